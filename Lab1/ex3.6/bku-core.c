@@ -0,0 +1,923 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * bku-core: the per-file loops of 'bku add', 'bku status' and 'bku commit'
+ * in one process. bku.sh still does its checks and calls this when it is
+ * installed. The files stay compatible with the shell version:
+ * latest-<path with / as _>.tmp snapshots, normal-format .diff files for
+ * 'patch -R' and 'diff -u' output for status.
+ *
+ * tracked_file is loaded once into a hash set. .bku/index remembers the
+ * size, mtime and content hash of every file last seen equal to its
+ * snapshot, so an untouched file costs two stat() calls. Diffs are
+ * computed in-process with Myers' algorithm.
+ */
+
+#define TRACKEDFILES ".bku/tracked_file"
+#define HISTORY ".bku/history.log"
+#define COMMITSDIR ".bku/commits"
+#define INDEXFILE ".bku/index"
+#define BUFFER_SIZE 4096
+#define CONTEXT 3          /* lines of context in status output, as diff -u */
+#define BINARY_PROBE 32768 /* bytes diff looks at to call a file binary */
+
+typedef struct {
+    char* data;
+    size_t size;
+} Buffer;
+
+/* A tracked file and its snapshot as they were when last found equal. */
+typedef struct {
+    long long size;
+    long long mtime; /* ns; -1 when it was too recent to trust */
+    long long snapSize;
+    long long snapMtime;
+    uint64_t hash;
+    int valid;
+} IndexEntry;
+
+typedef struct {
+    char* path;
+    IndexEntry index;
+} PathEntry;
+
+/* Paths in insertion order plus an open-addressing table of their indexes. */
+typedef struct {
+    PathEntry* entries;
+    int count;
+    int capacity;
+    int* slots; /* entry index + 1, 0 when empty */
+    size_t mask;
+    int dirty;  /* index entries changed since loading */
+} PathSet;
+
+typedef struct {
+    const char* text;
+    size_t len; /* including the newline, if the line has one */
+} Line;
+
+typedef struct {
+    Line* lines;
+    long count;
+    long* ids; /* equal lines of both files share an id */
+    char* changed;
+} DiffSide;
+
+typedef struct {
+    long a;        /* first deleted line of the old file */
+    long deleted;
+    long b;        /* first inserted line of the new file */
+    long inserted;
+} Change;
+
+int addFiles(PathSet* set, int count, char* files[]);
+int statusFiles(PathSet* set, int count, char* files[]);
+int commitFiles(PathSet* set, const char* message, int count, char* files[]);
+int loadTracked(PathSet* set);
+void loadIndex(PathSet* set);
+void saveIndex(PathSet* set);
+PathEntry* findPath(PathSet* set, const char* path);
+PathEntry* addPath(PathSet* set, const char* path);
+int readFile(const char* path, Buffer* buf);
+int writeFile(const char* path, const char* data, size_t size, mode_t mode);
+void flatName(const char* file, char* out, size_t size);
+void snapshotPath(const char* file, char* out, size_t size);
+int sameContents(PathSet* set, PathEntry* entry, const char* file, const struct stat* st, Buffer* buf,
+    const char* snapshot, const struct stat* snapSt, Buffer* snap);
+void recordEntry(PathSet* set, PathEntry* entry, const struct stat* st, const char* snapshot, uint64_t hash);
+int diffFiles(FILE* out, const Buffer* oldBuf, const Buffer* newBuf, int unified,
+    const char* oldPath, const struct stat* oldSt, const char* newPath, const struct stat* newSt);
+int logAction(const char* entry);
+uint64_t hashBytes(const void* data, size_t size);
+
+int main(int argc, char* argv[]) {
+    PathSet set = {NULL, 0, 0, NULL, 0, 0};
+    int status;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bku-core {add [files]|status [files]|commit <message> [files]}\n");
+        return 2;
+    }
+    if (loadTracked(&set) != 0)
+        return 1;
+    loadIndex(&set);
+
+    if (strcmp(argv[1], "add") == 0)
+        status = addFiles(&set, argc - 2, argv + 2);
+    else if (strcmp(argv[1], "status") == 0)
+        status = statusFiles(&set, argc - 2, argv + 2);
+    else if (strcmp(argv[1], "commit") == 0 && argc >= 3)
+        status = commitFiles(&set, argv[2], argc - 3, argv + 3);
+    else {
+        fprintf(stderr, "Usage: bku-core {add [files]|status [files]|commit <message> [files]}\n");
+        return 2;
+    }
+
+    if (set.dirty)
+        saveIndex(&set);
+    fflush(stdout);
+    return status;
+}
+
+/* Collects the regular files under the current directory for a bare 'add'. */
+static char** walkFiles;
+static int walkCount, walkCapacity;
+
+static int collectFile(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)st;
+    (void)ftw;
+    if (type == FTW_D && strcmp(path, "./.bku") == 0)
+        return FTW_SKIP_SUBTREE;
+    if (type != FTW_F)
+        return FTW_CONTINUE;
+    if (walkCount == walkCapacity) {
+        walkCapacity = walkCapacity ? 2 * walkCapacity : 256;
+        char** grown = realloc(walkFiles, walkCapacity * sizeof(char*));
+        if (grown == NULL)
+            return FTW_STOP;
+        walkFiles = grown;
+    }
+    if ((walkFiles[walkCount] = strdup(path + 2)) == NULL)
+        return FTW_STOP;
+    walkCount++;
+    return FTW_CONTINUE;
+}
+
+int addFiles(PathSet* set, int count, char* files[]) {
+    if (count == 0) {
+        if (nftw(".", collectFile, 64, FTW_PHYS | FTW_ACTIONRETVAL) != 0) {
+            perror("Error: Could not list files");
+            return 1;
+        }
+        count = walkCount;
+        files = walkFiles;
+    }
+
+    FILE* tracked = fopen(TRACKEDFILES, "a");
+    if (tracked == NULL) {
+        perror("Error: Could not open " TRACKEDFILES);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const char* file = files[i];
+        char snapshot[BUFFER_SIZE];
+        struct stat st;
+        Buffer buf;
+
+        if (stat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+            printf("Error: %s does not exist.\n", file);
+            continue;
+        }
+        PathEntry* entry = findPath(set, file);
+        if (entry == NULL) {
+            if ((entry = addPath(set, file)) == NULL) {
+                perror("Error: Memory allocation failed");
+                break;
+            }
+            fprintf(tracked, "%s\n", file);
+            printf("Added %s to backup tracking.\n", file);
+        }
+        else
+            printf("Error: %s is already tracked.\n", file);
+
+        snapshotPath(file, snapshot, sizeof(snapshot));
+        if (readFile(file, &buf) != 0 || writeFile(snapshot, buf.data, buf.size, st.st_mode) != 0) {
+            fprintf(stderr, "cp: %s: %s\n", file, strerror(errno));
+            free(buf.data);
+            continue;
+        }
+        recordEntry(set, entry, &st, snapshot, hashBytes(buf.data, buf.size));
+        free(buf.data);
+    }
+    return fclose(tracked) == 0 ? 0 : 1;
+}
+
+int statusFiles(PathSet* set, int count, char* files[]) {
+    int all = count == 0;
+    if (all)
+        count = set->count;
+
+    for (int i = 0; i < count; i++) {
+        const char* file = all ? set->entries[i].path : files[i];
+        PathEntry* entry = findPath(set, file);
+        char snapshot[BUFFER_SIZE];
+        struct stat st, snapSt;
+        Buffer buf = {NULL, 0}, snap = {NULL, 0};
+
+        if (entry == NULL) {
+            printf("Error: %s is not tracked.\n", file);
+            continue;
+        }
+        snapshotPath(file, snapshot, sizeof(snapshot));
+        if (stat(snapshot, &snapSt) != 0 || stat(file, &st) != 0) {
+            fprintf(stderr, "diff: %s: %s\n", file, strerror(errno));
+            printf("%s: No changes\n", file);
+            continue;
+        }
+
+        int same = sameContents(set, entry, file, &st, &buf, snapshot, &snapSt, &snap);
+        if (same != 0) {
+            if (same < 0)
+                fprintf(stderr, "diff: %s: %s\n", file, strerror(errno));
+            printf("%s: No changes\n", file);
+        }
+        else {
+            printf("%s:\n", file);
+            fflush(stdout);
+            diffFiles(stdout, &snap, &buf, 1, snapshot, &snapSt, file, &st);
+        }
+        free(buf.data);
+        free(snap.data);
+    }
+    return 0;
+}
+
+int commitFiles(PathSet* set, const char* message, int count, char* files[]) {
+    time_t now = time(NULL);
+    struct tm tm;
+    char commitId[64], commitIdName[64];
+    char* changedFiles = NULL;
+    size_t changedSize = 0;
+    FILE* changed = open_memstream(&changedFiles, &changedSize);
+    int all = count == 0;
+
+    localtime_r(&now, &tm);
+    strftime(commitId, sizeof(commitId), "%H:%M-%d/%m/%Y", &tm);
+    strftime(commitIdName, sizeof(commitIdName), "%H-%M-%d_%m_%Y", &tm);
+    if (changed == NULL) {
+        perror("Error: Memory allocation failed");
+        return 1;
+    }
+    if (all)
+        count = set->count;
+
+    for (int i = 0; i < count; i++) {
+        const char* file = all ? set->entries[i].path : files[i];
+        PathEntry* entry = findPath(set, file);
+        char name[BUFFER_SIZE], snapshot[BUFFER_SIZE], commitFile[2 * BUFFER_SIZE];
+        struct stat st, snapSt;
+        Buffer buf = {NULL, 0}, snap = {NULL, 0}, diff = {NULL, 0};
+
+        if (entry == NULL) {
+            printf("%s is not tracked.\n", file);
+            continue;
+        }
+        snapshotPath(file, snapshot, sizeof(snapshot));
+        int hasSnapshot = stat(snapshot, &snapSt) == 0;
+        int same = 0;
+        if (stat(file, &st) != 0 || (!hasSnapshot && readFile(file, &buf) != 0) ||
+            (hasSnapshot && (same = sameContents(set, entry, file, &st, &buf, snapshot, &snapSt, &snap)) < 0)) {
+            fprintf(stderr, "%s: %s: %s\n", hasSnapshot ? "diff" : "cat", file, strerror(errno));
+            free(buf.data);
+            free(snap.data);
+            continue;
+        }
+
+        if (!hasSnapshot) {
+            diff.data = buf.data;
+            diff.size = buf.size;
+        }
+        else if (!same) {
+            FILE* out = open_memstream(&diff.data, &diff.size);
+            if (out == NULL || diffFiles(out, &snap, &buf, 0, snapshot, &snapSt, file, &st) != 0) {
+                perror("Error: Could not compute the diff");
+                if (out != NULL)
+                    fclose(out);
+                free(diff.data);
+                free(buf.data);
+                free(snap.data);
+                continue;
+            }
+            fclose(out);
+        }
+
+        /* bku.sh stored "$(diff ...)", so trailing newlines become exactly one. */
+        while (diff.size > 0 && diff.data[diff.size - 1] == '\n')
+            diff.size--;
+        if (diff.size > 0) {
+            flatName(file, name, sizeof(name));
+            snprintf(commitFile, sizeof(commitFile), "%s/%s-%s.diff", COMMITSDIR, commitIdName, name);
+            diff.data[diff.size++] = '\n';
+            if (writeFile(commitFile, diff.data, diff.size, 0644) != 0 ||
+                writeFile(snapshot, buf.data, buf.size, st.st_mode) != 0)
+                fprintf(stderr, "Error: Could not commit %s: %s\n", file, strerror(errno));
+            else {
+                recordEntry(set, entry, &st, snapshot, hashBytes(buf.data, buf.size));
+                printf("Committed %s with ID %s.\n", file, commitId);
+                fprintf(changed, "%s%s", ftell(changed) > 0 ? "," : "", file);
+            }
+        }
+        if (diff.data != buf.data)
+            free(diff.data);
+        free(buf.data);
+        free(snap.data);
+    }
+
+    fclose(changed);
+    if (changedSize == 0) {
+        printf("Error: No change to commit.\n");
+        free(changedFiles);
+        return 1;
+    }
+
+    char* entry;
+    int status = 1;
+    if (asprintf(&entry, "%s: %s (%s).", commitId, message, changedFiles) >= 0) {
+        status = logAction(entry);
+        free(entry);
+    }
+    free(changedFiles);
+    return status;
+}
+
+/*
+ * Says whether file equals its snapshot: 1 if so, 0 if not, -1 with errno
+ * set when one cannot be read. Trusts the index when neither file's stat
+ * changed, and the content hash when only the working file was touched.
+ * Whatever it has to read is left in buf and snap for the caller.
+ */
+int sameContents(PathSet* set, PathEntry* entry, const char* file, const struct stat* st, Buffer* buf,
+    const char* snapshot, const struct stat* snapSt, Buffer* snap) {
+    IndexEntry* index = &entry->index;
+    long long mtime = st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    long long snapMtime = snapSt->st_mtim.tv_sec * 1000000000LL + snapSt->st_mtim.tv_nsec;
+    int snapshotKnown = index->valid && index->snapSize == snapSt->st_size && index->snapMtime == snapMtime;
+
+    if (snapshotKnown && index->size == st->st_size && index->mtime == mtime)
+        return 1;
+    if (buf->data == NULL && readFile(file, buf) != 0)
+        return -1;
+    uint64_t hash = hashBytes(buf->data, buf->size);
+    if (snapshotKnown && index->size == st->st_size && index->hash == hash) {
+        recordEntry(set, entry, st, snapshot, hash);
+        return 1;
+    }
+
+    if (snap->data == NULL && readFile(snapshot, snap) != 0)
+        return -1;
+    if (snap->size != buf->size || memcmp(snap->data, buf->data, buf->size) != 0)
+        return 0;
+    recordEntry(set, entry, st, snapshot, hash);
+    return 1;
+}
+
+void recordEntry(PathSet* set, PathEntry* entry, const struct stat* st, const char* snapshot, uint64_t hash) {
+    IndexEntry* index = &entry->index;
+    struct stat snapSt;
+
+    if (stat(snapshot, &snapSt) != 0) {
+        index->valid = 0;
+        return;
+    }
+    index->size = st->st_size;
+    /* A file written this second may change again without its mtime moving. */
+    index->mtime = st->st_mtim.tv_sec >= time(NULL) - 1 ? -1 :
+        st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    index->snapSize = snapSt.st_size;
+    index->snapMtime = snapSt.st_mtim.tv_sec * 1000000000LL + snapSt.st_mtim.tv_nsec;
+    index->hash = hash;
+    index->valid = 1;
+    set->dirty = 1;
+}
+
+/* A path with every / turned into _, as bku.sh names its commit files. */
+void flatName(const char* file, char* out, size_t size) {
+    size_t len = 0;
+    for (; file[len] != '\0' && len + 1 < size; len++)
+        out[len] = file[len] == '/' ? '_' : file[len];
+    out[len] = '\0';
+}
+
+/* The last committed copy of a file. */
+void snapshotPath(const char* file, char* out, size_t size) {
+    char name[BUFFER_SIZE];
+    flatName(file, name, sizeof(name));
+    snprintf(out, size, "%s/latest-%s.tmp", COMMITSDIR, name);
+}
+
+/* Appends entry on top of the history, newest first like log_action. */
+int logAction(const char* entry) {
+    Buffer old = {NULL, 0};
+    char tmp[] = HISTORY ".tmp";
+    FILE* out = fopen(tmp, "w");
+
+    if (out == NULL) {
+        perror("Error: Could not write " HISTORY);
+        return 1;
+    }
+    if (readFile(HISTORY, &old) != 0)
+        old.size = 0;
+    fprintf(out, "%s\n", entry);
+    fwrite(old.data, 1, old.size, out);
+    free(old.data);
+    if (fclose(out) != 0 || rename(tmp, HISTORY) != 0) {
+        perror("Error: Could not write " HISTORY);
+        return 1;
+    }
+    return 0;
+}
+
+/* FNV-1a. */
+uint64_t hashBytes(const void* data, size_t size) {
+    const unsigned char* p = data;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* ---- path set and index ---- */
+
+PathEntry* findPath(PathSet* set, const char* path) {
+    if (set->slots == NULL)
+        return NULL;
+    for (size_t slot = hashBytes(path, strlen(path)) & set->mask; set->slots[slot] != 0;
+        slot = (slot + 1) & set->mask) {
+        PathEntry* entry = &set->entries[set->slots[slot] - 1];
+        if (strcmp(entry->path, path) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static int growSet(PathSet* set) {
+    size_t slots = set->slots == NULL ? 1024 : 2 * (set->mask + 1);
+    int* table = calloc(slots, sizeof(int));
+    PathEntry* entries = realloc(set->entries, slots / 2 * sizeof(PathEntry));
+    if (table == NULL || entries == NULL) {
+        free(table);
+        if (entries != NULL)
+            set->entries = entries;
+        return -1;
+    }
+
+    set->entries = entries;
+    set->capacity = slots / 2;
+    set->mask = slots - 1;
+    free(set->slots);
+    set->slots = table;
+    for (int i = 0; i < set->count; i++) {
+        size_t slot = hashBytes(entries[i].path, strlen(entries[i].path)) & set->mask;
+        while (table[slot] != 0)
+            slot = (slot + 1) & set->mask;
+        table[slot] = i + 1;
+    }
+    return 0;
+}
+
+/* Adds path if it is new; returns its entry, or NULL when out of memory. */
+PathEntry* addPath(PathSet* set, const char* path) {
+    PathEntry* entry = findPath(set, path);
+    if (entry != NULL)
+        return entry;
+    if (set->count == set->capacity && growSet(set) != 0)
+        return NULL;
+
+    entry = &set->entries[set->count];
+    memset(entry, 0, sizeof(*entry));
+    if ((entry->path = strdup(path)) == NULL)
+        return NULL;
+    size_t slot = hashBytes(path, strlen(path)) & set->mask;
+    while (set->slots[slot] != 0)
+        slot = (slot + 1) & set->mask;
+    set->slots[slot] = ++set->count;
+    return entry;
+}
+
+int loadTracked(PathSet* set) {
+    Buffer buf;
+    if (readFile(TRACKEDFILES, &buf) != 0) {
+        perror("Error: Could not read " TRACKEDFILES);
+        return 1;
+    }
+    for (char* line = buf.data; line < buf.data + buf.size; ) {
+        char* end = memchr(line, '\n', buf.data + buf.size - line);
+        if (end == NULL)
+            end = buf.data + buf.size;
+        *end = '\0';
+        if (*line != '\0' && addPath(set, line) == NULL) {
+            perror("Error: Memory allocation failed");
+            return 1;
+        }
+        line = end + 1;
+    }
+    free(buf.data);
+    return 0;
+}
+
+/* Index lines: size mtime snapshot-size snapshot-mtime hash TAB path. */
+void loadIndex(PathSet* set) {
+    Buffer buf;
+    if (readFile(INDEXFILE, &buf) != 0)
+        return;
+    for (char* line = buf.data; line < buf.data + buf.size; ) {
+        char* end = memchr(line, '\n', buf.data + buf.size - line);
+        if (end == NULL)
+            break;
+        *end = '\0';
+        char* tab = strchr(line, '\t');
+        IndexEntry index;
+        if (tab != NULL && sscanf(line, "%lld %lld %lld %lld %" SCNx64, &index.size, &index.mtime,
+            &index.snapSize, &index.snapMtime, &index.hash) == 5) {
+            PathEntry* entry = findPath(set, tab + 1);
+            if (entry != NULL) {
+                index.valid = 1;
+                entry->index = index;
+            }
+        }
+        line = end + 1;
+    }
+    free(buf.data);
+}
+
+void saveIndex(PathSet* set) {
+    char tmp[] = INDEXFILE ".tmp";
+    FILE* out = fopen(tmp, "w");
+    if (out == NULL)
+        return;
+    for (int i = 0; i < set->count; i++) {
+        const IndexEntry* index = &set->entries[i].index;
+        if (index->valid)
+            fprintf(out, "%lld %lld %lld %lld %016" PRIx64 "\t%s\n", index->size, index->mtime,
+                index->snapSize, index->snapMtime, index->hash, set->entries[i].path);
+    }
+    if (fclose(out) != 0 || rename(tmp, INDEXFILE) != 0)
+        unlink(tmp);
+}
+
+/* ---- file helpers ---- */
+
+/* Reads a whole file into a buffer with one spare byte; returns 0 or -1 with errno set. */
+int readFile(const char* path, Buffer* buf) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    buf->data = NULL;
+    buf->size = 0;
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || (buf->data = malloc(st.st_size + 1)) == NULL) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    while (buf->size < (size_t)st.st_size) {
+        ssize_t got = read(fd, buf->data + buf->size, st.st_size - buf->size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        buf->size += got;
+    }
+    close(fd);
+    return 0;
+}
+
+int writeFile(const char* path, const char* data, size_t size, mode_t mode) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode & 0777);
+    if (fd < 0)
+        return -1;
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return close(fd);
+}
+
+/* ---- diff ---- */
+
+static int splitLines(const Buffer* buf, DiffSide* side) {
+    long count = 0;
+    for (const char* p = buf->data; p < buf->data + buf->size; count++) {
+        const char* end = memchr(p, '\n', buf->data + buf->size - p);
+        p = end != NULL ? end + 1 : buf->data + buf->size;
+    }
+
+    side->count = count;
+    side->lines = malloc((count + 1) * sizeof(Line));
+    side->ids = malloc((count + 1) * sizeof(long));
+    side->changed = calloc(count + 1, 1);
+    if (side->lines == NULL || side->ids == NULL || side->changed == NULL)
+        return -1;
+
+    const char* p = buf->data;
+    for (long i = 0; i < count; i++) {
+        const char* end = memchr(p, '\n', buf->data + buf->size - p);
+        side->lines[i].text = p;
+        side->lines[i].len = end != NULL ? (size_t)(end + 1 - p) : (size_t)(buf->data + buf->size - p);
+        p += side->lines[i].len;
+    }
+    return 0;
+}
+
+/* Numbers the distinct lines of both files so the diff compares integers. */
+static int assignIds(DiffSide* a, DiffSide* b) {
+    size_t slots = 16;
+    while (slots < 2 * (size_t)(a->count + b->count))
+        slots <<= 1;
+    const Line** table = calloc(slots, sizeof(Line*));
+    uint64_t* hashes = malloc(slots * sizeof(uint64_t));
+    long* ids = malloc(slots * sizeof(long));
+    long next = 0;
+
+    if (table == NULL || hashes == NULL || ids == NULL) {
+        free(table);
+        free(hashes);
+        free(ids);
+        return -1;
+    }
+    for (int s = 0; s < 2; s++) {
+        DiffSide* side = s == 0 ? a : b;
+        for (long i = 0; i < side->count; i++) {
+            const Line* line = &side->lines[i];
+            uint64_t hash = hashBytes(line->text, line->len);
+            size_t slot = hash & (slots - 1);
+            while (table[slot] != NULL && (hashes[slot] != hash || table[slot]->len != line->len ||
+                memcmp(table[slot]->text, line->text, line->len) != 0))
+                slot = (slot + 1) & (slots - 1);
+            if (table[slot] == NULL) {
+                table[slot] = line;
+                hashes[slot] = hash;
+                ids[slot] = next++;
+            }
+            side->ids[i] = ids[slot];
+        }
+    }
+    free(table);
+    free(hashes);
+    free(ids);
+    return 0;
+}
+
+typedef struct {
+    DiffSide* a;
+    DiffSide* b;
+    long* v1; /* furthest reach of the forward and reverse searches per diagonal */
+    long* v2;
+} DiffContext;
+
+/*
+ * Finds a point on an optimal path through a[aLo,aHi) x b[bLo,bHi) by
+ * running Myers' search from both ends until they overlap. Returns 0 when
+ * the searches never meet, which only a degenerate input causes.
+ */
+static int bisect(DiffContext* ctx, long aLo, long aHi, long bLo, long bHi, long* splitA, long* splitB) {
+    const long* A = ctx->a->ids + aLo;
+    const long* B = ctx->b->ids + bLo;
+    long n = aHi - aLo, m = bHi - bLo;
+    long maxD = (n + m + 1) / 2, offset = maxD, length = 2 * maxD;
+    long delta = n - m;
+    int front = delta % 2 != 0;
+    long k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+    long* v1 = ctx->v1;
+    long* v2 = ctx->v2;
+
+    for (long i = 0; i < length; i++)
+        v1[i] = v2[i] = -1;
+    v1[offset + 1] = v2[offset + 1] = 0;
+
+    for (long d = 0; d < maxD; d++) {
+        for (long k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+            long k1off = offset + k1;
+            long x1 = (k1 == -d || (k1 != d && v1[k1off - 1] < v1[k1off + 1])) ? v1[k1off + 1] : v1[k1off - 1] + 1;
+            long y1 = x1 - k1;
+            while (x1 < n && y1 < m && A[x1] == B[y1]) {
+                x1++;
+                y1++;
+            }
+            v1[k1off] = x1;
+            if (x1 > n)
+                k1end += 2;
+            else if (y1 > m)
+                k1start += 2;
+            else if (front) {
+                long k2off = offset + delta - k1;
+                if (k2off >= 0 && k2off < length && v2[k2off] != -1 && x1 >= n - v2[k2off]) {
+                    *splitA = aLo + x1;
+                    *splitB = bLo + y1;
+                    return 1;
+                }
+            }
+        }
+        for (long k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+            long k2off = offset + k2;
+            long x2 = (k2 == -d || (k2 != d && v2[k2off - 1] < v2[k2off + 1])) ? v2[k2off + 1] : v2[k2off - 1] + 1;
+            long y2 = x2 - k2;
+            while (x2 < n && y2 < m && A[n - x2 - 1] == B[m - y2 - 1]) {
+                x2++;
+                y2++;
+            }
+            v2[k2off] = x2;
+            if (x2 > n)
+                k2end += 2;
+            else if (y2 > m)
+                k2start += 2;
+            else if (!front) {
+                long k1off = offset + delta - k2;
+                if (k1off >= 0 && k1off < length && v1[k1off] != -1 && v1[k1off] >= n - x2) {
+                    *splitA = aLo + v1[k1off];
+                    *splitB = bLo + offset + v1[k1off] - k1off;
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* Marks the lines of a[aLo,aHi) and b[bLo,bHi) that a shortest edit script changes. */
+static void compareSeq(DiffContext* ctx, long aLo, long aHi, long bLo, long bHi) {
+    const long* A = ctx->a->ids;
+    const long* B = ctx->b->ids;
+    long splitA, splitB;
+
+    while (aLo < aHi && bLo < bHi && A[aLo] == B[bLo]) {
+        aLo++;
+        bLo++;
+    }
+    while (aLo < aHi && bLo < bHi && A[aHi - 1] == B[bHi - 1]) {
+        aHi--;
+        bHi--;
+    }
+    if (aLo == aHi || bLo == bHi || !bisect(ctx, aLo, aHi, bLo, bHi, &splitA, &splitB) ||
+        (splitA == aLo && splitB == bLo) || (splitA == aHi && splitB == bHi)) {
+        memset(ctx->a->changed + aLo, 1, aHi - aLo);
+        memset(ctx->b->changed + bLo, 1, bHi - bLo);
+        return;
+    }
+    compareSeq(ctx, aLo, splitA, bLo, splitB);
+    compareSeq(ctx, splitA, aHi, splitB, bHi);
+}
+
+static void printLine(FILE* out, const char* prefix, const Line* line) {
+    fputs(prefix, out);
+    fwrite(line->text, 1, line->len, out);
+    if (line->len == 0 || line->text[line->len - 1] != '\n')
+        fputs("\n\\ No newline at end of file\n", out);
+}
+
+/* A line range the way diff prints it: first,last in normal format, first,count in unified. */
+static void printRange(FILE* out, long start, long count, int unified) {
+    if (count == 0)
+        fprintf(out, unified ? "%ld,0" : "%ld", start);
+    else if (count == 1)
+        fprintf(out, "%ld", start + 1);
+    else
+        fprintf(out, "%ld,%ld", start + 1, unified ? count : start + count);
+}
+
+static void printNormal(FILE* out, const DiffSide* a, const DiffSide* b, const Change* changes, long count) {
+    for (long i = 0; i < count; i++) {
+        const Change* c = &changes[i];
+        printRange(out, c->a, c->deleted, 0);
+        fputc(c->deleted == 0 ? 'a' : c->inserted == 0 ? 'd' : 'c', out);
+        printRange(out, c->b, c->inserted, 0);
+        fputc('\n', out);
+        for (long k = 0; k < c->deleted; k++)
+            printLine(out, "< ", &a->lines[c->a + k]);
+        if (c->deleted > 0 && c->inserted > 0)
+            fputs("---\n", out);
+        for (long k = 0; k < c->inserted; k++)
+            printLine(out, "> ", &b->lines[c->b + k]);
+    }
+}
+
+static void printHeader(FILE* out, const char* mark, const char* path, const struct stat* st) {
+    char stamp[64], zone[16];
+    struct tm tm;
+    localtime_r(&st->st_mtim.tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    strftime(zone, sizeof(zone), "%z", &tm);
+    fprintf(out, "%s %s\t%s.%09ld %s\n", mark, path, stamp, st->st_mtim.tv_nsec, zone);
+}
+
+/* Changes closer than 2 * CONTEXT lines share a hunk, as in diff -u. */
+static void printUnified(FILE* out, const DiffSide* a, const DiffSide* b, const Change* changes, long count) {
+    for (long i = 0; i < count; ) {
+        long j = i;
+        while (j + 1 < count && changes[j + 1].a - (changes[j].a + changes[j].deleted) <= 2 * CONTEXT)
+            j++;
+
+        const Change* first = &changes[i];
+        const Change* last = &changes[j];
+        long before = first->a < CONTEXT ? first->a : CONTEXT;
+        long after = a->count - (last->a + last->deleted);
+        if (after > CONTEXT)
+            after = CONTEXT;
+        long aStart = first->a - before, aEnd = last->a + last->deleted + after;
+        long bStart = first->b - before, bEnd = last->b + last->inserted + after;
+
+        fputs("@@ -", out);
+        printRange(out, aStart, aEnd - aStart, 1);
+        fputs(" +", out);
+        printRange(out, bStart, bEnd - bStart, 1);
+        fputs(" @@\n", out);
+
+        long pos = aStart;
+        for (long k = i; k <= j; k++) {
+            for (; pos < changes[k].a; pos++)
+                printLine(out, " ", &a->lines[pos]);
+            for (long d = 0; d < changes[k].deleted; d++)
+                printLine(out, "-", &a->lines[pos++]);
+            for (long n = 0; n < changes[k].inserted; n++)
+                printLine(out, "+", &b->lines[changes[k].b + n]);
+        }
+        for (; pos < aEnd; pos++)
+            printLine(out, " ", &a->lines[pos]);
+        i = j + 1;
+    }
+}
+
+static int isBinary(const Buffer* buf) {
+    return memchr(buf->data, '\0', buf->size < BINARY_PROBE ? buf->size : BINARY_PROBE) != NULL;
+}
+
+/*
+ * Writes the differences from oldBuf to newBuf as 'diff -u' (unified) or
+ * plain 'diff' would. The paths and stats are only used for the unified
+ * headers. Returns 0, or -1 when out of memory.
+ */
+int diffFiles(FILE* out, const Buffer* oldBuf, const Buffer* newBuf, int unified,
+    const char* oldPath, const struct stat* oldSt, const char* newPath, const struct stat* newSt) {
+    DiffSide a = {NULL, 0, NULL, NULL}, b = {NULL, 0, NULL, NULL};
+    DiffContext ctx = {&a, &b, NULL, NULL};
+    Change* changes = NULL;
+    long count = 0;
+    int status = -1;
+
+    if (isBinary(oldBuf) || isBinary(newBuf)) {
+        fprintf(out, "Binary files %s and %s differ\n", oldPath, newPath);
+        return 0;
+    }
+    if (splitLines(oldBuf, &a) != 0 || splitLines(newBuf, &b) != 0 || assignIds(&a, &b) != 0)
+        goto done;
+    ctx.v1 = malloc((a.count + b.count + 2) * sizeof(long));
+    ctx.v2 = malloc((a.count + b.count + 2) * sizeof(long));
+    changes = malloc((a.count + b.count + 1) * sizeof(Change));
+    if (ctx.v1 == NULL || ctx.v2 == NULL || changes == NULL)
+        goto done;
+    compareSeq(&ctx, 0, a.count, 0, b.count);
+
+    /* Unchanged lines pair up in order, so runs of changed lines form the changes. */
+    for (long i = 0, j = 0; i < a.count || j < b.count; ) {
+        if (i < a.count && j < b.count && !a.changed[i] && !b.changed[j]) {
+            i++;
+            j++;
+            continue;
+        }
+        Change* c = &changes[count++];
+        c->a = i;
+        c->b = j;
+        while (i < a.count && a.changed[i])
+            i++;
+        while (j < b.count && b.changed[j])
+            j++;
+        c->deleted = i - c->a;
+        c->inserted = j - c->b;
+    }
+
+    if (count > 0 && unified) {
+        printHeader(out, "---", oldPath, oldSt);
+        printHeader(out, "+++", newPath, newSt);
+        printUnified(out, &a, &b, changes, count);
+    }
+    else if (count > 0)
+        printNormal(out, &a, &b, changes, count);
+    status = 0;
+
+done:
+    free(a.lines);
+    free(a.ids);
+    free(a.changed);
+    free(b.lines);
+    free(b.ids);
+    free(b.changed);
+    free(ctx.v1);
+    free(ctx.v2);
+    free(changes);
+    return status;
+}
@@ -4,6 +4,8 @@ BKUDIR='.bku'
 TRACKEDFILES='.bku/tracked_file'
 HISTORY='.bku/history.log'
 COMMITSDIR='.bku/commits'
+# Compiled add/status/commit loops (bku-core.c); the shell loops below are the fallback.
+BKUCORE=$(command -v bku-core 2>/dev/null || echo "$(dirname "$(realpath "$0")")/bku-core")
 
 check(){
     if [ ! -d "$BKUDIR" ]; then
@@ -27,6 +29,11 @@ init(){
 
 add(){
     check
+
+	if [ -x "$BKUCORE" ]; then
+		"$BKUCORE" add "$@"
+		return
+	fi
 	
 	if [ $# -eq 0 ]; then
         files=()
@@ -62,6 +69,11 @@ status(){
 		return
 	fi
 
+	if [ -x "$BKUCORE" ]; then
+		"$BKUCORE" status "$@"
+		return
+	fi
+
 	if [ $# -eq 0 ]; then
 		mapfile -t files < "$TRACKEDFILES"
 	else
@@ -115,12 +127,17 @@ commit(){
 		return
 	fi
 
+	if [ -x "$BKUCORE" ]; then
+		"$BKUCORE" commit "$commitMessage" "$@" || exit 1
+		return
+	fi
+
 	if [ $# -eq 0 ]; then
 		mapfile -t files < "$TRACKEDFILES"
 	else
 		files=("$@")
 	fi
-	changedFiles=""
+	changedFiles=()
 	changesMade=false
 
 	for file in "${files[@]}"; do
@@ -144,7 +161,7 @@ commit(){
             echo "$diffOutput" > "$commitFile"
 			cp "$file" "$prevFile"
             echo "Committed $file with ID $commitId."
-            changedFiles+="$file"
+            changedFiles+=("$file")
             changesMade=true
         fi
 	done
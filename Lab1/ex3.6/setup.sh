@@ -1,6 +1,7 @@
 #!/bin/bash
 
 BKU_PATH="/usr/local/bin/bku"
+BKU_CORE_PATH="/usr/local/bin/bku-core"
 DEPENDENCIES=("diff" "cron")
 
 checkDependencies(){
@@ -36,6 +37,13 @@ install(){
     sudo cp bku.sh "$BKU_PATH"
     sudo chmod +x "$BKU_PATH"
     echo BKU installed to "$BKU_PATH"
+    # Optional: bku.sh falls back to its shell loops without the compiled core.
+    if command -v make &>/dev/null && make -s bku-core; then
+        sudo cp bku-core "$BKU_CORE_PATH"
+        echo BKU core installed to "$BKU_CORE_PATH"
+    else
+        echo Warning: Could not build bku-core, using the shell implementation.
+    fi
 }
 
 uninstall(){
@@ -47,6 +55,7 @@ uninstall(){
     fi
     echo Removing BKU from "$BKU_PATH"
     sudo rm "$BKU_PATH"
+    sudo rm -f "$BKU_CORE_PATH"
     echo Removing scheduled backups...
     crontab -l | grep -v "$BKU_PATH" | crontab - 
     echo BKU successfully uninstalled.
@@ -1,7 +1,14 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #if __has_include(<regex.h>)
 #include <regex.h>
@@ -10,18 +17,69 @@
 #define USE_REGEX 0
 #endif
 
+#include "template.h"
+#include "templates.h"
+
 #define BUFFER_SIZE 256
 
+extern char** environ;
+
+static int verbose = 1; /* per-step messages; batch mode prints a summary instead */
+
+/* Milliseconds spent in each phase of one project. */
+typedef struct {
+    double create;
+    double build;
+    double run;
+    double test;
+} PhaseTimes;
+
+/* The templates of one file of a project kind, compiled at startup. */
+typedef struct {
+    CompiledTemplate path;
+    CompiledTemplate text;
+} CompiledFile;
+
+static CompiledFile* compiledKinds[PROJECT_KIND_COUNT];
+static CompiledFile compiledGitignore;
+
+typedef struct {
+    char* name;
+    int kind;
+    int withGit;
+    int failed;
+    PhaseTimes times;
+} BatchEntry;
+
+/* Projects of a batch; workers claim the next one with an atomic add. */
+typedef struct {
+    BatchEntry* entries;
+    int count;
+    int next;
+} BatchQueue;
+
 void helpDisplay();
 int isValidProjectName(const char* name);
-void createFile(const char* path, const char* content);
-int createProject(const char* name, int withGit);
+int compileTemplates();
+int findProjectKind(const char* name);
+int createProject(const char* name, int withGit, int kind);
 int checkGitInstalled();
-int verifyBuild(const char* name);
+int verifyBuild(const char* name, PhaseTimes* times, int runTests);
+int runCommand(char* const argv[], char* output, size_t size);
+double nowMs();
+int runBatch(const char* manifest, int jobs, int withGit, int kind, int timing);
 
 int main(int argc, char* argv[]) {
     char* projectName = NULL;
+    char* manifest = NULL;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
     int withGit = 0;
+    int kind = 0;
+    int timing = 0;
+    PhaseTimes times = {0, 0, 0, 0};
+
+    if (compileTemplates() != 0)
+        exit(1);
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--name") == 0) {
@@ -32,8 +90,30 @@ int main(int argc, char* argv[]) {
                 exit(1);
             }
         }
+        else if (strcmp(argv[i], "--batch") == 0) {
+            if (i + 1 < argc)
+                manifest = argv[++i];
+            else {
+                fprintf(stderr, "Error: Missing manifest file after '--batch'.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-j") == 0) {
+            if (i + 1 < argc && (jobs = atoi(argv[++i])) > 0)
+                continue;
+            fprintf(stderr, "Error: '-j' needs a positive number of workers.\n");
+            exit(1);
+        }
+        else if (strcmp(argv[i], "--kind") == 0) {
+            if (i + 1 < argc && (kind = findProjectKind(argv[++i])) >= 0)
+                continue;
+            fprintf(stderr, "Error: '--kind' needs one of the kinds listed by 'cnew --help'.\n");
+            exit(1);
+        }
         else if (strcmp(argv[i], "--with-git") == 0)
             withGit = 1;
+        else if (strcmp(argv[i], "--timing") == 0)
+            timing = 1;
         else if (strcmp(argv[i], "--help") == 0)
             helpDisplay();
         else {
@@ -42,6 +122,13 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (manifest != NULL && projectName != NULL) {
+        fprintf(stderr, "Error: '--name' and '--batch' cannot be combined.\n");
+        exit(1);
+    }
+    if (manifest != NULL)
+        return runBatch(manifest, jobs, withGit, kind, timing) == 0 ? 0 : 1;
+
     if (projectName == NULL) {
         fprintf(stderr, "Error: Missing required '--name' option.\n");
         exit(1);
@@ -52,16 +139,22 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
-    if (createProject(projectName, withGit) != 0) {
+    double start = nowMs();
+    if (createProject(projectName, withGit, kind) != 0) {
         fprintf(stderr, "Failed to create project '%s'.", projectName);
         exit(1);
     }
+    times.create = nowMs() - start;
 
-    if (verifyBuild(projectName) != 0) {
+    if (verifyBuild(projectName, &times, projectKinds[kind].hasTests) != 0) {
         fprintf(stderr, "Failed to verify project '%s' build.", projectName);
         exit(1);
     }
 
+    if (timing)
+        printf("Timing: create %.1f ms, build %.1f ms, run %.1f ms, test %.1f ms, total %.1f ms\n",
+            times.create, times.build, times.run, times.test, nowMs() - start);
+
     return 0;
 }
 
@@ -70,24 +163,37 @@ void helpDisplay() {
     printf("Options:\n");
     printf("  --name <project-name>    Create a new C project with the given name (required).\n");
     printf("                           Name must contain only letters, numbers, and hyphens.\n");
+    printf("  --kind <kind>            Project layout to create (default: app):\n");
+    for (int i = 0; i < PROJECT_KIND_COUNT; i++)
+        printf("                             %-6s %s\n", projectKinds[i].name, projectKinds[i].description);
+    printf("  --batch <manifest>       Create every project listed in the manifest, one name per line,\n");
+    printf("                           optionally followed by --with-git and --kind <kind>. Blank\n");
+    printf("                           lines and lines starting with '#' are skipped.\n");
+    printf("  -j <workers>             Projects created and verified at once with --batch\n");
+    printf("                           (default: number of CPUs).\n");
     printf("  --with-git               Initialize the project as a Git repository with a .gitignore.\n");
+    printf("  --timing                 Report how long creating, building, running and testing took.\n");
     printf("  --help                   Display this help message.\n");
     printf("Example:\n");
     printf("  cnew --name my-project --with-git\n");
+    printf("  cnew --name my-lib --kind lib\n");
+    printf("  cnew --batch projects.txt -j 8 --timing\n");
     exit(0);
 }
 
+/* The pattern is compiled on the first call and kept; call it from one thread. */
 int isValidProjectName(const char* name) {
 #if USE_REGEX == 1
-    regex_t regex;
-    int ret = regcomp(&regex, "^[a-zA-Z0-9-]+$", REG_EXTENDED);
-    if (ret) {
-        fprintf(stderr, "Error: Failed to compile regex.\n");
-        return 1;
+    static regex_t regex;
+    static int compiled = 0;
+    if (!compiled) {
+        if (regcomp(&regex, "^[a-zA-Z0-9-]+$", REG_EXTENDED | REG_NOSUB)) {
+            fprintf(stderr, "Error: Failed to compile regex.\n");
+            return 1;
+        }
+        compiled = 1;
     }
-    ret = regexec(&regex, name, 0, NULL, 0);
-    regfree(&regex);
-    if (ret == 0)  return 0;
+    if (regexec(&regex, name, 0, NULL, 0) == 0)  return 0;
 #else
     for (int i = 0; name[i] != '\0'; i++) {
         if (!(('a' <= name[i] && name[i] <= 'z') ||
@@ -101,129 +207,403 @@ int isValidProjectName(const char* name) {
     return -1;
 }
 
-void createFile(const char* path, const char* content) {
-    FILE* file = fopen(path, "w");
-    if (file == NULL) {
-        fprintf(stderr, "Error creating file '%s'", path);
-        exit(1);
+/* Compiles every embedded template once; call before any project is made. */
+int compileTemplates() {
+    for (int k = 0; k < PROJECT_KIND_COUNT; k++) {
+        int count = 0;
+        while (projectKinds[k].files[count].path != NULL)
+            count++;
+        compiledKinds[k] = malloc(count * sizeof(CompiledFile));
+        if (compiledKinds[k] == NULL) {
+            perror("Error: Memory allocation failed");
+            return 1;
+        }
+        for (int f = 0; f < count; f++) {
+            if (templateCompile(projectKinds[k].files[f].path, &compiledKinds[k][f].path) != 0 ||
+                templateCompile(projectKinds[k].files[f].text, &compiledKinds[k][f].text) != 0)
+                return 1;
+        }
     }
-    fprintf(file, "%s", content);
-    fclose(file);
+    if (templateCompile(gitignoreFile.path, &compiledGitignore.path) != 0 ||
+        templateCompile(gitignoreFile.text, &compiledGitignore.text) != 0)
+        return 1;
+    return 0;
 }
 
-int createProject(const char* name, int withGit) {
-    char path[BUFFER_SIZE];
+int findProjectKind(const char* name) {
+    for (int k = 0; k < PROJECT_KIND_COUNT; k++) {
+        if (strcmp(projectKinds[k].name, name) == 0)
+            return k;
+    }
+    return -1;
+}
 
-    if (access(name, F_OK) == 0) {
-        fprintf(stderr, "Error: Directory '%s' already exists.\n", name);
+int writeProjectFile(int dirfd, const char* name, const CompiledFile* file, const TemplateVars* vars) {
+    char path[BUFFER_SIZE];
+    if (templateRender(&file->path, vars, path, sizeof(path)) < 0) {
+        fprintf(stderr, "Error: File path in project '%s' is too long.\n", name);
+        return 1;
+    }
+    if (templateWrite(dirfd, path, &file->text, vars) != 0) {
+        fprintf(stderr, "Error creating file '%s/%s': %s\n", name, path, strerror(errno));
         return 1;
     }
+    return 0;
+}
 
-    mkdir(name, 0777);
-    snprintf(path, BUFFER_SIZE, "%s/src", name);
-    mkdir(path, 0777);
-    snprintf(path, BUFFER_SIZE, "%s/include", name);
-    mkdir(path, 0777);
+int createProject(const char* name, int withGit, int kind) {
+    const ProjectKind* project = &projectKinds[kind];
+    TemplateVars vars;
+    int failed = 0;
 
-    snprintf(path, BUFFER_SIZE, "%s/src/main.c", name);
-    createFile(path, "#include <stdio.h>\n\n"
-        "int main() {\n"
-        "    printf(\"Hello, World!\\n\");\n"
-        "    return 0;\n"
-        "}\n");
+    if (mkdir(name, 0777) != 0) {
+        if (errno == EEXIST)
+            fprintf(stderr, "Error: Directory '%s' already exists.\n", name);
+        else
+            fprintf(stderr, "Error: Could not create directory '%s': %s\n", name, strerror(errno));
+        return 1;
+    }
 
-    snprintf(path, BUFFER_SIZE, "%s/README.md", name);
-    char* readmeContent = malloc(strlen(name) + 3);
-    if (!readmeContent) {
-        perror("Error: Memory allocation failed");
+    int dirfd = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0 || templateVarsInit(&vars, name) != 0) {
+        fprintf(stderr, "Error: Could not set up project '%s': %s\n", name, strerror(errno));
+        if (dirfd >= 0)
+            close(dirfd);
         return 1;
     }
-    strcpy(readmeContent, "# ");
-    strcat(readmeContent, name);
-    createFile(path, readmeContent);
-    free(readmeContent);
 
-    snprintf(path, BUFFER_SIZE, "%s/Makefile", name);
-    createFile(path, "CC = gcc\n\n"
-        "SRC = src/main.c\n\n"
-        "OUT = program\n\n"
-        "all:\n\t$(CC) $(SRC) -o $(OUT)\n\n"
-        "clean:\n\trm -f $(OUT) *.o\n");
+    for (int i = 0; !failed && project->dirs[i] != NULL; i++) {
+        if (mkdirat(dirfd, project->dirs[i], 0777) != 0) {
+            fprintf(stderr, "Error: Could not create directory '%s/%s': %s\n", name, project->dirs[i],
+                strerror(errno));
+            failed = 1;
+        }
+    }
+    for (int i = 0; !failed && project->files[i].path != NULL; i++)
+        failed = writeProjectFile(dirfd, name, &compiledKinds[kind][i], &vars);
 
-    printf("Created C project '%s' with standard layout.\n", name);
+    if (!failed && verbose)
+        printf("Created C project '%s' with %s layout.\n", name, kind == 0 ? "standard" : project->name);
 
-    if (withGit == 1) {
+    if (!failed && withGit == 1) {
+        char* gitArgv[] = {"git", "init", (char*)name, NULL};
         if (checkGitInstalled() != 0) {
             fprintf(stderr, "Error: Git is not installed. Install it to use --with-git.\n");
-            return 1;
+            failed = 1;
         }
-
-        snprintf(path, BUFFER_SIZE, "cd %s && git init > /dev/null 2>&1", name);
-        if (system(path) != 0) {
+        else if (runCommand(gitArgv, NULL, 0) != 0) {
             fprintf(stderr, "Error: Failed to initialize Git repository.\n");
-            return 1;
+            failed = 1;
         }
+        else {
+            if (verbose)
+                printf("Initialized Git repository.\n");
+            failed = writeProjectFile(dirfd, name, &compiledGitignore, &vars);
+            if (!failed && verbose)
+                printf("Added .gitignore for C projects.\n");
+        }
+    }
 
-        printf("Initialized Git repository.\n");
+    templateVarsFree(&vars);
+    close(dirfd);
+    return failed;
+}
 
-        snprintf(path, BUFFER_SIZE, "%s/.gitignore", name);
-        createFile(path, "*.o\nprogram\n");
-        printf("Added .gitignore for C projects.\n");
+/* Asks git once and remembers the answer; batch mode asks before starting workers. */
+int checkGitInstalled() {
+    static int installed = -1;
+    if (installed < 0) {
+        char* gitArgv[] = {"git", "--version", NULL};
+        installed = runCommand(gitArgv, NULL, 0) == 0;
     }
+    return installed ? 0 : 1;
+}
 
-    return 0;
+double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
 }
 
-int checkGitInstalled() {
-    if (system("git --version > /dev/null 2>&1") == 0)
-        return 0;
-    return 1;
+/*
+ * Runs argv[0] (searched in PATH) without a shell and waits for it. With
+ * output set, its stdout and stderr are read through a pipe into output,
+ * at most size - 1 bytes and NUL-terminated; otherwise both go to
+ * /dev/null. Returns the exit status, or -1 when it could not be run.
+ */
+int runCommand(char* const argv[], char* output, size_t size) {
+    posix_spawn_file_actions_t actions;
+    int fds[2] = {-1, -1};
+    pid_t pid;
+    int status;
+
+    /* Close-on-exec, so projects built at the same time never hold each other's pipe open. */
+    if (output != NULL && pipe2(fds, O_CLOEXEC) != 0) {
+        perror("Error: pipe failed");
+        return -1;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    if (output != NULL) {
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    }
+    else {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    }
+
+    int err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (output != NULL)
+        close(fds[1]);
+    if (err != 0) {
+        fprintf(stderr, "Error: Could not run '%s': %s\n", argv[0], strerror(err));
+        if (output != NULL)
+            close(fds[0]);
+        return -1;
+    }
+
+    if (output != NULL) {
+        size_t len = 0;
+        char discard[BUFFER_SIZE];
+        ssize_t n;
+        /* Keep draining past size so the child never blocks on a full pipe. */
+        while ((n = read(fds[0], len + 1 < size ? output + len : discard,
+                    len + 1 < size ? size - 1 - len : sizeof(discard))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            if (len + 1 < size)
+                len += n;
+        }
+        output[len] = '\0';
+        close(fds[0]);
+    }
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
 }
 
-int verifyBuild(const char* name) {
-    char command[BUFFER_SIZE];
+int verifyBuild(const char* name, PhaseTimes* times, int runTests) {
+    char path[BUFFER_SIZE];
     char output[BUFFER_SIZE];
-    FILE* tempFile;
 
-    snprintf(command, BUFFER_SIZE, "cd %s && make all > /dev/null 2>&1", name);
-    if (system(command) != 0) {
+    double start = nowMs();
+    char* makeArgv[] = {"make", "-C", (char*)name, "all", NULL};
+    if (runCommand(makeArgv, NULL, 0) != 0) {
         fprintf(stderr, "Error: Build project '%s' failed.\n", name);
         return 1;
     }
+    times->build = nowMs() - start;
 
-    snprintf(command, BUFFER_SIZE, "cd %s && ./program > output.txt 2>&1", name);
-    if (system(command) != 0) {
-        fprintf(stderr, "Error: Failed to execute ./program.\n");
-        return 1;
-    }
-
-    snprintf(command, BUFFER_SIZE, "%s/output.txt", name);
-    tempFile = fopen(command, "r");
-    if (!tempFile) {
-        fprintf(stderr, "Error: Could not open output file.\n");
+    start = nowMs();
+    snprintf(path, BUFFER_SIZE, "%s/program", name);
+    char* programArgv[] = {path, NULL};
+    if (runCommand(programArgv, output, sizeof(output)) != 0) {
+        fprintf(stderr, "Error: Failed to execute '%s'.\n", path);
         return 1;
     }
+    times->run = nowMs() - start;
 
-    if (fgets(output, sizeof(output), tempFile) == NULL) {
+    if (output[0] == '\0') {
         fprintf(stderr, "Error: No output from ./program.\n");
-        fclose(tempFile);
         return 1;
     }
-    fclose(tempFile);
-
-    snprintf(command, BUFFER_SIZE, "rm -f %s/output.txt", name);
-    system(command);
-
 
+    /* Only the first line is checked. */
+    char* newline = strchr(output, '\n');
+    if (newline != NULL)
+        newline[1] = '\0';
     if (strcmp(output, "Hello, World!\n") != 0) {
         fprintf(stderr, "Error: Incorrect program output: '%s'\n", output);
         return 1;
     }
 
-    printf("Running 'make all' to verify...\n");
-    printf("Build successfully. Binary 'program' created.\n");
-    printf("Output check successfully.\n");
-    printf("Project setup complete.\n");
+    if (runTests) {
+        start = nowMs();
+        char* testArgv[] = {"make", "-C", (char*)name, "test", NULL};
+        if (runCommand(testArgv, NULL, 0) != 0) {
+            fprintf(stderr, "Error: Tests of project '%s' failed.\n", name);
+            return 1;
+        }
+        times->test = nowMs() - start;
+    }
+
+    if (verbose) {
+        printf("Running 'make all' to verify...\n");
+        printf("Build successfully. Binary 'program' created.\n");
+        printf("Output check successfully.\n");
+        if (runTests)
+            printf("Tests passed.\n");
+        printf("Project setup complete.\n");
+    }
 
     return 0;
 }
+
+void* batchWorker(void* arg) {
+    BatchQueue* queue = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count) {
+        BatchEntry* entry = &queue->entries[i];
+        double start = nowMs();
+        entry->failed = createProject(entry->name, entry->withGit, entry->kind) != 0;
+        entry->times.create = nowMs() - start;
+        if (!entry->failed)
+            entry->failed = verifyBuild(entry->name, &entry->times, projectKinds[entry->kind].hasTests) != 0;
+    }
+    return NULL;
+}
+
+/*
+ * Reads the manifest into *entries. Every name is checked, against the
+ * pattern and against the names before it, before any project is made.
+ * Returns the number of entries, or -1.
+ */
+int readManifest(const char* manifest, int withGit, int kind, BatchEntry** entries) {
+    FILE* file = fopen(manifest, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open manifest '%s'.\n", manifest);
+        return -1;
+    }
+
+    char* line = NULL;
+    size_t lineSize = 0;
+    int count = 0, capacity = 0, lineNumber = 0, failed = 0;
+    *entries = NULL;
+    while (!failed && getline(&line, &lineSize, file) != -1) {
+        char* saved;
+        char* name = strtok_r(line, " \t\r\n", &saved);
+        char* flag;
+        int entryGit = withGit, entryKind = kind;
+        lineNumber++;
+        if (name == NULL || name[0] == '#')
+            continue;
+
+        while (!failed && (flag = strtok_r(NULL, " \t\r\n", &saved)) != NULL) {
+            if (strcmp(flag, "--with-git") == 0)
+                entryGit = 1;
+            else if (strcmp(flag, "--kind") == 0 && (flag = strtok_r(NULL, " \t\r\n", &saved)) != NULL &&
+                (entryKind = findProjectKind(flag)) >= 0)
+                continue;
+            else {
+                fprintf(stderr, "Error: %s:%d: expected '<project-name> [--with-git] [--kind <kind>]'.\n",
+                    manifest, lineNumber);
+                failed = 1;
+            }
+        }
+        if (!failed && isValidProjectName(name) != 0) {
+            fprintf(stderr, "Error: %s:%d: project name '%s' is invalid.\n", manifest, lineNumber, name);
+            failed = 1;
+        }
+        for (int i = 0; !failed && i < count; i++) {
+            if (strcmp((*entries)[i].name, name) == 0) {
+                fprintf(stderr, "Error: %s:%d: project '%s' is listed twice.\n", manifest, lineNumber, name);
+                failed = 1;
+            }
+        }
+        if (failed)
+            break;
+
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            BatchEntry* grown = realloc(*entries, capacity * sizeof(BatchEntry));
+            if (grown == NULL) {
+                perror("Error: Memory allocation failed");
+                failed = 1;
+                break;
+            }
+            *entries = grown;
+        }
+        memset(&(*entries)[count], 0, sizeof(BatchEntry));
+        (*entries)[count].withGit = entryGit;
+        (*entries)[count].kind = entryKind;
+        if (((*entries)[count].name = strdup(name)) == NULL) {
+            perror("Error: Memory allocation failed");
+            failed = 1;
+            break;
+        }
+        count++;
+    }
+    free(line);
+    fclose(file);
+
+    if (failed) {
+        for (int i = 0; i < count; i++)
+            free((*entries)[i].name);
+        free(*entries);
+        *entries = NULL;
+        return -1;
+    }
+    return count;
+}
+
+/*
+ * Creates and verifies every project of the manifest with up to jobs
+ * projects in flight. Returns the number of projects that failed, or -1
+ * when the batch could not start.
+ */
+int runBatch(const char* manifest, int jobs, int withGit, int kind, int timing) {
+    BatchQueue queue = {NULL, 0, 0};
+    double start = nowMs();
+
+    if ((queue.count = readManifest(manifest, withGit, kind, &queue.entries)) < 0)
+        return -1;
+    for (int i = 0; i < queue.count; i++) {
+        if (queue.entries[i].withGit && checkGitInstalled() != 0) {
+            fprintf(stderr, "Error: Git is not installed. Install it to use --with-git.\n");
+            jobs = 0;
+            break;
+        }
+    }
+
+    if (jobs > queue.count)
+        jobs = queue.count;
+    pthread_t* tids = jobs > 0 ? malloc(jobs * sizeof(pthread_t)) : NULL;
+    if (tids == NULL) {
+        if (jobs > 0)
+            perror("Error: Memory allocation failed");
+        for (int i = 0; i < queue.count; i++)
+            free(queue.entries[i].name);
+        free(queue.entries);
+        return queue.count > 0 ? -1 : 0;
+    }
+
+    verbose = 0;
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&tids[started], NULL, batchWorker, &queue) != 0)
+            break;
+    }
+    if (started == 0 && queue.count > 0)
+        batchWorker(&queue);
+    for (int t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+    free(tids);
+    double elapsed = nowMs() - start;
+
+    int failures = 0;
+    for (int i = 0; i < queue.count; i++) {
+        BatchEntry* entry = &queue.entries[i];
+        failures += entry->failed;
+        if (timing)
+            printf("%-24s %s  create %.1f ms, build %.1f ms, run %.1f ms, test %.1f ms\n", entry->name,
+                entry->failed ? "FAILED" : "ok    ", entry->times.create, entry->times.build, entry->times.run,
+                entry->times.test);
+        else
+            printf("%-24s %s\n", entry->name, entry->failed ? "FAILED" : "ok");
+        free(entry->name);
+    }
+    free(queue.entries);
+
+    printf("Created %d of %d projects in %.1f ms (%.1f ms per project) with %d workers.\n",
+        queue.count - failures, queue.count, elapsed, queue.count > 0 ? elapsed / queue.count : 0.0,
+        started > 0 ? started : 1);
+    return failures;
+}
@@ -0,0 +1,187 @@
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+/*
+ * Scaffolding templates with {{name}} placeholders.
+ *
+ * templateCompile() splits a template once into literal runs and
+ * placeholder references, so nothing is parsed per project. The values of
+ * one project are resolved into a single buffer by templateVarsInit(), and
+ * templateWrite() hands the literal runs (which stay in the embedded text)
+ * and the values to one writev() on a file opened with openat() relative
+ * to the project directory, so every file costs one open, one write and
+ * one close however many placeholders it has.
+ *
+ * Placeholders: {{name}} the project name, {{ident}} the name as a C
+ * identifier (hyphens become underscores), {{guard}} the identifier in
+ * upper case followed by _H.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define TEMPLATE_MAX_SEGMENTS 64
+
+typedef enum {
+    VAR_NAME,
+    VAR_IDENT,
+    VAR_GUARD,
+    VAR_COUNT
+} TemplateVar;
+
+static const char* const templateVarNames[VAR_COUNT] = {"name", "ident", "guard"};
+
+typedef struct {
+    const char* text; /* literal run, or NULL for a placeholder */
+    size_t len;
+    int var;
+} TemplateSegment;
+
+typedef struct {
+    int count;
+    TemplateSegment segments[TEMPLATE_MAX_SEGMENTS];
+} CompiledTemplate;
+
+typedef struct {
+    const char* values[VAR_COUNT];
+    size_t lengths[VAR_COUNT];
+    char* buffer; /* one allocation behind the derived values */
+} TemplateVars;
+
+/* Returns 0, or -1 after reporting an unknown or unterminated placeholder. */
+static int templateCompile(const char* text, CompiledTemplate* out) {
+    const char* p = text;
+    out->count = 0;
+    while (*p != '\0') {
+        const char* open = strstr(p, "{{");
+        const char* end = open != NULL ? open : p + strlen(p);
+        if (end > p) {
+            if (out->count == TEMPLATE_MAX_SEGMENTS)
+                break;
+            out->segments[out->count++] = (TemplateSegment){p, end - p, -1};
+        }
+        if (open == NULL)
+            return 0;
+
+        const char* close = strstr(open + 2, "}}");
+        if (close == NULL) {
+            fprintf(stderr, "Error: Unterminated placeholder in template '%.20s...'.\n", text);
+            return -1;
+        }
+        int var = 0;
+        while (var < VAR_COUNT && (strlen(templateVarNames[var]) != (size_t)(close - open - 2) ||
+            strncmp(templateVarNames[var], open + 2, close - open - 2) != 0))
+            var++;
+        if (var == VAR_COUNT) {
+            fprintf(stderr, "Error: Unknown placeholder '%.*s' in template.\n", (int)(close - open + 2), open);
+            return -1;
+        }
+        if (out->count == TEMPLATE_MAX_SEGMENTS)
+            break;
+        out->segments[out->count++] = (TemplateSegment){NULL, 0, var};
+        p = close + 2;
+    }
+    if (*p != '\0') {
+        fprintf(stderr, "Error: Template has more than %d segments.\n", TEMPLATE_MAX_SEGMENTS);
+        return -1;
+    }
+    return 0;
+}
+
+/* Resolves every placeholder of a project named name; returns 0 or -1. */
+static int templateVarsInit(TemplateVars* vars, const char* name) {
+    size_t len = strlen(name);
+    vars->buffer = malloc(2 * len + 4);
+    if (vars->buffer == NULL)
+        return -1;
+
+    char* ident = vars->buffer;
+    char* guard = ident + len + 1;
+    for (size_t i = 0; i < len; i++) {
+        ident[i] = name[i] == '-' ? '_' : name[i];
+        guard[i] = toupper((unsigned char)ident[i]);
+    }
+    ident[len] = '\0';
+    memcpy(guard + len, "_H", 3);
+
+    vars->values[VAR_NAME] = name;
+    vars->values[VAR_IDENT] = ident;
+    vars->values[VAR_GUARD] = guard;
+    vars->lengths[VAR_NAME] = len;
+    vars->lengths[VAR_IDENT] = len;
+    vars->lengths[VAR_GUARD] = len + 2;
+    return 0;
+}
+
+static void templateVarsFree(TemplateVars* vars) {
+    free(vars->buffer);
+    vars->buffer = NULL;
+}
+
+/* Renders t into out; returns the length, or -1 when it does not fit. */
+static long templateRender(const CompiledTemplate* t, const TemplateVars* vars, char* out, size_t size) {
+    size_t len = 0;
+    for (int i = 0; i < t->count; i++) {
+        const TemplateSegment* seg = &t->segments[i];
+        const char* text = seg->text != NULL ? seg->text : vars->values[seg->var];
+        size_t n = seg->text != NULL ? seg->len : vars->lengths[seg->var];
+        if (len + n >= size)
+            return -1;
+        memcpy(out + len, text, n);
+        len += n;
+    }
+    out[len] = '\0';
+    return (long)len;
+}
+
+/*
+ * Creates path under dirfd (failing if it exists) and writes t into it
+ * with one writev(), looping only if the kernel takes less. Returns 0, or
+ * -1 with errno set.
+ */
+static int templateWrite(int dirfd, const char* path, const CompiledTemplate* t, const TemplateVars* vars) {
+    struct iovec iov[TEMPLATE_MAX_SEGMENTS];
+    int n = 0;
+    for (int i = 0; i < t->count; i++) {
+        const TemplateSegment* seg = &t->segments[i];
+        iov[n].iov_base = (void*)(seg->text != NULL ? seg->text : vars->values[seg->var]);
+        iov[n].iov_len = seg->text != NULL ? seg->len : vars->lengths[seg->var];
+        if (iov[n].iov_len > 0)
+            n++;
+    }
+
+    int fd = openat(dirfd, path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    struct iovec* next = iov;
+    while (n > 0) {
+        ssize_t written = writev(fd, next, n);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        while (n > 0 && (size_t)written >= next->iov_len) {
+            written -= next->iov_len;
+            next++;
+            n--;
+        }
+        if (n > 0) {
+            next->iov_base = (char*)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+    return close(fd);
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef TEMPLATES_H
+#define TEMPLATES_H
+
+/*
+ * Project kinds cnew can scaffold, embedded in the binary. Paths and
+ * contents may use the placeholders of template.h. Every kind builds a
+ * binary named program that prints "Hello, World!", which is what
+ * verifyBuild checks; kinds with tests also get their 'make test' run.
+ *
+ * The generated Makefiles compile one object per source into
+ * build/<config>/ with -MMD dependency files, so rebuilds touch only what
+ * changed and 'make -j' is safe. TEMPLATE_MAKE_HEAD and TEMPLATE_MAKE_TAIL
+ * are shared by every kind; the part between them says what is linked.
+ */
+
+typedef struct {
+    const char* path; /* relative to the project directory */
+    const char* text;
+} TemplateFile;
+
+typedef struct {
+    const char* name;
+    const char* description;
+    const char* const* dirs;   /* created in order, NULL-terminated */
+    const TemplateFile* files; /* terminated by a NULL path */
+    int hasTests;
+} ProjectKind;
+
+#define TEMPLATE_HELLO_MAIN \
+    "#include <stdio.h>\n\n" \
+    "int main() {\n" \
+    "    printf(\"Hello, World!\\n\");\n" \
+    "    return 0;\n" \
+    "}\n"
+
+#define TEMPLATE_MAKE_HEAD \
+    "# make CONFIG=release|debug|profile (default release); CCACHE=ccache\n" \
+    "# compiles through ccache. Each configuration keeps its own objects.\n" \
+    "CC = gcc\n" \
+    "AR = gcc-ar\n" \
+    "CCACHE ?=\n" \
+    "CONFIG ?= release\n\n" \
+    "CPPFLAGS = -Iinclude -MMD -MP\n" \
+    "CFLAGS = -Wall -Wextra\n" \
+    "LDFLAGS =\n" \
+    "LDLIBS =\n\n" \
+    "ifeq ($(CONFIG),release)\n" \
+    "CFLAGS += -O2 -flto\n" \
+    "else ifeq ($(CONFIG),debug)\n" \
+    "CFLAGS += -O0 -g\n" \
+    "else ifeq ($(CONFIG),profile)\n" \
+    "CFLAGS += -O2 -g -pg\n" \
+    "else\n" \
+    "$(error CONFIG must be release, debug or profile)\n" \
+    "endif\n\n" \
+    "BUILD = build/$(CONFIG)\n" \
+    "STAMP = build/config\n" \
+    "OUT = program\n\n"
+
+/* Expects OBJ to list every object, for the dependency files. */
+#define TEMPLATE_MAKE_TAIL \
+    "$(BUILD)/%.o: %.c\n" \
+    "\t@mkdir -p $(@D)\n" \
+    "\t$(CCACHE) $(CC) $(CPPFLAGS) $(CFLAGS) -c $< -o $@\n\n" \
+    "# Rewritten only when CONFIG changes, so switching relinks.\n" \
+    "$(STAMP): FORCE\n" \
+    "\t@mkdir -p $(@D)\n" \
+    "\t@echo $(CONFIG) | cmp -s - $@ || echo $(CONFIG) > $@\n\n" \
+    "-include $(OBJ:.o=.d)\n\n"
+
+#define TEMPLATE_MAKE_PROGRAM \
+    TEMPLATE_MAKE_HEAD \
+    "SRC = $(shell find src -name '*.c')\n" \
+    "OBJ = $(SRC:%.c=$(BUILD)/%.o)\n\n" \
+    "all: $(OUT)\n\n" \
+    "$(OUT): $(OBJ) $(STAMP)\n" \
+    "\t$(CC) $(CFLAGS) $(LDFLAGS) $(OBJ) -o $@ $(LDLIBS)\n\n" \
+    TEMPLATE_MAKE_TAIL \
+    "clean:\n\trm -rf build $(OUT)\n\n" \
+    ".PHONY: all clean FORCE\n"
+
+static const char* const appDirs[] = {"src", "include", NULL};
+static const char* const testDirs[] = {"src", "include", "tests", NULL};
+
+static const TemplateFile appFiles[] = {
+    {"src/main.c", TEMPLATE_HELLO_MAIN},
+    {"README.md", "# {{name}}\n"},
+    {"Makefile", TEMPLATE_MAKE_PROGRAM},
+    {NULL, NULL}
+};
+
+static const TemplateFile multiFiles[] = {
+    {"src/main.c",
+        "#include \"greeting.h\"\n\n"
+        "int main() {\n"
+        "    greet();\n"
+        "    return 0;\n"
+        "}\n"},
+    {"src/greeting.c",
+        "#include <stdio.h>\n"
+        "#include \"greeting.h\"\n\n"
+        "void greet(void) {\n"
+        "    printf(\"Hello, World!\\n\");\n"
+        "}\n"},
+    {"include/greeting.h",
+        "#ifndef GREETING_H\n"
+        "#define GREETING_H\n\n"
+        "void greet(void);\n\n"
+        "#endif\n"},
+    {"README.md", "# {{name}}\n\nA program split over several source files in src/, with headers in include/.\n"},
+    {"Makefile", TEMPLATE_MAKE_PROGRAM},
+    {NULL, NULL}
+};
+
+static const TemplateFile libFiles[] = {
+    {"include/{{ident}}.h",
+        "#ifndef {{guard}}\n"
+        "#define {{guard}}\n\n"
+        "/* Returns the greeting of the {{name}} library. */\n"
+        "const char* {{ident}}_greeting(void);\n\n"
+        "#endif\n"},
+    {"src/{{ident}}.c",
+        "#include \"{{ident}}.h\"\n\n"
+        "const char* {{ident}}_greeting(void) {\n"
+        "    return \"Hello, World!\";\n"
+        "}\n"},
+    {"src/main.c",
+        "#include <stdio.h>\n"
+        "#include \"{{ident}}.h\"\n\n"
+        "int main() {\n"
+        "    printf(\"%s\\n\", {{ident}}_greeting());\n"
+        "    return 0;\n"
+        "}\n"},
+    {"README.md",
+        "# {{name}}\n\nA static library, lib{{name}}.a, with its API in include/{{ident}}.h "
+        "and an example program in src/main.c.\n"},
+    {"Makefile",
+        TEMPLATE_MAKE_HEAD
+        "LIB = lib{{name}}.a\n"
+        "LIB_SRC = $(filter-out src/main.c,$(shell find src -name '*.c'))\n"
+        "LIB_OBJ = $(LIB_SRC:%.c=$(BUILD)/%.o)\n"
+        "MAIN_OBJ = $(BUILD)/src/main.o\n"
+        "OBJ = $(LIB_OBJ) $(MAIN_OBJ)\n\n"
+        "all: $(OUT)\n\n"
+        "$(LIB): $(LIB_OBJ) $(STAMP)\n"
+        "\trm -f $@\n"
+        "\t$(AR) rcs $@ $(LIB_OBJ)\n\n"
+        "$(OUT): $(MAIN_OBJ) $(LIB)\n"
+        "\t$(CC) $(CFLAGS) $(LDFLAGS) $(MAIN_OBJ) $(LIB) -o $@ $(LDLIBS)\n\n"
+        TEMPLATE_MAKE_TAIL
+        "clean:\n\trm -rf build $(OUT) $(LIB)\n\n"
+        ".PHONY: all clean FORCE\n"},
+    {NULL, NULL}
+};
+
+static const TemplateFile testFiles[] = {
+    {"src/main.c",
+        "#include <stdio.h>\n"
+        "#include \"greeting.h\"\n\n"
+        "int main() {\n"
+        "    printf(\"%s\\n\", greeting());\n"
+        "    return 0;\n"
+        "}\n"},
+    {"src/greeting.c",
+        "#include \"greeting.h\"\n\n"
+        "const char* greeting(void) {\n"
+        "    return \"Hello, World!\";\n"
+        "}\n"},
+    {"include/greeting.h",
+        "#ifndef GREETING_H\n"
+        "#define GREETING_H\n\n"
+        "const char* greeting(void);\n\n"
+        "#endif\n"},
+    {"tests/test_greeting.c",
+        "#include <stdio.h>\n"
+        "#include <string.h>\n"
+        "#include \"greeting.h\"\n\n"
+        "int main() {\n"
+        "    if (strcmp(greeting(), \"Hello, World!\") != 0) {\n"
+        "        fprintf(stderr, \"greeting: got '%s'\\n\", greeting());\n"
+        "        return 1;\n"
+        "    }\n"
+        "    printf(\"All tests passed.\\n\");\n"
+        "    return 0;\n"
+        "}\n"},
+    {"README.md", "# {{name}}\n\nRun 'make test' to build and run the tests in tests/.\n"},
+    {"Makefile",
+        TEMPLATE_MAKE_HEAD
+        "CORE_SRC = $(filter-out src/main.c,$(shell find src -name '*.c'))\n"
+        "CORE_OBJ = $(CORE_SRC:%.c=$(BUILD)/%.o)\n"
+        "MAIN_OBJ = $(BUILD)/src/main.o\n"
+        "TEST_SRC = $(wildcard tests/*.c)\n"
+        "TESTS = $(TEST_SRC:%.c=$(BUILD)/%)\n"
+        "OBJ = $(CORE_OBJ) $(MAIN_OBJ) $(TESTS:=.o)\n\n"
+        "all: $(OUT)\n\n"
+        "$(OUT): $(MAIN_OBJ) $(CORE_OBJ) $(STAMP)\n"
+        "\t$(CC) $(CFLAGS) $(LDFLAGS) $(MAIN_OBJ) $(CORE_OBJ) -o $@ $(LDLIBS)\n\n"
+        "$(TESTS): %: %.o $(CORE_OBJ) $(STAMP)\n"
+        "\t$(CC) $(CFLAGS) $(LDFLAGS) $@.o $(CORE_OBJ) -o $@ $(LDLIBS)\n\n"
+        "test: $(TESTS)\n"
+        "\t@for t in $(TESTS); do ./$$t || exit 1; done\n\n"
+        TEMPLATE_MAKE_TAIL
+        "clean:\n\trm -rf build $(OUT)\n\n"
+        ".PHONY: all test clean FORCE\n"},
+    {NULL, NULL}
+};
+
+static const ProjectKind projectKinds[] = {
+    {"app", "single-file program (default)", appDirs, appFiles, 0},
+    {"multi", "program split over several source files", appDirs, multiFiles, 0},
+    {"lib", "static library with an example program", appDirs, libFiles, 0},
+    {"test", "program with a unit test run by 'make test'", testDirs, testFiles, 1},
+};
+
+#define PROJECT_KIND_COUNT ((int)(sizeof(projectKinds) / sizeof(projectKinds[0])))
+
+static const TemplateFile gitignoreFile = {".gitignore", "build/\n*.o\n*.a\nprogram\n"};
+
+#endif
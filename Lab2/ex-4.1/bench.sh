@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# bench.sh: compares the slice, atomic and lock merge modes of problem-1
+# and the reader/parser/aggregator pipeline on the MovieLens 100k ratings
+# and on a synthetic file, then the mmap and stdio parsers on the same
+# inputs.
+# Usage: ./bench.sh [synthetic-rows] [workers]
+
+ROWS=${1:-100000000}
+WORKERS=${2:-$(nproc)}
+WORKDIR=$(mktemp -d)
+BIN="$WORKDIR/problem-1"
+SYNTHETIC="$WORKDIR/synthetic.txt"
+
+trap 'rm -rf "$WORKDIR"' EXIT
+
+gcc -O2 -Wall -pthread problem-1.c -o "$BIN" -lm || exit 1
+
+echo "Generating $ROWS synthetic ratings..."
+awk -v rows="$ROWS" 'BEGIN {
+    srand(42)
+    for (i = 0; i < rows; i++)
+        printf "%d\t%d\t%d\t%d\n", 1 + int(rand() * 943), 1 + int(rand() * 1682),
+            1 + int(rand() * 5), 874724710 + int(rand() * 18000000)
+}' > "$SYNTHETIC"
+
+run(){
+    for mode in slice atomic lock; do
+        printf "%-10s %-7s " "$1" "$mode"
+        "$BIN" -j "$WORKERS" -m "$mode" "${@:2}" 2>&1 >/dev/null | grep throughput
+    done
+    printf "%-10s %-7s " "$1" pipe
+    "$BIN" -P "$WORKERS" "${@:2}" 2>&1 >/dev/null | grep throughput
+}
+
+run 100k movie-100k.txt movie-100k_2.txt
+run synthetic "$SYNTHETIC"
+
+echo "Pipeline stages on the synthetic file:"
+"$BIN" -P "$WORKERS" "$SYNTHETIC" 2>&1 >/dev/null | sed -n '/pipeline aggregate/,/bottleneck/p'
+
+echo "Parser throughput (one core):"
+"$BIN" -B movie-100k.txt movie-100k_2.txt
+"$BIN" -B "$SYNTHETIC"
@@ -1,125 +1,2528 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
 #include <sys/wait.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../include/shm_segment.h"
+#include "../include/work_pool.h"
+#include "../include/mpmc_queue.h"
 
-#define MAX_MOVIES 1682
-#define MAX_USERS 943
-#define SHM_KEY 0x124
+#define MIN_RATING 1
+#define MAX_RATING 5
+#define RATING_LEVELS (MAX_RATING - MIN_RATING + 1)
+#define OUT_BUFFER_SIZE (1 << 20)
+#define SECONDS_PER_DAY 86400
+#define TOP_MIN_SHARE (1 << 16)
+#define SHARED_HEADER 128 /* keeps the payload 64-byte aligned */
+#define PIPE_BLOCK (1 << 20)            /* bytes the reader hands over at once */
+#define PIPE_READAHEAD (8 * PIPE_BLOCK) /* window the reader asks the kernel for */
+#define PIPE_BATCH 4096                 /* records a parser hands over at once */
+#define PIPE_MAX_PARSERS 64
+
+/*
+ * Usage: problem-1 [-j workers] [-T] [-P parsers] [-m slice|atomic|lock]
+ *                  [-p mmap|stdio] [-n max-item-id] [-s] [-F text|binary] [-o output]
+ *                  [-S state] [-w days] [-k top] [-c min-count] [-B]
+ *                  [file ...]
+ *
+ * Without file arguments the two MovieLens halves are processed as before.
+ * The inputs are cut into byte ranges that end on line boundaries and the
+ * ranges are handed out to the workers, so a single big file is processed
+ * by every worker as well. The worker count defaults to the number of
+ * online CPUs. Workers are forked processes; -T runs them as tasks of a
+ * work_pool.h thread pool of as many threads instead, which saves the
+ * forks and copies no page tables.
+ *
+ * -P runs each pass as a pipeline instead, for inputs on slow storage
+ * where reading and parsing should overlap: one thread reads the files in
+ * 1 MiB blocks with sequential and read-ahead hints, the given number of
+ * parser threads turn blocks into record batches, and the main thread
+ * aggregates them into a single store. The stages are connected by
+ * bounded lock-free queues (mpmc_queue.h), and every pass reports how long
+ * each stage worked and waited, so the slowest stage shows up as the one
+ * that never waits. -j, -m and -p do not apply.
+ *
+ * -m picks how workers add into shared memory: "slice" (default) gives each
+ * worker a private store that the parent merges in one pass, "atomic" uses
+ * fetch-add on one shared store and "lock" takes one process-shared mutex
+ * per update. bench.sh compares the three.
+ *
+ * -p picks the parser: "mmap" (default) maps the file and tokenizes the
+ * records in place, "stdio" is the original fscanf loop. -B skips the
+ * aggregation report and times both parsers on one core instead.
+ *
+ * The shared segment is sized at runtime. A first parallel pass finds the
+ * item-id range and record count, then the store is a dense array indexed
+ * by item when that is no larger than a hash table for the same input, and
+ * an open-addressing hash table otherwise. -n gives the largest item id up
+ * front, skips the first pass and forces the dense store; records with ids
+ * outside 1..max-item-id are skipped and counted.
+ *
+ * -s prints count, mean, variance, the rating histogram and the first and
+ * last timestamp of every rated item and every user instead of the plain
+ * average listing. Items and users are numbered from 0 like that listing.
+ *
+ * Results go to stdout, or to the file given with -o, through one 1 MiB
+ * buffer. -F binary writes the rated items as columns instead of text:
+ *
+ *     ColumnHeader                    magic "RATCOL01", row count, offsets
+ *     int32_t  id[rows]               item id as in the input
+ *     int32_t  count[rows]
+ *     int64_t  sum[rows]              sum of the ratings
+ *     double   mean[rows]
+ *
+ * Every column starts at the byte offset recorded in the header, aligned to
+ * 8 bytes, in host byte order, so a consumer can mmap the file and index
+ * the columns directly. The binary format holds items only and cannot be
+ * combined with -s.
+ *
+ * -S keeps the aggregate in a state file: the merged item and user
+ * statistics, the largest timestamp seen and, per input file (matched by
+ * device and inode), the offset just past the last complete line read. A
+ * later run with the same state reads only what was appended since, up to
+ * the last complete line, and merges it into the saved statistics.
+ *
+ * -w limits the result to ratings from the last given number of days,
+ * counted back from the day of the newest timestamp seen. With -S the
+ * statistics are kept per item and day, so the window can slide forward on
+ * each incremental run and days that fall out of it are dropped from the
+ * state. A state file is tied to the -w it was created with.
+ *
+ * -k prints only the top given number of items by mean rating, best first,
+ * ties going to the item with more ratings. -c skips items with fewer than
+ * the given number of ratings, alone or together with -k. Both work on the
+ * merged table in place and apply to items only; -s then lists the chosen
+ * items without the users.
+ */
+
+typedef struct
+{
+    int userId;
+    int movieId;
+    int rating;
+    int timeStamp;
+} Record;
+
+/*
+ * Statistics of one slice of items or users, one array per field so the
+ * merge streams through memory. A dense store uses the item index as slot.
+ * A sparse store maps index + 1 to slot + 1 through an open-addressing
+ * table of (key << 32 | slot + 1) words and hands out slots in order.
+ *
+ * mean and m2 follow Welford's update and are merged with Chan's formula.
+ * In atomic mode they are left alone and derived from the histogram after
+ * the workers finish, which is exact since ratings are small integers.
+ */
+typedef struct
+{
+    double *mean;
+    double *m2;
+    int *count;
+    int *hist; /* RATING_LEVELS arrays of capacity entries */
+    int *minTs;
+    int *maxTs;
+    uint64_t *table; /* sparse only */
+    int *slotIndex;  /* sparse only: slot -> item index */
+    int *used;       /* sparse only: slots handed out */
+    size_t capacity;
+} StatsStore;
+
+typedef enum
+{
+    MERGE_SLICE,
+    MERGE_ATOMIC,
+    MERGE_LOCK
+} MergeMode;
+
+typedef enum
+{
+    PARSE_MMAP,
+    PARSE_STDIO
+} ParseMode;
+
+typedef enum
+{
+    STORE_DENSE,
+    STORE_SPARSE
+} StoreKind;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    long skipped;
+    long outsideWindow;
+} SharedSegment;
+
+/*
+ * Item index i stands for id i + 1, as in the original output. With day
+ * buckets the store key is index * buckets + day offset until table_fold
+ * turns it back into one entry per index.
+ */
+typedef struct
+{
+    StoreKind kind;
+    int maxIndex; /* dense stores hold indexes 0..maxIndex */
+    size_t capacity;
+    StatsStore *slices;
+    StatsStore *result; /* set by table_merge */
+    void *resultMem;    /* private memory behind a merged sparse result */
+} StatsTable;
+
+typedef struct
+{
+    MergeMode mode;
+    int nslices;
+    SharedSegment *seg;
+    StatsTable movies;
+    StatsTable users;
+    int withUsers;
+    int itemLimit; /* indexes at or above the limits are skipped */
+    int userLimit;
+    int windowed;
+    int windowStartDay;
+    int buckets; /* day buckets per index, 1 without -S -w */
+} Aggregation;
+
+typedef struct
+{
+    int min;
+    int max;
+} IdRange;
+
+/* What the first pass learns about one range. */
+typedef struct
+{
+    IdRange movies;
+    IdRange users;
+    int maxTs;
+    long records;
+} RangeScan;
+
+typedef struct
+{
+    RangeScan *scan; /* first pass when set, otherwise accumulate */
+    Aggregation *agg;
+    int slice;
+} RecordSink;
+
+typedef struct
+{
+    const char *fileName;
+    off_t start;
+    off_t end;
+} FileRange;
+
+typedef enum
+{
+    OUTPUT_TEXT,
+    OUTPUT_BINARY
+} OutputFormat;
+
+typedef struct
+{
+    char magic[8];
+    uint64_t rows;
+    uint64_t idOffset;
+    uint64_t countOffset;
+    uint64_t sumOffset;
+    uint64_t meanOffset;
+} ColumnHeader;
+
+typedef struct
+{
+    int fd;
+    size_t len;
+    int failed;
+    char data[OUT_BUFFER_SIZE];
+} OutBuffer;
+
+/* State file layout: StateHeader, ninputs entries, then the rows. */
+typedef struct
+{
+    char magic[8];
+    uint32_t ninputs;
+    int32_t windowDays;
+    int64_t maxTs;
+    uint64_t rows[2]; /* items, users */
+} StateHeader;
+
+typedef struct
+{
+    uint64_t dev;
+    uint64_t ino;
+    int64_t offset;
+    uint32_t pathLength; /* followed by the path, not terminated */
+    uint32_t reserved;
+} StateInputEntry;
+
+typedef struct
+{
+    int32_t index;
+    int32_t day; /* days since the epoch with -w, 0 otherwise */
+    int32_t count;
+    int32_t hist[RATING_LEVELS];
+    int32_t minTs;
+    int32_t maxTs;
+    double mean;
+    double m2;
+} StateRow;
+
+typedef struct
+{
+    uint64_t dev;
+    uint64_t ino;
+    int64_t offset;
+    char *path;
+} StateInput;
+
+typedef struct
+{
+    int windowDays;
+    int64_t maxTs;
+    int ninputs;
+    StateInput *inputs;
+    size_t nrows[2];
+    StateRow *rows[2];
+} SavedState;
+
+typedef struct
+{
+    long workers;
+    MergeMode mode;
+    ParseMode parser;
+    long maxItemId;
+    int fullStats;
+    OutputFormat format;
+    const char *outputPath;
+    const char *statePath;
+    int windowDays;
+    long topK;
+    int minCount;
+    int benchmark;
+    int threads;
+    int parsers; /* pipeline mode when > 0 */
+    char **files;
+    int nfiles;
+} Options;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Private POSIX segment that forked children inherit mapped. It has no name
+ * that another run could collide with and goes away with the last process
+ * even if one of them crashes. Large segments ask for huge pages. The
+ * mapping is preceded by one cache line holding the segment descriptor so
+ * shared_free needs only the pointer; the pages arrive zero-filled.
+ */
+void *shared_alloc(size_t size)
+{
+    _Static_assert(sizeof(ShmSegment) <= SHARED_HEADER, "segment descriptor must fit the header");
+    ShmSegment seg;
+    if (shm_segment_create(&seg, NULL, SHARED_HEADER + size, SHM_SEG_HUGE) != 0)
+    {
+        perror("Shared-memory failed");
+        return NULL;
+    }
+    memcpy(seg.addr, &seg, sizeof(seg));
+    return (char *)seg.addr + SHARED_HEADER;
+}
+
+void shared_free(void *mem)
+{
+    ShmSegment seg;
+    memcpy(&seg, (char *)mem - SHARED_HEADER, sizeof(seg));
+    shm_segment_close(&seg);
+}
+
+static size_t next_pow2(size_t n)
+{
+    size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+static size_t align64(size_t n)
+{
+    return (n + 63) & ~(size_t)63;
+}
+
+size_t store_bytes(StoreKind kind, size_t capacity)
+{
+    size_t bytes = 64 + capacity * (2 * sizeof(double) + (3 + RATING_LEVELS) * sizeof(int));
+    if (kind == STORE_SPARSE)
+        bytes += capacity * (sizeof(uint64_t) + sizeof(int));
+    return align64(bytes);
+}
+
+/* Lays the arrays out in mem, which must be zeroed and store_bytes long. */
+void store_bind(StatsStore *s, char *mem, StoreKind kind, size_t capacity)
+{
+    memset(s, 0, sizeof(*s));
+    s->capacity = capacity;
+    if (kind == STORE_SPARSE)
+        s->used = (int *)mem;
+    mem += 64;
+    s->mean = (double *)mem;
+    mem += capacity * sizeof(double);
+    s->m2 = (double *)mem;
+    mem += capacity * sizeof(double);
+    if (kind == STORE_SPARSE)
+    {
+        s->table = (uint64_t *)mem;
+        mem += capacity * sizeof(uint64_t);
+    }
+    s->count = (int *)mem;
+    mem += capacity * sizeof(int);
+    s->hist = (int *)mem;
+    mem += RATING_LEVELS * capacity * sizeof(int);
+    s->minTs = (int *)mem;
+    mem += capacity * sizeof(int);
+    s->maxTs = (int *)mem;
+    mem += capacity * sizeof(int);
+    if (kind == STORE_SPARSE)
+        s->slotIndex = (int *)mem;
+
+    for (size_t i = 0; i < capacity; i++)
+        s->minTs[i] = INT_MAX;
+}
+
+static inline size_t hash_key(uint32_t key, size_t mask)
+{
+    return (key * 2654435761u) & mask;
+}
+
+/*
+ * Returns the slot of an item index, claiming one the first time the index
+ * is seen. In atomic mode a worker first claims the table entry by setting
+ * its key with slot 0 ("being claimed"), and only the winner takes a slot
+ * from used, so used never counts more slots than there are indexes; the
+ * others wait for the winner to fill the slot in.
+ */
+static inline int store_slot(StatsStore *s, int index, int atomic)
+{
+    if (s->table == NULL)
+        return index;
+
+    uint64_t key = (uint64_t)(uint32_t)(index + 1) << 32;
+    size_t mask = s->capacity - 1;
+    size_t i = hash_key(index + 1, mask);
+    for (;;)
+    {
+        uint64_t *e = &s->table[i];
+        uint64_t v = atomic ? __atomic_load_n(e, __ATOMIC_ACQUIRE) : *e;
+        if (v == 0 && (!atomic || __atomic_compare_exchange_n(e, &v, key, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)))
+        {
+            int slot = atomic ? __atomic_fetch_add(s->used, 1, __ATOMIC_RELAXED) : (*s->used)++;
+            if ((size_t)slot >= s->capacity)
+            {
+                fprintf(stderr, "Statistics store overflow\n");
+                exit(EXIT_FAILURE);
+            }
+            s->slotIndex[slot] = index;
+            if (atomic)
+                __atomic_store_n(e, key | (uint32_t)(slot + 1), __ATOMIC_RELEASE);
+            else
+                *e = key | (uint32_t)(slot + 1);
+            return slot;
+        }
+        if ((v & 0xffffffff00000000ull) == key)
+        {
+            /* Claimed by another worker that has not taken its slot yet. */
+            while ((uint32_t)v == 0)
+            {
+                sched_yield();
+                v = __atomic_load_n(e, __ATOMIC_ACQUIRE);
+            }
+            return (int)(uint32_t)v - 1;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static inline void stats_add(StatsStore *s, int slot, int rating, int timeStamp, int atomic)
+{
+    int *hist = &s->hist[(rating - MIN_RATING) * s->capacity + slot];
+    if (atomic)
+    {
+        __atomic_fetch_add(&s->count[slot], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(hist, 1, __ATOMIC_RELAXED);
+        int seen = __atomic_load_n(&s->minTs[slot], __ATOMIC_RELAXED);
+        while (timeStamp < seen &&
+               !__atomic_compare_exchange_n(&s->minTs[slot], &seen, timeStamp, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+        seen = __atomic_load_n(&s->maxTs[slot], __ATOMIC_RELAXED);
+        while (timeStamp > seen &&
+               !__atomic_compare_exchange_n(&s->maxTs[slot], &seen, timeStamp, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+        return;
+    }
+
+    int n = ++s->count[slot];
+    double delta = rating - s->mean[slot];
+    s->mean[slot] += delta / n;
+    s->m2[slot] += delta * (rating - s->mean[slot]);
+    (*hist)++;
+    if (timeStamp < s->minTs[slot])
+        s->minTs[slot] = timeStamp;
+    if (timeStamp > s->maxTs[slot])
+        s->maxTs[slot] = timeStamp;
+}
+
+/* Chan et al.'s pairwise combination of two partial results. */
+static void stats_merge_slot(StatsStore *dst, int d, const StatsStore *src, int s)
+{
+    int nb = src->count[s];
+    if (nb == 0)
+        return;
+
+    int na = dst->count[d];
+    int n = na + nb;
+    double delta = src->mean[s] - dst->mean[d];
+    dst->mean[d] += delta * nb / n;
+    dst->m2[d] += src->m2[s] + delta * delta * na / n * nb;
+    dst->count[d] = n;
+    for (int r = 0; r < RATING_LEVELS; r++)
+        dst->hist[r * dst->capacity + d] += src->hist[r * src->capacity + s];
+    if (src->minTs[s] < dst->minTs[d])
+        dst->minTs[d] = src->minTs[s];
+    if (src->maxTs[s] > dst->maxTs[d])
+        dst->maxTs[d] = src->maxTs[s];
+}
+
+/* Fills mean and m2 from the histogram after atomic-mode workers. */
+static void stats_from_histogram(StatsStore *s, size_t slots)
+{
+    for (size_t i = 0; i < slots; i++)
+    {
+        if (s->count[i] == 0)
+            continue;
+        long sum = 0;
+        for (int r = 0; r < RATING_LEVELS; r++)
+            sum += (long)(MIN_RATING + r) * s->hist[r * s->capacity + i];
+        double mean = (double)sum / s->count[i];
+        double m2 = 0;
+        for (int r = 0; r < RATING_LEVELS; r++)
+            m2 += s->hist[r * s->capacity + i] * (MIN_RATING + r - mean) * (MIN_RATING + r - mean);
+        s->mean[i] = mean;
+        s->m2[i] = m2;
+    }
+}
+
+static inline void accumulate(Aggregation *agg, int slice, const Record *rec)
+{
+    int movie = rec->movieId - 1;
+    int user = rec->userId - 1;
+    if (movie < 0 || movie >= agg->itemLimit || rec->rating < MIN_RATING || rec->rating > MAX_RATING ||
+        (agg->withUsers && (user < 0 || user >= agg->userLimit)))
+    {
+        __atomic_fetch_add(&agg->seg->skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (agg->windowed)
+    {
+        int bucket = rec->timeStamp / SECONDS_PER_DAY - agg->windowStartDay;
+        if (bucket < 0 || (agg->buckets > 1 && bucket >= agg->buckets))
+        {
+            __atomic_fetch_add(&agg->seg->outsideWindow, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (agg->buckets > 1)
+        {
+            movie = movie * agg->buckets + bucket;
+            user = user * agg->buckets + bucket;
+        }
+    }
+
+    int atomic = agg->mode == MERGE_ATOMIC;
+    if (agg->mode == MERGE_LOCK)
+        pthread_mutex_lock(&agg->seg->lock);
+
+    StatsStore *s = &agg->movies.slices[slice];
+    stats_add(s, store_slot(s, movie, atomic), rec->rating, rec->timeStamp, atomic);
+    if (agg->withUsers)
+    {
+        s = &agg->users.slices[slice];
+        stats_add(s, store_slot(s, user, atomic), rec->rating, rec->timeStamp, atomic);
+    }
+
+    if (agg->mode == MERGE_LOCK)
+        pthread_mutex_unlock(&agg->seg->lock);
+}
+
+static inline void track_id(IdRange *range, int id, long seen)
+{
+    if (seen == 0 || id < range->min)
+        range->min = id;
+    if (seen == 0 || id > range->max)
+        range->max = id;
+}
+
+static void merge_range(IdRange *range, const IdRange *other, long seen)
+{
+    if (seen == 0 || other->min < range->min)
+        range->min = other->min;
+    if (seen == 0 || other->max > range->max)
+        range->max = other->max;
+}
+
+static inline void consume(RecordSink *sink, const Record *rec)
+{
+    RangeScan *scan = sink->scan;
+    if (scan != NULL)
+    {
+        track_id(&scan->movies, rec->movieId, scan->records);
+        track_id(&scan->users, rec->userId, scan->records);
+        if (scan->records == 0 || rec->timeStamp > scan->maxTs)
+            scan->maxTs = rec->timeStamp;
+        scan->records++;
+        return;
+    }
+    accumulate(sink->agg, sink->slice, rec);
+}
+
+/*
+ * A record belongs to the range holding its first byte. A range that does
+ * not start at offset 0 skips the partial line it lands in, which the
+ * previous range reads to the end.
+ */
+void read_range_stdio(const FileRange *range, RecordSink *sink)
+{
+    FILE *file = fopen(range->fileName, "r");
+    if (file == NULL)
+    {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+
+    off_t pos = range->start;
+    if (pos > 0)
+    {
+        if (fseeko(file, pos - 1, SEEK_SET) != 0)
+        {
+            perror("fseeko failed");
+            exit(EXIT_FAILURE);
+        }
+        int c;
+        while ((c = getc(file)) != '\n' && c != EOF)
+            pos++;
+    }
+
+    Record rec;
+    int used;
+    while (pos < range->end &&
+           fscanf(file, "%d\t%d\t%d\t%d%n", &rec.userId, &rec.movieId, &rec.rating, &rec.timeStamp, &used) == 4)
+    {
+        int c;
+        pos += used;
+        while ((c = getc(file)) != '\n' && c != EOF)
+            pos++;
+        pos++;
+
+        consume(sink, &rec);
+    }
+
+    fclose(file);
+}
+
+static inline const char *parse_uint(const char *p, const char *limit, int *value)
+{
+    int v = 0;
+    while (p < limit && (unsigned)(*p - '0') < 10)
+        v = v * 10 + (*p++ - '0');
+    *value = v;
+    return p;
+}
+
+/*
+ * Splits the line at p on its separators into rec and returns the start of
+ * the next line. *ok says whether the line held four numbers. Line ends
+ * are found with memchr, which glibc already implements with SSE2/AVX2.
+ */
+static inline const char *parse_line(const char *p, const char *limit, Record *rec, int *ok)
+{
+    int fields[4];
+    int n;
+    const char *q = p;
+    for (n = 0; n < 4; n++)
+    {
+        const char *f = q;
+        q = parse_uint(f, limit, &fields[n]);
+        if (q == f)
+            break;
+        if (n < 3)
+        {
+            if (q == limit || (*q != '\t' && *q != ' '))
+                break;
+            q++;
+        }
+    }
+    *ok = n == 4;
+    if (*ok)
+    {
+        rec->userId = fields[0];
+        rec->movieId = fields[1];
+        rec->rating = fields[2];
+        rec->timeStamp = fields[3];
+    }
+
+    if (q < limit && *q == '\n')
+        return q + 1;
+    const char *nl = memchr(q, '\n', limit - q);
+    return nl ? nl + 1 : limit;
+}
+
+/*
+ * Same ownership rule as read_range_stdio, but the file is mapped and each
+ * line is split in place.
+ */
+void read_range_mmap(const FileRange *range, RecordSink *sink)
+{
+    int fd = open(range->fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror("fstat failed");
+        exit(EXIT_FAILURE);
+    }
+    if (st.st_size == 0 || range->start >= range->end)
+    {
+        close(fd);
+        return;
+    }
+
+    const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *limit = base + st.st_size;
+    const char *p = base + range->start;
+    const char *stop = base + range->end;
+    off_t pageStart = range->start & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    madvise((void *)(base + pageStart), range->end - pageStart, MADV_SEQUENTIAL);
+
+    if (p > base && p[-1] != '\n')
+    {
+        const char *nl = memchr(p, '\n', limit - p);
+        p = nl ? nl + 1 : limit;
+    }
+
+    while (p < stop)
+    {
+        Record rec;
+        int ok;
+        p = parse_line(p, limit, &rec, &ok);
+        if (ok)
+            consume(sink, &rec);
+    }
+
+    munmap((void *)base, st.st_size);
+}
+
+void read_and_process_range(const FileRange *range, RecordSink *sink, ParseMode parser)
+{
+    if (parser == PARSE_STDIO)
+        read_range_stdio(range, sink);
+    else
+        read_range_mmap(range, sink);
+}
+
+/*
+ * Splits the byte range [starts[i], ends[i]) of every file into pieces of
+ * about totalBytes / workers bytes. Each file gets at least one piece so
+ * small files are never merged with others. Returns the number of ranges
+ * written to *ranges, or -1 on error.
+ */
+int split_inputs(char **files, int nfiles, const off_t *starts, const off_t *ends, int workers, FileRange **ranges,
+                 off_t *totalBytes)
+{
+    *totalBytes = 0;
+    for (int i = 0; i < nfiles; i++)
+        *totalBytes += ends[i] - starts[i];
+
+    off_t piece = *totalBytes / workers + 1;
+    int capacity = workers + nfiles;
+    FileRange *out = malloc(capacity * sizeof(FileRange));
+    if (out == NULL)
+        return -1;
+
+    int n = 0;
+    for (int i = 0; i < nfiles; i++)
+    {
+        off_t start = starts[i];
+        do
+        {
+            off_t end = start + piece < ends[i] ? start + piece : ends[i];
+            out[n].fileName = files[i];
+            out[n].start = start;
+            out[n].end = end;
+            n++;
+            start = end;
+        } while (start < ends[i]);
+    }
+
+    *ranges = out;
+    return n;
+}
+
+/*
+ * Offset just past the last newline in [start, size) of the file, or start
+ * when there is none, so a line still being appended is left for later.
+ */
+off_t last_line_end(const char *fileName, off_t start, off_t size)
+{
+    char block[4096];
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return start;
+
+    off_t end = size;
+    while (end > start)
+    {
+        size_t chunk = end - start < (off_t)sizeof(block) ? (size_t)(end - start) : sizeof(block);
+        ssize_t n = pread(fd, block, chunk, end - chunk);
+        if (n <= 0)
+            break;
+        for (ssize_t k = n - 1; k >= 0; k--)
+        {
+            if (block[k] == '\n')
+            {
+                close(fd);
+                return end - chunk + k + 1;
+            }
+        }
+        end -= n;
+    }
+    close(fd);
+    return start;
+}
+
+static WorkPool *workerPool; /* set by -T */
+
+typedef struct
+{
+    void (*job)(int w, void *arg);
+    void *arg;
+} WorkerCall;
+
+static void worker_task(uint64_t lo, uint64_t hi, void *arg)
+{
+    WorkerCall *call = arg;
+    for (uint64_t w = lo; w < hi; w++)
+        call->job((int)w, call->arg);
+}
+
+/*
+ * Forks one child per worker and runs job(w, arg) in it, or with -T runs
+ * every job(w, arg) as a task of the thread pool. Returns 0 when every
+ * child exited cleanly.
+ */
+int run_workers(long workers, void (*job)(int w, void *arg), void *arg)
+{
+    if (workerPool != NULL)
+    {
+        WorkerCall call = {job, arg};
+        work_pool_for(workerPool, 0, workers, 1, worker_task, &call);
+        return 0;
+    }
+
+    pid_t *pids = malloc(workers * sizeof(pid_t));
+    if (pids == NULL)
+    {
+        perror("malloc failed");
+        return 1;
+    }
+
+    int started = 0;
+    for (; started < workers; started++)
+    {
+        pids[started] = fork();
+        if (pids[started] == 0)
+        {
+            job(started, arg);
+            exit(0);
+        }
+        else if (pids[started] < 0)
+        {
+            perror("fork failed");
+            break;
+        }
+    }
+
+    int failed = started < workers;
+    for (int w = 0; w < started; w++)
+    {
+        int status;
+        waitpid(pids[w], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+
+    free(pids);
+    return failed;
+}
+
+
+typedef struct
+{
+    FileRange *ranges;
+    int nranges;
+    long workers;
+    ParseMode parser;
+    RangeScan *scans; /* one per range, shared */
+    Aggregation *agg;
+} Job;
+
+void scan_job(int w, void *arg)
+{
+    Job *job = arg;
+    for (int r = w; r < job->nranges; r += job->workers)
+    {
+        RecordSink sink = {&job->scans[r], NULL, 0};
+        read_and_process_range(&job->ranges[r], &sink, job->parser);
+    }
+}
+
+void aggregate_job(int w, void *arg)
+{
+    Job *job = arg;
+    RecordSink sink = {NULL, job->agg, job->agg->mode == MERGE_SLICE ? w : 0};
+    for (int r = w; r < job->nranges; r += job->workers)
+        read_and_process_range(&job->ranges[r], &sink, job->parser);
+}
+
+typedef struct
+{
+    size_t len;
+    char *data; /* PIPE_BLOCK bytes of whole lines */
+} PipeBlock;
+
+typedef struct
+{
+    int n;
+    Record records[PIPE_BATCH];
+} PipeBatch;
+
+/* Seconds one pipeline thread worked and waited for input or a free buffer. */
+typedef struct
+{
+    _Alignas(64) double busy;
+    double wait;
+    long items;
+} PipeTimer;
+
+/*
+ * Buffers circulate between the stages through four queues: the reader
+ * takes free blocks and fills them, parsers turn full blocks into record
+ * batches, and the aggregator consumes the batches and hands them back.
+ * A NULL block tells a parser to finish; a NULL batch tells the aggregator
+ * that one parser has. Every queue can hold all of its buffers and end
+ * markers, so only taking a buffer ever waits.
+ */
+typedef struct
+{
+    const FileRange *ranges;
+    int nranges;
+    int parsers;
+    MpmcQueue freeBlocks;
+    MpmcQueue fullBlocks;
+    MpmcQueue freeBatches;
+    MpmcQueue fullBatches;
+    PipeTimer reader;
+    PipeTimer aggregator;
+    PipeTimer parser[PIPE_MAX_PARSERS];
+} Pipeline;
+
+typedef struct
+{
+    Pipeline *pipeline;
+    int index;
+} PipeParser;
+
+static void *pipe_take(MpmcQueue *q, PipeTimer *timer)
+{
+    void *item;
+    if (mpmc_queue_try_pop(q, &item))
+        return item;
+    double started = now_seconds();
+    item = mpmc_queue_pop(q);
+    timer->wait += now_seconds() - started;
+    return item;
+}
+
+/*
+ * Reads one range in PIPE_BLOCK pieces that end on line boundaries, with
+ * the ownership rule of read_range_stdio. The partial line at the end of a
+ * piece is carried over to the next one. The kernel is told the access is
+ * sequential and asked for the next PIPE_READAHEAD bytes ahead of time, so
+ * the disk works while the parsers do.
+ */
+static void pipe_read_range(Pipeline *pipeline, const FileRange *range)
+{
+    if (range->start >= range->end)
+        return;
+    int fd = open(range->fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+    posix_fadvise(fd, range->start, range->end - range->start, POSIX_FADV_SEQUENTIAL);
+
+    char before;
+    int skip = range->start > 0 && pread(fd, &before, 1, range->start - 1) == 1 && before != '\n';
+    off_t base = range->start; /* file offset of data[0] */
+    off_t advised = range->start;
+    PipeBlock *block = pipe_take(&pipeline->freeBlocks, &pipeline->reader);
+    block->len = 0;
+
+    for (;;)
+    {
+        off_t pos = base + block->len;
+        if (pos + PIPE_BLOCK > advised)
+        {
+            posix_fadvise(fd, advised, PIPE_READAHEAD, POSIX_FADV_WILLNEED);
+            advised += PIPE_READAHEAD;
+        }
+        ssize_t n = pread(fd, block->data + block->len, PIPE_BLOCK - block->len, pos);
+        if (n < 0)
+        {
+            perror("read failed");
+            exit(EXIT_FAILURE);
+        }
+        block->len += n;
+
+        if (skip)
+        {
+            char *nl = memchr(block->data, '\n', block->len);
+            size_t drop = nl != NULL ? (size_t)(nl + 1 - block->data) : block->len;
+            memmove(block->data, block->data + drop, block->len - drop);
+            base += drop;
+            block->len -= drop;
+            skip = nl == NULL;
+            if (base >= range->end)
+            {
+                block->len = 0;
+                break;
+            }
+        }
+
+        /* The range owns the line holding its last byte, wherever that line ends. */
+        if (base + (off_t)block->len >= range->end)
+        {
+            size_t from = range->end - 1 - base;
+            char *nl = memchr(block->data + from, '\n', block->len - from);
+            if (nl != NULL)
+            {
+                block->len = nl + 1 - block->data;
+                break;
+            }
+        }
+        if (n == 0)
+            break;
+        if (block->len < PIPE_BLOCK)
+            continue;
+
+        char *nl = memrchr(block->data, '\n', block->len);
+        size_t keep = nl != NULL ? (size_t)(nl + 1 - block->data) : block->len;
+        PipeBlock *next = pipe_take(&pipeline->freeBlocks, &pipeline->reader);
+        next->len = block->len - keep;
+        memcpy(next->data, block->data + keep, next->len);
+        block->len = keep;
+        mpmc_queue_push(&pipeline->fullBlocks, block);
+        pipeline->reader.items++;
+        base += keep;
+        block = next;
+    }
+
+    if (block->len > 0)
+    {
+        mpmc_queue_push(&pipeline->fullBlocks, block);
+        pipeline->reader.items++;
+    }
+    else
+        mpmc_queue_push(&pipeline->freeBlocks, block);
+    close(fd);
+}
+
+static void *pipe_reader(void *arg)
+{
+    Pipeline *pipeline = arg;
+    double started = now_seconds();
+    for (int r = 0; r < pipeline->nranges; r++)
+        pipe_read_range(pipeline, &pipeline->ranges[r]);
+    for (int p = 0; p < pipeline->parsers; p++)
+        mpmc_queue_push(&pipeline->fullBlocks, NULL);
+    pipeline->reader.busy = now_seconds() - started - pipeline->reader.wait;
+    return NULL;
+}
+
+static void *pipe_parser(void *arg)
+{
+    PipeParser *self = arg;
+    Pipeline *pipeline = self->pipeline;
+    PipeTimer *timer = &pipeline->parser[self->index];
+    double started = now_seconds();
+    PipeBatch *batch = pipe_take(&pipeline->freeBatches, timer);
+    PipeBlock *block;
+
+    batch->n = 0;
+    while ((block = pipe_take(&pipeline->fullBlocks, timer)) != NULL)
+    {
+        const char *p = block->data;
+        const char *limit = block->data + block->len;
+        while (p < limit)
+        {
+            int ok;
+            p = parse_line(p, limit, &batch->records[batch->n], &ok);
+            if (ok && ++batch->n == PIPE_BATCH)
+            {
+                mpmc_queue_push(&pipeline->fullBatches, batch);
+                batch = pipe_take(&pipeline->freeBatches, timer);
+                batch->n = 0;
+            }
+        }
+        mpmc_queue_push(&pipeline->freeBlocks, block);
+        timer->items++;
+    }
+    mpmc_queue_push(batch->n > 0 ? &pipeline->fullBatches : &pipeline->freeBatches, batch);
+    mpmc_queue_push(&pipeline->fullBatches, NULL);
+    timer->busy = now_seconds() - started - timer->wait;
+    return NULL;
+}
+
+static void pipe_report(const Pipeline *pipeline, const char *label)
+{
+    double parseBusy = 0, parseWait = 0;
+    long blocks = 0;
+    for (int p = 0; p < pipeline->parsers; p++)
+    {
+        parseBusy += pipeline->parser[p].busy;
+        parseWait += pipeline->parser[p].wait;
+        blocks += pipeline->parser[p].items;
+    }
+    parseBusy /= pipeline->parsers;
+    parseWait /= pipeline->parsers;
+
+    const char *bottleneck = "read";
+    double most = pipeline->reader.busy;
+    if (parseBusy > most)
+    {
+        bottleneck = "parse";
+        most = parseBusy;
+    }
+    if (pipeline->aggregator.busy > most)
+        bottleneck = "aggregate";
+
+    fprintf(stderr, "pipeline %s, busy and waiting seconds per thread:\n", label);
+    fprintf(stderr, "  read          %7.3f %7.3f  %ld blocks\n", pipeline->reader.busy, pipeline->reader.wait,
+            pipeline->reader.items);
+    fprintf(stderr, "  parse x%-3d    %7.3f %7.3f  %ld blocks\n", pipeline->parsers, parseBusy, parseWait, blocks);
+    fprintf(stderr, "  aggregate     %7.3f %7.3f  %ld records\n", pipeline->aggregator.busy, pipeline->aggregator.wait,
+            pipeline->aggregator.items);
+    fprintf(stderr, "  bottleneck: %s\n", bottleneck);
+}
+
+/*
+ * Runs one pass over the ranges as a pipeline: a reader thread, parsers
+ * parser threads and the calling thread aggregating into sink, which needs
+ * no locking since only this thread touches it. Exits when the buffers or
+ * threads cannot be set up.
+ */
+void run_pipeline(const FileRange *ranges, int nranges, int parsers, RecordSink *sink, const char *label)
+{
+    int nblocks = 2 * parsers + 2;   /* one per parser, two for the reader, the rest in flight */
+    int nbatches = 4 * parsers + 4;
+    Pipeline *pipeline = aligned_alloc(64, sizeof(Pipeline));
+    PipeBlock *blocks = malloc(nblocks * sizeof(PipeBlock));
+    char *blockData = malloc((size_t)nblocks * PIPE_BLOCK);
+    PipeBatch *batches = malloc(nbatches * sizeof(PipeBatch));
+    PipeParser *self = malloc(parsers * sizeof(PipeParser));
+    pthread_t *tids = malloc((parsers + 1) * sizeof(pthread_t));
+    int failed = pipeline == NULL || blocks == NULL || blockData == NULL || batches == NULL || self == NULL ||
+                 tids == NULL;
+
+    if (!failed)
+    {
+        memset(pipeline, 0, sizeof(*pipeline));
+        pipeline->ranges = ranges;
+        pipeline->nranges = nranges;
+        pipeline->parsers = parsers;
+        failed = mpmc_queue_init(&pipeline->freeBlocks, nblocks) != 0 ||
+                 mpmc_queue_init(&pipeline->fullBlocks, nblocks + parsers) != 0 ||
+                 mpmc_queue_init(&pipeline->freeBatches, nbatches) != 0 ||
+                 mpmc_queue_init(&pipeline->fullBatches, nbatches + parsers) != 0;
+    }
+    if (failed)
+    {
+        perror("pipeline setup failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int b = 0; b < nblocks; b++)
+    {
+        blocks[b].data = blockData + (size_t)b * PIPE_BLOCK;
+        mpmc_queue_push(&pipeline->freeBlocks, &blocks[b]);
+    }
+    for (int b = 0; b < nbatches; b++)
+        mpmc_queue_push(&pipeline->freeBatches, &batches[b]);
+
+    int started = 0;
+    if (pthread_create(&tids[0], NULL, pipe_reader, pipeline) == 0)
+        for (started = 1; started <= parsers; started++)
+        {
+            self[started - 1].pipeline = pipeline;
+            self[started - 1].index = started - 1;
+            if (pthread_create(&tids[started], NULL, pipe_parser, &self[started - 1]) != 0)
+                break;
+        }
+    if (started <= parsers)
+    {
+        /* The stages already running wait for a stage that never came. */
+        perror("pthread_create failed");
+        exit(EXIT_FAILURE);
+    }
+
+    double aggStarted = now_seconds();
+    for (int running = parsers; running > 0;)
+    {
+        PipeBatch *batch = pipe_take(&pipeline->fullBatches, &pipeline->aggregator);
+        if (batch == NULL)
+        {
+            running--;
+            continue;
+        }
+        for (int i = 0; i < batch->n; i++)
+            consume(sink, &batch->records[i]);
+        pipeline->aggregator.items += batch->n;
+        mpmc_queue_push(&pipeline->freeBatches, batch);
+    }
+    pipeline->aggregator.busy = now_seconds() - aggStarted - pipeline->aggregator.wait;
+
+    for (int t = 0; t <= parsers; t++)
+        pthread_join(tids[t], NULL);
+    pipe_report(pipeline, label);
+
+    mpmc_queue_destroy(&pipeline->freeBlocks);
+    mpmc_queue_destroy(&pipeline->fullBlocks);
+    mpmc_queue_destroy(&pipeline->freeBatches);
+    mpmc_queue_destroy(&pipeline->fullBatches);
+    free(tids);
+    free(self);
+    free(batches);
+    free(blockData);
+    free(blocks);
+    free(pipeline);
+}
+
+/*
+ * Picks the store kind for indexes minIndex..maxIndex and returns the bytes
+ * one slice needs. maxRecords bounds the distinct indexes one slice can
+ * see, so a hash table of more than twice that many slots never fills up.
+ */
+size_t table_plan(StatsTable *t, int minIndex, int maxIndex, long maxRecords, int forceDense)
+{
+    size_t span = (size_t)maxIndex + 1;
+    size_t present = (size_t)(maxIndex - minIndex) + 1;
+    size_t distinct = (size_t)maxRecords < present ? (size_t)maxRecords : present;
+    size_t sparseCapacity = next_pow2(2 * distinct + 1);
+
+    memset(t, 0, sizeof(*t));
+    t->maxIndex = maxIndex;
+    if (forceDense || store_bytes(STORE_DENSE, span) <= store_bytes(STORE_SPARSE, sparseCapacity))
+    {
+        t->kind = STORE_DENSE;
+        t->capacity = span;
+    }
+    else
+    {
+        t->kind = STORE_SPARSE;
+        t->capacity = sparseCapacity;
+    }
+    return store_bytes(t->kind, t->capacity);
+}
+
+int table_bind(StatsTable *t, char *mem, int nslices)
+{
+    size_t sliceBytes = store_bytes(t->kind, t->capacity);
+    t->slices = malloc(nslices * sizeof(StatsStore));
+    if (t->slices == NULL)
+        return -1;
+    for (int s = 0; s < nslices; s++)
+        store_bind(&t->slices[s], mem + s * sliceBytes, t->kind, t->capacity);
+    return 0;
+}
+
+/*
+ * Carves one shared segment into the lock header and nslices stores for
+ * items and, with withUsers, for users. maxItemId > 0 forces a dense item
+ * store of that size; scan describes the whole input otherwise, including
+ * what a saved state contributes. Every index is widened to agg->buckets
+ * keys.
+ */
+int aggregation_init(Aggregation *agg, int nslices, const RangeScan *scan, long sliceRecords, int maxItemId,
+                     int withUsers)
+{
+    long buckets = agg->buckets;
+    int maxMovie = maxItemId > 0 ? maxItemId - 1 : scan->movies.max - 1;
+    int minMovie = maxItemId > 0 ? 0 : scan->movies.min - 1;
+
+    agg->nslices = nslices;
+    agg->withUsers = withUsers;
+    if ((maxMovie + 1L) * buckets > INT_MAX || (scan->users.max * buckets > INT_MAX && withUsers))
+    {
+        fprintf(stderr, "Too many ids for %ld day buckets\n", buckets);
+        return -1;
+    }
+    agg->itemLimit = maxMovie + 1;
+    agg->userLimit = scan->users.max;
+
+    size_t movieBytes = table_plan(&agg->movies, minMovie * buckets, (maxMovie + 1) * buckets - 1,
+                                   sliceRecords, maxItemId > 0);
+    size_t userBytes = withUsers ? table_plan(&agg->users, (scan->users.min - 1) * buckets,
+                                              scan->users.max * buckets - 1, sliceRecords, 0)
+                                 : 0;
+    size_t header = align64(sizeof(SharedSegment));
+
+    char *mem = shared_alloc(header + nslices * (movieBytes + userBytes));
+    if (mem == NULL)
+        return -1;
+
+    agg->seg = (SharedSegment *)mem;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&agg->seg->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    if (table_bind(&agg->movies, mem + header, nslices) != 0)
+        return -1;
+    if (withUsers && table_bind(&agg->users, mem + header + nslices * movieBytes, nslices) != 0)
+        return -1;
+    return 0;
+}
+
+/* Number of slots to walk in s; a sparse store hands them out in order. */
+static size_t store_slots(const StatsStore *s)
+{
+    return s->table != NULL ? (size_t)*s->used : s->capacity;
+}
+
+/* Index held by a slot. */
+static int slot_index(const StatsStore *s, size_t slot)
+{
+    return s->table != NULL ? s->slotIndex[slot] : (int)slot;
+}
+
+/* Sparse store in private memory, for results that live past the workers. */
+static int private_store(StatsTable *t, StoreKind kind, size_t capacity)
+{
+    void *mem = calloc(1, store_bytes(kind, capacity));
+    StatsStore *store = malloc(sizeof(StatsStore));
+    if (mem == NULL || store == NULL)
+    {
+        free(mem);
+        free(store);
+        return -1;
+    }
+    store_bind(store, mem, kind, capacity);
+
+    if (t->resultMem != NULL)
+    {
+        free(t->resultMem);
+        free(t->result);
+    }
+    t->kind = kind;
+    t->capacity = capacity;
+    t->result = store;
+    t->resultMem = mem;
+    return 0;
+}
+
+static void merge_store(StatsStore *dst, const StatsStore *src)
+{
+    size_t slots = store_slots(src);
+    for (size_t slot = 0; slot < slots; slot++)
+    {
+        int index = slot_index(src, slot);
+        if (src->count[slot] > 0 && index >= 0)
+            stats_merge_slot(dst, store_slot(dst, index, 0), src, slot);
+    }
+}
+
+/*
+ * Combines the slices, and base when given, into t->result in O(slots).
+ * Dense slices fold into the first one; sparse slices are re-inserted by
+ * index into a private store sized for everything they hold.
+ */
+int table_merge(StatsTable *t, int nslices, MergeMode mode, const StatsStore *base)
+{
+    if (mode == MERGE_ATOMIC)
+        stats_from_histogram(&t->slices[0], t->capacity);
+
+    if (t->kind == STORE_DENSE)
+    {
+        StatsStore *dst = &t->slices[0];
+        for (int s = 1; s < nslices; s++)
+            for (size_t i = 0; i < t->capacity; i++)
+                stats_merge_slot(dst, i, &t->slices[s], i);
+        t->result = dst;
+        if (base != NULL)
+            merge_store(dst, base);
+        return 0;
+    }
+
+    size_t total = base != NULL ? store_slots(base) : 0;
+    for (int s = 0; s < nslices; s++)
+        total += *t->slices[s].used;
+
+    if (private_store(t, STORE_SPARSE, next_pow2(2 * total + 1)) != 0)
+        return -1;
+    for (int s = 0; s < nslices; s++)
+        merge_store(t->result, &t->slices[s]);
+    if (base != NULL)
+        merge_store(t->result, base);
+    return 0;
+}
+
+/*
+ * Collapses the day buckets of a merged table into one entry per index.
+ * The result keeps the table's store kind.
+ */
+int table_fold(StatsTable *t, int buckets)
+{
+    if (buckets == 1)
+        return 0;
+
+    StatsStore *src = t->result;
+    void *srcMem = t->resultMem;
+    size_t slots = store_slots(src);
+    size_t capacity = t->kind == STORE_DENSE ? (size_t)(t->maxIndex + 1) / buckets : next_pow2(2 * slots + 1);
+
+    t->result = NULL;
+    t->resultMem = NULL;
+    if (private_store(t, t->kind, capacity) != 0)
+        return -1;
+    t->maxIndex = (t->maxIndex + 1) / buckets - 1;
+
+    for (size_t slot = 0; slot < slots; slot++)
+    {
+        int index = slot_index(src, slot);
+        if (src->count[slot] > 0 && index >= 0)
+            stats_merge_slot(t->result, store_slot(t->result, index / buckets, 0), src, slot);
+    }
+
+    if (srcMem != NULL)
+    {
+        free(srcMem);
+        free(src);
+    }
+    return 0;
+}
+
+long table_records(const StatsTable *t)
+{
+    long records = 0;
+    size_t slots = store_slots(t->result);
+    for (size_t i = 0; i < slots; i++)
+        records += t->result->count[i];
+    return records;
+}
+
+void table_free(StatsTable *t)
+{
+    if (t->resultMem != NULL)
+    {
+        free(t->resultMem);
+        free(t->result);
+    }
+    free(t->slices);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Lists the merged slots in index order as (index << 32 | slot). A dense
+ * table lists every index so the plain listing keeps its unrated items.
+ */
+size_t table_order(const StatsTable *t, uint64_t **order)
+{
+    const StatsStore *s = t->result;
+    size_t n = 0;
+
+    if (t->kind == STORE_DENSE)
+    {
+        *order = malloc(t->capacity * sizeof(uint64_t));
+        if (*order == NULL)
+            return 0;
+        for (size_t i = 0; i < t->capacity; i++)
+            (*order)[n++] = (uint64_t)i << 32 | i;
+        return n;
+    }
+
+    *order = malloc(*s->used * sizeof(uint64_t) + 1);
+    if (*order == NULL)
+        return 0;
+    for (int slot = 0; slot < *s->used; slot++)
+        (*order)[n++] = (uint64_t)s->slotIndex[slot] << 32 | (uint32_t)slot;
+    qsort(*order, n, sizeof(uint64_t), compare_u64);
+    return n;
+}
+
+/* Drops the entries of order with fewer than minCount ratings. */
+size_t order_threshold(const StatsTable *t, uint64_t *order, size_t n, int minCount)
+{
+    const StatsStore *s = t->result;
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++)
+        if (s->count[(uint32_t)order[i]] >= minCount)
+            order[kept++] = order[i];
+    return kept;
+}
+
+/* Rank order of the top-K query: higher mean, then more ratings, then lower index. */
+static inline int ranks_before(const StatsStore *s, uint64_t a, uint64_t b)
+{
+    uint32_t x = (uint32_t)a, y = (uint32_t)b;
+    if (s->mean[x] != s->mean[y])
+        return s->mean[x] > s->mean[y];
+    if (s->count[x] != s->count[y])
+        return s->count[x] > s->count[y];
+    return (int)(a >> 32) < (int)(b >> 32);
+}
+
+/* Min-heap on rank: the root is the weakest entry kept so far. */
+static void heap_sift_down(const StatsStore *s, uint64_t *heap, size_t n, size_t i)
+{
+    for (;;)
+    {
+        size_t weakest = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && ranks_before(s, heap[weakest], heap[l]))
+            weakest = l;
+        if (r < n && ranks_before(s, heap[weakest], heap[r]))
+            weakest = r;
+        if (weakest == i)
+            return;
+        uint64_t tmp = heap[i];
+        heap[i] = heap[weakest];
+        heap[weakest] = tmp;
+        i = weakest;
+    }
+}
+
+static void heap_offer(const StatsStore *s, uint64_t *heap, size_t *n, size_t k, uint64_t entry)
+{
+    if (*n < k)
+    {
+        size_t i = (*n)++;
+        heap[i] = entry;
+        while (i > 0 && ranks_before(s, heap[(i - 1) / 2], heap[i]))
+        {
+            uint64_t tmp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    }
+    else if (ranks_before(s, entry, heap[0]))
+    {
+        heap[0] = entry;
+        heap_sift_down(s, heap, k, 0);
+    }
+}
 
 typedef struct
 {
-    int sumRating[MAX_MOVIES];
-    int count[MAX_MOVIES];
-} ShareData;
+    const StatsTable *t;
+    size_t k;
+    int minCount;
+    long workers;
+    uint64_t *heaps; /* shared: k entries per worker */
+    size_t *sizes;   /* shared: entries used per worker */
+} TopJob;
 
-void read_and_process_file(char *fileName, int shmid)
+/* Keeps the best k slots of one contiguous share of the slots. */
+void top_job(int w, void *arg)
 {
-    ShareData *data = (ShareData *)shmat(shmid, NULL, 0);
-    FILE *file = fopen(fileName, "r");
-    if (file == NULL)
+    TopJob *job = arg;
+    const StatsStore *s = job->t->result;
+    size_t slots = store_slots(s);
+    size_t first = slots * w / job->workers, last = slots * (w + 1) / job->workers;
+    uint64_t *heap = job->heaps + (size_t)w * job->k;
+    size_t n = 0;
+
+    for (size_t slot = first; slot < last; slot++)
+        if (s->count[slot] > 0 && s->count[slot] >= job->minCount)
+            heap_offer(s, heap, &n, job->k, (uint64_t)(uint32_t)slot_index(s, slot) << 32 | slot);
+    job->sizes[w] = n;
+}
+
+/*
+ * Selects the k best rated entries with at least minCount ratings into
+ * *order, best first. Each worker keeps a k-entry heap over its share of
+ * the slots in O(n log k) and the parent merges the worker heaps the same
+ * way, so nothing but the k winners is ever sorted.
+ */
+size_t table_top(const StatsTable *t, size_t k, int minCount, long workers, uint64_t **order)
+{
+    const StatsStore *s = t->result;
+    size_t slots = store_slots(s);
+
+    *order = NULL;
+    if (k > slots)
+        k = slots;
+    if (k == 0)
+        return 0;
+    /* Forking only pays off when every worker has a sizable share. */
+    if (workers > (long)(slots / TOP_MIN_SHARE))
+        workers = slots / TOP_MIN_SHARE;
+    if (workers < 1)
+        workers = 1;
+
+    TopJob job = {t, k, minCount, workers, NULL, NULL};
+    size_t bytes = workers * k * sizeof(uint64_t);
+    job.heaps = shared_alloc(bytes + workers * sizeof(size_t));
+    *order = malloc(k * sizeof(uint64_t));
+    if (job.heaps == NULL || *order == NULL)
     {
-        perror("Error opening file");
-        exit(EXIT_FAILURE);
+        if (job.heaps != NULL)
+            shared_free(job.heaps);
+        free(*order);
+        *order = NULL;
+        return 0;
+    }
+    job.sizes = (size_t *)((char *)job.heaps + bytes);
+
+    int failed;
+    if (workers == 1)
+    {
+        top_job(0, &job);
+        failed = 0;
+    }
+    else
+        failed = run_workers(workers, top_job, &job);
+
+    size_t n = 0;
+    for (long w = 0; !failed && w < workers; w++)
+        for (size_t i = 0; i < job.sizes[w]; i++)
+            heap_offer(s, *order, &n, k, job.heaps[w * k + i]);
+    shared_free(job.heaps);
+
+    /* Popping the weakest root to the back leaves the heap sorted best first. */
+    for (size_t end = n; end > 1; end--)
+    {
+        uint64_t tmp = (*order)[0];
+        (*order)[0] = (*order)[end - 1];
+        (*order)[end - 1] = tmp;
+        heap_sift_down(s, *order, end - 1, 0);
+    }
+    return n;
+}
+
+void out_flush(OutBuffer *out)
+{
+    size_t done = 0;
+    while (done < out->len && !out->failed)
+    {
+        ssize_t n = write(out->fd, out->data + done, out->len - done);
+        if (n < 0)
+        {
+            perror("write failed");
+            out->failed = 1;
+        }
+        else
+            done += n;
+    }
+    out->len = 0;
+}
+
+void out_write(OutBuffer *out, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0)
+    {
+        if (out->len == OUT_BUFFER_SIZE)
+            out_flush(out);
+        size_t chunk = OUT_BUFFER_SIZE - out->len < size ? OUT_BUFFER_SIZE - out->len : size;
+        memcpy(out->data + out->len, p, chunk);
+        out->len += chunk;
+        p += chunk;
+        size -= chunk;
+    }
+}
+
+void out_printf(OutBuffer *out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->data + out->len, OUT_BUFFER_SIZE - out->len, format, args);
+    va_end(args);
+    if (n >= 0 && (size_t)n >= OUT_BUFFER_SIZE - out->len)
+    {
+        out_flush(out);
+        va_start(args, format);
+        n = vsnprintf(out->data, OUT_BUFFER_SIZE, format, args);
+        va_end(args);
+    }
+    if (n > 0)
+        out->len += n;
+}
+
+static char *format_uint(char *p, unsigned long v)
+{
+    char digits[24];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    while (n > 0)
+        *p++ = digits[--n];
+    return p;
+}
+
+/*
+ * Formats a non-negative float like printf's %.3f. value * 1000 is exact in
+ * a double, so rint rounds ties to even just as printf does.
+ */
+static char *format_fixed3(char *p, float value)
+{
+    unsigned long thousandths = (unsigned long)rint((double)value * 1000.0);
+    p = format_uint(p, thousandths / 1000);
+    *p++ = '.';
+    *p++ = '0' + thousandths / 100 % 10;
+    *p++ = '0' + thousandths / 10 % 10;
+    *p++ = '0' + thousandths % 10;
+    return p;
+}
+
+/*
+ * The exact sum of the slot's ratings, from the histogram. Printed means
+ * come from it rather than the Welford mean, which is rounded differently
+ * depending on how the workers' partials were merged.
+ */
+static int64_t rating_sum(const StatsStore *s, int slot)
+{
+    int64_t sum = 0;
+    for (int r = 0; r < RATING_LEVELS; r++)
+        sum += (int64_t)(MIN_RATING + r) * s->hist[r * s->capacity + slot];
+    return sum;
+}
+
+/* Variance is the population variance of the item's or user's ratings. */
+void print_stats(OutBuffer *out, const char *label, const StatsTable *t, const uint64_t *order, size_t n)
+{
+    const StatsStore *s = t->result;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        int slot = (uint32_t)order[i];
+        int64_t count = s->count[slot];
+        if (count == 0)
+            continue;
+        int64_t sum = rating_sum(s, slot), squares = 0;
+        for (int r = 0; r < RATING_LEVELS; r++)
+            squares += (int64_t)(MIN_RATING + r) * (MIN_RATING + r) * s->hist[r * s->capacity + slot];
+        out_printf(out, "%s %d count %d mean %.3f var %.3f hist", label, (int)(order[i] >> 32), s->count[slot],
+                   (double)sum / count, (double)(count * squares - sum * sum) / ((double)count * count));
+        for (int r = 0; r < RATING_LEVELS; r++)
+            out_printf(out, " %d", s->hist[r * s->capacity + slot]);
+        out_printf(out, " first %d last %d\n", s->minTs[slot], s->maxTs[slot]);
+    }
+}
+
+void print_averages(OutBuffer *out, const StatsTable *t, const uint64_t *order, size_t n)
+{
+    const StatsStore *s = t->result;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        int slot = (uint32_t)order[i];
+        int index = order[i] >> 32;
+        float avg_rating = s->count[slot] > 0 ? (float)rating_sum(s, slot) / s->count[slot] : 0.0;
+
+        char line[64];
+        char *p = line;
+        memcpy(p, "ITEM ", 5);
+        p += 5;
+        if (index < 0)
+            *p++ = '-';
+        p = format_uint(p, index < 0 ? 1 : (unsigned)index);
+        memcpy(p, " has ", 5);
+        p = format_fixed3(p + 5, avg_rating);
+        memcpy(p, " rating\n", 8);
+        out_write(out, line, p + 8 - line);
+    }
+}
+
+static void out_pad(OutBuffer *out, size_t *offset)
+{
+    static const char zeros[8];
+    size_t aligned = (*offset + 7) & ~(size_t)7;
+    out_write(out, zeros, aligned - *offset);
+    *offset = aligned;
+}
+
+/*
+ * Writes the rated items of order in the columnar layout described at the
+ * top. Unrated entries are squeezed out of order in place.
+ */
+int write_columns(OutBuffer *out, const StatsTable *t, uint64_t *order, size_t n)
+{
+    const StatsStore *s = t->result;
+    size_t rows = 0;
+
+    for (size_t i = 0; i < n; i++)
+        if (s->count[(uint32_t)order[i]] > 0)
+            order[rows++] = order[i];
+
+    int32_t *ids = malloc(rows * sizeof(int32_t) + 1);
+    int32_t *counts = malloc(rows * sizeof(int32_t) + 1);
+    int64_t *sums = malloc(rows * sizeof(int64_t) + 1);
+    double *means = malloc(rows * sizeof(double) + 1);
+    if (ids == NULL || counts == NULL || sums == NULL || means == NULL)
+    {
+        free(ids);
+        free(counts);
+        free(sums);
+        free(means);
+        return -1;
+    }
+
+    for (size_t i = 0; i < rows; i++)
+    {
+        int slot = (uint32_t)order[i];
+        int64_t sum = rating_sum(s, slot);
+        ids[i] = (int32_t)(order[i] >> 32) + 1;
+        counts[i] = s->count[slot];
+        sums[i] = sum;
+        means[i] = (double)sum / s->count[slot];
     }
 
-    int userId, movieId, rating, timeStamp;
-    while (fscanf(file, "%d\t%d\t%d\t%d", &userId, &movieId, &rating, &timeStamp) != EOF)
+    ColumnHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "RATCOL01", 8);
+    header.rows = rows;
+    size_t offset = sizeof(header);
+    header.idOffset = offset;
+    offset = (offset + rows * sizeof(int32_t) + 7) & ~(size_t)7;
+    header.countOffset = offset;
+    offset = (offset + rows * sizeof(int32_t) + 7) & ~(size_t)7;
+    header.sumOffset = offset;
+    header.meanOffset = offset + rows * sizeof(int64_t);
+
+    offset = sizeof(header);
+    out_write(out, &header, sizeof(header));
+    out_write(out, ids, rows * sizeof(int32_t));
+    offset += rows * sizeof(int32_t);
+    out_pad(out, &offset);
+    out_write(out, counts, rows * sizeof(int32_t));
+    offset += rows * sizeof(int32_t);
+    out_pad(out, &offset);
+    out_write(out, sums, rows * sizeof(int64_t));
+    out_write(out, means, rows * sizeof(double));
+
+    free(ids);
+    free(counts);
+    free(sums);
+    free(means);
+    return 0;
+}
+
+void state_free(SavedState *state)
+{
+    for (int i = 0; i < state->ninputs; i++)
+        free(state->inputs[i].path);
+    free(state->inputs);
+    free(state->rows[0]);
+    free(state->rows[1]);
+    memset(state, 0, sizeof(*state));
+}
+
+/* Returns 0 after loading, 1 when there is no state file yet, -1 on error. */
+int state_load(const char *path, SavedState *state)
+{
+    memset(state, 0, sizeof(*state));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
     {
-        int index = movieId - 1;
+        if (errno == ENOENT)
+            return 1;
+        perror(path);
+        return -1;
+    }
 
-        data->sumRating[index] += rating;
-        data->count[index]++;
+    StateHeader header;
+    int ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "RATSTAT1", 8) == 0;
+    if (ok)
+    {
+        state->windowDays = header.windowDays;
+        state->maxTs = header.maxTs;
+        state->inputs = calloc(header.ninputs + 1, sizeof(StateInput));
+        ok = state->inputs != NULL;
+    }
+    for (uint32_t i = 0; ok && i < header.ninputs; i++)
+    {
+        StateInputEntry entry;
+        StateInput *input = &state->inputs[i];
+        ok = fread(&entry, sizeof(entry), 1, file) == 1 && entry.pathLength < PATH_MAX &&
+             (input->path = calloc(entry.pathLength + 1, 1)) != NULL &&
+             fread(input->path, 1, entry.pathLength, file) == entry.pathLength;
+        input->dev = entry.dev;
+        input->ino = entry.ino;
+        input->offset = entry.offset;
+        state->ninputs = i + 1;
+    }
+    for (int t = 0; ok && t < 2; t++)
+    {
+        state->nrows[t] = header.rows[t];
+        state->rows[t] = malloc(header.rows[t] * sizeof(StateRow) + 1);
+        ok = state->rows[t] != NULL &&
+             fread(state->rows[t], sizeof(StateRow), header.rows[t], file) == header.rows[t];
     }
 
     fclose(file);
-    shmdt(data);
-    exit(0);
+    if (!ok)
+    {
+        fprintf(stderr, "%s is not a valid state file\n", path);
+        state_free(state);
+        return -1;
+    }
+    return 0;
 }
 
-int main(int argc, char *argv[])
+static int write_rows(FILE *file, const StatsTable *t, const Aggregation *agg, uint64_t *rows)
+{
+    const StatsStore *s = t->result;
+    size_t slots = store_slots(s);
+    *rows = 0;
+    for (size_t slot = 0; slot < slots; slot++)
+    {
+        int key = slot_index(s, slot);
+        if (s->count[slot] == 0 || key < 0)
+            continue;
+
+        StateRow row;
+        memset(&row, 0, sizeof(row));
+        row.index = key / agg->buckets;
+        row.day = agg->buckets > 1 ? agg->windowStartDay + key % agg->buckets : 0;
+        row.count = s->count[slot];
+        for (int r = 0; r < RATING_LEVELS; r++)
+            row.hist[r] = s->hist[r * s->capacity + slot];
+        row.minTs = s->minTs[slot];
+        row.maxTs = s->maxTs[slot];
+        row.mean = s->mean[slot];
+        row.m2 = s->m2[slot];
+        if (fwrite(&row, sizeof(row), 1, file) != 1)
+            return -1;
+        (*rows)++;
+    }
+    return 0;
+}
+
+/*
+ * Writes the merged (not yet folded) tables next to path and renames the
+ * file over it, so an interrupted run leaves the previous state intact.
+ */
+int state_save(const char *path, const SavedState *state, const Aggregation *agg)
 {
-    int shmid = shmget(SHM_KEY, sizeof(ShareData), 0666 | IPC_CREAT);
+    char tmpPath[PATH_MAX];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL)
+    {
+        perror(tmpPath);
+        return -1;
+    }
+
+    StateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "RATSTAT1", 8);
+    header.ninputs = state->ninputs;
+    header.windowDays = state->windowDays;
+    header.maxTs = state->maxTs;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
 
-    if (shmid < 0)
+    for (int i = 0; ok && i < state->ninputs; i++)
     {
-        perror("Shared-memory failed");
-        exit(1);
+        StateInputEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.dev = state->inputs[i].dev;
+        entry.ino = state->inputs[i].ino;
+        entry.offset = state->inputs[i].offset;
+        entry.pathLength = strlen(state->inputs[i].path);
+        ok = fwrite(&entry, sizeof(entry), 1, file) == 1 &&
+             fwrite(state->inputs[i].path, 1, entry.pathLength, file) == entry.pathLength;
+    }
+
+    ok = ok && write_rows(file, &agg->movies, agg, &header.rows[0]) == 0 &&
+         write_rows(file, &agg->users, agg, &header.rows[1]) == 0;
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpPath, path) != 0)
+    {
+        perror("saving state failed");
+        unlink(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Loads the saved rows of one table that still fall inside the window into
+ * a private sparse store keyed like the live tables, and widens range to
+ * cover their ids. Returns the number of rows kept, or -1 on error.
+ */
+long state_base(const SavedState *state, int table, const Aggregation *agg, StatsTable *base, IdRange *range,
+                long seen)
+{
+    memset(base, 0, sizeof(*base));
+    if (private_store(base, STORE_SPARSE, next_pow2(2 * state->nrows[table] + 1)) != 0)
+        return -1;
+
+    long kept = 0;
+    for (size_t i = 0; i < state->nrows[table]; i++)
+    {
+        const StateRow *row = &state->rows[table][i];
+        int key = row->index;
+        if (agg->buckets > 1)
+        {
+            int bucket = row->day - agg->windowStartDay;
+            if (bucket < 0 || bucket >= agg->buckets)
+                continue;
+            key = row->index * agg->buckets + bucket;
+        }
+
+        StatsStore *s = base->result;
+        int slot = store_slot(s, key, 0);
+        StatsStore one = {&(double){row->mean}, &(double){row->m2}, &(int){row->count}, (int *)row->hist,
+                          &(int){row->minTs}, &(int){row->maxTs}, NULL, NULL, NULL, 1};
+        stats_merge_slot(s, slot, &one, 0);
+
+        IdRange id = {row->index + 1, row->index + 1};
+        merge_range(range, &id, seen + kept);
+        kept++;
+    }
+    return kept;
+}
+
+/*
+ * Parses every input whole on the calling process with each parser and
+ * reports the best of a few rounds, so page-cache warm-up is not counted.
+ */
+int benchmark_parsers(char **files, int nfiles, off_t totalBytes)
+{
+    static const char *parserNames[] = {"mmap", "stdio"};
+
+    for (int parser = PARSE_MMAP; parser <= PARSE_STDIO; parser++)
+    {
+        double best = 0;
+        RangeScan scan;
+        for (int round = 0; round < 3; round++)
+        {
+            memset(&scan, 0, sizeof(scan));
+            RecordSink sink = {&scan, NULL, 0};
+            double started = now_seconds();
+            for (int i = 0; i < nfiles; i++)
+            {
+                FileRange whole = {files[i], 0, 0};
+                struct stat st;
+                if (stat(files[i], &st) == 0)
+                    whole.end = st.st_size;
+                read_and_process_range(&whole, &sink, parser);
+            }
+            double elapsed = now_seconds() - started;
+            if (round == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        printf("%-6s %ld records in %.3f s, %.1f MB/s\n",
+               parserNames[parser], scan.records, best, totalBytes / best / 1e6);
     }
 
-    ShareData *data = (ShareData *)shmat(shmid, NULL, 0);
-    if (data == (void *)-1)
+    return 0;
+}
+
+void parse_options(int argc, char *argv[], Options *opt)
+{
+    static char *defaultFiles[] = {"movie-100k_1.txt", "movie-100k_2.txt"};
+    int c;
+
+    memset(opt, 0, sizeof(*opt));
+    opt->workers = sysconf(_SC_NPROCESSORS_ONLN);
+    opt->mode = MERGE_SLICE;
+    opt->parser = PARSE_MMAP;
+    opt->format = OUTPUT_TEXT;
+
+    while ((c = getopt(argc, argv, "j:TP:m:p:n:sF:o:S:w:k:c:B")) != -1)
+    {
+        switch (c)
+        {
+        case 'j':
+            opt->workers = strtol(optarg, NULL, 10);
+            break;
+        case 'T':
+            opt->threads = 1;
+            break;
+        case 'P':
+            opt->parsers = strtol(optarg, NULL, 10);
+            if (opt->parsers < 1 || opt->parsers > PIPE_MAX_PARSERS)
+            {
+                fprintf(stderr, "Invalid parser count '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'm':
+            if (strcmp(optarg, "slice") == 0)
+                opt->mode = MERGE_SLICE;
+            else if (strcmp(optarg, "atomic") == 0)
+                opt->mode = MERGE_ATOMIC;
+            else if (strcmp(optarg, "lock") == 0)
+                opt->mode = MERGE_LOCK;
+            else
+            {
+                fprintf(stderr, "Unknown merge mode '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            if (strcmp(optarg, "mmap") == 0)
+                opt->parser = PARSE_MMAP;
+            else if (strcmp(optarg, "stdio") == 0)
+                opt->parser = PARSE_STDIO;
+            else
+            {
+                fprintf(stderr, "Unknown parser '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'n':
+            opt->maxItemId = strtol(optarg, NULL, 10);
+            if (opt->maxItemId < 1 || opt->maxItemId > 0x7fffffff)
+            {
+                fprintf(stderr, "Invalid item id bound '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            opt->fullStats = 1;
+            break;
+        case 'F':
+            if (strcmp(optarg, "text") == 0)
+                opt->format = OUTPUT_TEXT;
+            else if (strcmp(optarg, "binary") == 0)
+                opt->format = OUTPUT_BINARY;
+            else
+            {
+                fprintf(stderr, "Unknown output format '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'o':
+            opt->outputPath = optarg;
+            break;
+        case 'S':
+            opt->statePath = optarg;
+            break;
+        case 'w':
+            opt->windowDays = strtol(optarg, NULL, 10);
+            if (opt->windowDays < 1)
+            {
+                fprintf(stderr, "Invalid window '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'k':
+            opt->topK = strtol(optarg, NULL, 10);
+            if (opt->topK < 1)
+            {
+                fprintf(stderr, "Invalid top-K '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            opt->minCount = strtol(optarg, NULL, 10);
+            if (opt->minCount < 1)
+            {
+                fprintf(stderr, "Invalid minimum rating count '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'B':
+            opt->benchmark = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j workers] [-T] [-P parsers] [-m slice|atomic|lock] [-p mmap|stdio] [-n max-item-id] [-s] "
+                            "[-F text|binary] [-o output] [-S state] [-w days] [-k top] [-c min-count] [-B] [file ...]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+    if (opt->workers < 1)
+        opt->workers = 1;
+    if (opt->fullStats && opt->format == OUTPUT_BINARY)
+    {
+        fprintf(stderr, "-s cannot be combined with -F binary\n");
+        exit(1);
+    }
+    if (opt->maxItemId > 0 && opt->statePath != NULL)
     {
-        perror("shmat failed");
+        fprintf(stderr, "-n cannot be combined with -S\n");
         exit(1);
     }
 
-    memset(data, 0, sizeof(ShareData));
+    opt->files = defaultFiles;
+    opt->nfiles = 2;
+    if (optind < argc)
+    {
+        opt->files = argv + optind;
+        opt->nfiles = argc - optind;
+    }
+}
+
+/*
+ * Decides where reading starts and stops in every input. With a state the
+ * saved offset of the same file is the start and the end is trimmed to the
+ * last complete line. The state's input list is updated to the new ends.
+ */
+int input_extents(const Options *opt, SavedState *state, off_t *starts, off_t *ends)
+{
+    for (int i = 0; i < opt->nfiles; i++)
+    {
+        struct stat st;
+        if (stat(opt->files[i], &st) != 0)
+        {
+            perror(opt->files[i]);
+            return -1;
+        }
+
+        StateInput *input = NULL;
+        for (int k = 0; opt->statePath != NULL && k < state->ninputs; k++)
+            if (state->inputs[k].dev == (uint64_t)st.st_dev && state->inputs[k].ino == (uint64_t)st.st_ino)
+                input = &state->inputs[k];
+
+        starts[i] = input != NULL ? input->offset : 0;
+        ends[i] = st.st_size;
+        if (starts[i] > st.st_size)
+        {
+            fprintf(stderr, "%s is shorter than when the state was saved\n", opt->files[i]);
+            return -1;
+        }
+        if (opt->statePath == NULL)
+            continue;
+
+        ends[i] = last_line_end(opt->files[i], starts[i], st.st_size);
+        if (input == NULL)
+        {
+            StateInput *grown = realloc(state->inputs, (state->ninputs + 1) * sizeof(StateInput));
+            if (grown == NULL)
+                return -1;
+            state->inputs = grown;
+            input = &state->inputs[state->ninputs++];
+            input->dev = st.st_dev;
+            input->ino = st.st_ino;
+            input->path = strdup(opt->files[i]);
+        }
+        input->offset = ends[i];
+    }
+    return 0;
+}
+
+void open_output(OutBuffer *out, const char *path)
+{
+    out->fd = STDOUT_FILENO;
+    out->len = 0;
+    out->failed = 0;
+    if (path != NULL)
+    {
+        out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out->fd < 0)
+        {
+            perror(path);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *modeNames[] = {"slice", "atomic", "lock"};
+    static const char *storeNames[] = {"dense", "sparse"};
+    Options opt;
+    parse_options(argc, argv, &opt);
 
-    pid_t pid1 = fork();
-    if (pid1 == 0)
+    static WorkPool pool;
+    if (opt.threads && !opt.benchmark)
     {
-        read_and_process_file("movie-100k_1.txt", shmid);
-        exit(0);
+        if (work_pool_init(&pool, opt.workers) != 0)
+        {
+            perror("thread pool failed");
+            exit(1);
+        }
+        workerPool = &pool;
     }
-    else if (pid1 < 0)
+
+    SavedState state;
+    memset(&state, 0, sizeof(state));
+    if (opt.statePath != NULL)
     {
-        perror("First fork failed");
+        int rc = state_load(opt.statePath, &state);
+        if (rc < 0)
+            exit(1);
+        if (rc == 0 && state.windowDays != opt.windowDays)
+        {
+            fprintf(stderr, "%s was created with -w %d\n", opt.statePath, state.windowDays);
+            exit(1);
+        }
+        state.windowDays = opt.windowDays;
+    }
+
+    off_t *starts = malloc(opt.nfiles * sizeof(off_t));
+    off_t *ends = malloc(opt.nfiles * sizeof(off_t));
+    FileRange *ranges;
+    off_t totalBytes;
+    if (starts == NULL || ends == NULL || input_extents(&opt, &state, starts, ends) != 0)
+        exit(1);
+    int nranges = split_inputs(opt.files, opt.nfiles, starts, ends, opt.parsers > 0 ? 1 : opt.workers, &ranges,
+                               &totalBytes);
+    free(starts);
+    free(ends);
+    if (nranges < 0)
         exit(1);
+    if (opt.benchmark)
+    {
+        int rc = benchmark_parsers(opt.files, opt.nfiles, totalBytes);
+        free(ranges);
+        return rc;
+    }
+
+    long workers = opt.parsers > 0 ? 1 : opt.workers < nranges ? opt.workers : nranges;
+    double started = now_seconds();
+    Job job = {ranges, nranges, workers, opt.parser, NULL, NULL};
+    int nslices = opt.mode == MERGE_SLICE ? workers : 1;
+    int withUsers = opt.fullStats || opt.statePath != NULL;
+    RangeScan total = {{1, 1}, {1, 1}, 0, 0};
+    long perSlice = 0;
+    Aggregation agg;
+    memset(&agg, 0, sizeof(agg));
+    agg.mode = opt.mode;
+
+    /* Users and windows have no size flag, so they always need the first pass. */
+    if (opt.parsers > 0 && (opt.maxItemId == 0 || withUsers || opt.windowDays > 0))
+    {
+        RecordSink sink = {&total, NULL, 0};
+        run_pipeline(ranges, nranges, opt.parsers, &sink, "scan");
+        perSlice = total.records;
+    }
+    else if (opt.maxItemId == 0 || withUsers || opt.windowDays > 0)
+    {
+        job.scans = shared_alloc(nranges * sizeof(RangeScan));
+        if (job.scans == NULL || run_workers(workers, scan_job, &job) != 0)
+            exit(1);
+
+        for (int w = 0; w < workers; w++)
+        {
+            long records = 0;
+            for (int r = w; r < nranges; r += workers)
+            {
+                RangeScan *scan = &job.scans[r];
+                if (scan->records == 0)
+                    continue;
+                merge_range(&total.movies, &scan->movies, total.records);
+                merge_range(&total.users, &scan->users, total.records);
+                if (total.records == 0 || scan->maxTs > total.maxTs)
+                    total.maxTs = scan->maxTs;
+                total.records += scan->records;
+                records += scan->records;
+            }
+            if (records > perSlice)
+                perSlice = records;
+        }
+        shared_free(job.scans);
+        job.scans = NULL;
     }
 
-    pid_t pid2 = fork();
-    if (pid2 == 0)
+    int64_t endTs = total.records > 0 && total.maxTs > state.maxTs ? total.maxTs : state.maxTs;
+    state.maxTs = endTs;
+    agg.buckets = 1;
+    if (opt.windowDays > 0)
+    {
+        agg.windowed = 1;
+        agg.windowStartDay = endTs / SECONDS_PER_DAY - opt.windowDays + 1;
+        if (opt.statePath != NULL)
+            agg.buckets = opt.windowDays;
+    }
+
+    StatsTable base[2];
+    memset(base, 0, sizeof(base));
+    if (opt.statePath != NULL)
+    {
+        long keptItems = state_base(&state, 0, &agg, &base[0], &total.movies, total.records);
+        long keptUsers = state_base(&state, 1, &agg, &base[1], &total.users, total.records);
+        if (keptItems < 0 || keptUsers < 0)
+            exit(1);
+    }
+    if (total.movies.min < 1)
+        total.movies.min = 1;
+    if (total.users.min < 1)
+        total.users.min = 1;
+
+    if (aggregation_init(&agg, nslices, &total, opt.mode == MERGE_SLICE ? perSlice : total.records, opt.maxItemId,
+                         withUsers) != 0)
+        exit(1);
+
+    job.agg = &agg;
+    if (opt.parsers > 0)
     {
-        read_and_process_file("movie-100k_2.txt", shmid);
-        exit(0);
+        RecordSink sink = {NULL, &agg, 0};
+        run_pipeline(ranges, nranges, opt.parsers, &sink, "aggregate");
     }
-    else if (pid2 < 0)
+    else if (run_workers(workers, aggregate_job, &job) != 0)
     {
-        perror("Second fork failed");
+        shared_free(agg.seg);
         exit(1);
     }
 
-    int status;
-    waitpid(pid1, &status, 0);
-    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+    if (table_merge(&agg.movies, nslices, opt.mode, base[0].result) != 0 ||
+        (withUsers && table_merge(&agg.users, nslices, opt.mode, base[1].result) != 0))
     {
-        shmdt(data);
-        shmctl(shmid, IPC_RMID, NULL);
+        perror("merge failed");
         exit(1);
     }
+    table_free(&base[0]);
+    table_free(&base[1]);
 
-    waitpid(pid2, &status, 0);
-    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+    if (opt.statePath != NULL && state_save(opt.statePath, &state, &agg) != 0)
+        exit(1);
+    if (table_fold(&agg.movies, agg.buckets) != 0 || (withUsers && table_fold(&agg.users, agg.buckets) != 0))
+    {
+        perror("fold failed");
+        exit(1);
+    }
+
+    double elapsed = now_seconds() - started;
+    long records = table_records(&agg.movies);
+
+    double queryStarted = now_seconds();
+    uint64_t *order;
+    size_t rows;
+    if (opt.topK > 0)
+        rows = table_top(&agg.movies, opt.topK, opt.minCount, opt.workers, &order);
+    else
+    {
+        rows = table_order(&agg.movies, &order);
+        if (opt.minCount > 0)
+            rows = order_threshold(&agg.movies, order, rows, opt.minCount);
+    }
+    if (order == NULL)
     {
-        shmdt(data);
-        shmctl(shmid, IPC_RMID, NULL);
+        perror("query failed");
         exit(1);
     }
+    double queryElapsed = now_seconds() - queryStarted;
 
-    float avg_ratings[MAX_MOVIES];
+    OutBuffer *out = malloc(sizeof(OutBuffer));
+    if (out == NULL)
+    {
+        perror("malloc failed");
+        exit(1);
+    }
+    open_output(out, opt.outputPath);
 
-    for (int i = 0; i < MAX_MOVIES; i++)
+    double outputStarted = now_seconds();
+    if (opt.format == OUTPUT_BINARY)
     {
-        if (data->count[i] > 0)
+        if (write_columns(out, &agg.movies, order, rows) != 0)
         {
-            avg_ratings[i] = (float)data->sumRating[i] / data->count[i];
-            printf("ITEM %d has %.3f rating\n", i, avg_ratings[i]);
+            perror("binary output failed");
+            exit(1);
         }
-        else
+    }
+    else if (opt.fullStats)
+    {
+        print_stats(out, "ITEM", &agg.movies, order, rows);
+        if (opt.topK == 0 && opt.minCount == 0)
         {
-            avg_ratings[i] = 0.0;
-            printf("ITEM %d has %.3f rating\n", i, avg_ratings[i]);
+            uint64_t *users;
+            size_t nusers = table_order(&agg.users, &users);
+            if (users == NULL)
+            {
+                perror("malloc failed");
+                exit(1);
+            }
+            print_stats(out, "USER", &agg.users, users, nusers);
+            free(users);
         }
     }
+    else
+        print_averages(out, &agg.movies, order, rows);
+    free(order);
+    out_flush(out);
+    double outputElapsed = now_seconds() - outputStarted;
+    if (opt.outputPath != NULL)
+        close(out->fd);
+    int outputFailed = out->failed;
+    free(out);
 
-    shmdt(data);
-    shmctl(shmid, IPC_RMID, NULL);
+    /* The report goes to stderr so stdout stays a clean result listing. */
+    fprintf(stderr, "%s merge, %s store, %ld workers, %d ranges, %ld records, %lld bytes in %.3f s\n",
+            modeNames[opt.mode], storeNames[agg.movies.kind], workers, nranges, records, (long long)totalBytes,
+            elapsed);
+    if (agg.seg->skipped > 0)
+        fprintf(stderr, "skipped %ld records with ids or ratings out of range\n", agg.seg->skipped);
+    if (agg.seg->outsideWindow > 0)
+        fprintf(stderr, "skipped %ld records older than the %d-day window\n", agg.seg->outsideWindow,
+                opt.windowDays);
+    if (elapsed > 0)
+        fprintf(stderr, "throughput: %.0f records/s, %.1f MB/s\n",
+                records / elapsed, totalBytes / elapsed / 1e6);
+    if (opt.topK > 0 || opt.minCount > 0)
+        fprintf(stderr, "query selected %zu items in %.3f s\n", rows, queryElapsed);
+    fprintf(stderr, "output written in %.3f s\n", outputElapsed);
 
-    return 0;
+    table_free(&agg.movies);
+    if (withUsers)
+        table_free(&agg.users);
+    state_free(&state);
+    free(ranges);
+    pthread_mutex_destroy(&agg.seg->lock);
+    shared_free(agg.seg);
+    if (workerPool != NULL)
+        work_pool_destroy(workerPool);
+
+    return outputFailed;
 }
@@ -0,0 +1,255 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+/*
+ * One-writer, many-reader broadcast channel for shared memory.
+ *
+ * The writer numbers its records from 1 and stores record n in slot
+ * n % slots of a ring. Every slot carries a sequence word used as a
+ * seqlock: it is 2n - 1 while record n is being written and 2n once it is
+ * complete. head is the number of the last complete record.
+ *
+ * Readers write to the segment only to announce that they are going to
+ * sleep, so any number of them can follow the channel without slowing the
+ * writer or each other. A reader keeps its own cursor, the next record
+ * number it wants. It copies the slot, then rereads the sequence word; if
+ * the word is not 2n before and after the copy, the writer has lapped the
+ * reader and the copy may be torn. The reader then skips to the oldest
+ * record still in the ring and reports how many it missed, instead of
+ * waiting for the writer or returning mixed data. Every read finishes in a
+ * bounded number of steps.
+ *
+ * broadcast_latest() reads just the newest record, for readers that want
+ * the current snapshot rather than every update. broadcast_wait() sleeps
+ * on a futex until the writer publishes; the writer only makes the wake-up
+ * call when some reader has said it is sleeping.
+ *
+ * broadcast_init stores the magic word last, with release; a reader that
+ * attaches by name waits until broadcast_valid sees it.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define BROADCAST_MAGIC 0x3130305453414342ULL /* "BCAST001" */
+#define BROADCAST_LINE 64
+
+/* broadcast_read results other than a length */
+#define BROADCAST_EMPTY (-1)
+#define BROADCAST_OVERRUN (-2)
+#define BROADCAST_CLOSED (-3)
+
+typedef struct
+{
+    uint64_t magic; /* BROADCAST_MAGIC once init is done */
+    uint32_t slots;
+    uint32_t slotBytes; /* header plus the largest payload, rounded to a line */
+    uint32_t maxPayload;
+    _Alignas(BROADCAST_LINE) uint64_t head; /* last complete record, 0 before the first */
+    uint32_t closed;
+    _Alignas(BROADCAST_LINE) uint32_t futex; /* bumped on publish when someone sleeps */
+    uint32_t sleepers;
+    _Alignas(BROADCAST_LINE) unsigned char data[];
+} Broadcast;
+
+typedef struct
+{
+    uint64_t seq;
+    uint32_t len;
+    uint32_t reserved;
+    unsigned char payload[];
+} BroadcastSlot;
+
+/* Reader-private position in the channel. */
+typedef struct
+{
+    uint64_t next;   /* record number to read next */
+    uint64_t missed; /* records skipped because the writer lapped us */
+    uint64_t torn;   /* copies thrown away because they changed underneath */
+} BroadcastCursor;
+
+static inline size_t broadcast_slot_bytes(uint32_t maxPayload)
+{
+    return (sizeof(BroadcastSlot) + maxPayload + BROADCAST_LINE - 1) & ~(size_t)(BROADCAST_LINE - 1);
+}
+
+/* Bytes a channel of slots records of up to maxPayload bytes occupies. */
+static inline size_t broadcast_bytes(uint32_t slots, uint32_t maxPayload)
+{
+    return sizeof(Broadcast) + (size_t)slots * broadcast_slot_bytes(maxPayload);
+}
+
+static inline BroadcastSlot *broadcast_slot(const Broadcast *b, uint64_t n)
+{
+    return (BroadcastSlot *)(b->data + (n % b->slots) * b->slotBytes);
+}
+
+/* Sets up an empty channel in zero-filled shared memory. */
+static inline void broadcast_init(Broadcast *b, uint32_t slots, uint32_t maxPayload)
+{
+    memset(b, 0, sizeof(*b));
+    b->slots = slots;
+    b->slotBytes = broadcast_slot_bytes(maxPayload);
+    b->maxPayload = maxPayload;
+    __atomic_store_n(&b->magic, BROADCAST_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Nonzero when mem holds a channel set up by broadcast_init. */
+static inline int broadcast_valid(const Broadcast *b, size_t mapped)
+{
+    return mapped >= sizeof(Broadcast) && __atomic_load_n(&b->magic, __ATOMIC_ACQUIRE) == BROADCAST_MAGIC &&
+           b->slots > 0 &&
+           mapped >= broadcast_bytes(b->slots, b->maxPayload);
+}
+
+static inline void broadcast_wake(Broadcast *b)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&b->sleepers, __ATOMIC_RELAXED) > 0)
+    {
+        __atomic_fetch_add(&b->futex, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &b->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*
+ * Publishes one record; only one process may write. Returns its number, or
+ * 0 when len exceeds the payload size the channel was created with.
+ */
+static inline uint64_t broadcast_publish(Broadcast *b, const void *data, uint32_t len)
+{
+    if (len > b->maxPayload)
+        return 0;
+    uint64_t n = b->head + 1;
+    BroadcastSlot *slot = broadcast_slot(b, n);
+
+    __atomic_store_n(&slot->seq, 2 * n - 1, __ATOMIC_RELAXED);
+    /* The odd sequence must be visible before any payload byte changes. */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->len = len;
+    memcpy(slot->payload, data, len);
+    __atomic_store_n(&slot->seq, 2 * n, __ATOMIC_RELEASE);
+    __atomic_store_n(&b->head, n, __ATOMIC_RELEASE);
+    broadcast_wake(b);
+    return n;
+}
+
+/* Tells readers no more records will follow. */
+static inline void broadcast_close(Broadcast *b)
+{
+    __atomic_store_n(&b->closed, 1, __ATOMIC_RELEASE);
+    broadcast_wake(b);
+}
+
+/* Starts a cursor at the oldest record still held, or after the newest. */
+static inline void broadcast_cursor_init(const Broadcast *b, BroadcastCursor *c, int fromNewest)
+{
+    uint64_t head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    memset(c, 0, sizeof(*c));
+    if (fromNewest)
+        c->next = head + 1;
+    else
+        c->next = head >= b->slots ? head - b->slots + 1 : 1;
+}
+
+/*
+ * Copies record n into buf if it is still intact. Returns its length, or
+ * -1 when the slot no longer (or not yet) holds record n or changed while
+ * it was copied.
+ */
+static inline long broadcast_copy(const Broadcast *b, uint64_t n, void *buf, size_t size)
+{
+    const BroadcastSlot *slot = broadcast_slot(b, n);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != 2 * n)
+        return -1;
+    uint32_t len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+    if (len > b->maxPayload)
+        return -1;
+    memcpy(buf, slot->payload, len < size ? len : size);
+    /* The recheck must not move before the copy. */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != 2 * n)
+        return -1;
+    return len;
+}
+
+/*
+ * Reads the record at the cursor into buf (at most size bytes) and
+ * advances. Returns the record length; BROADCAST_EMPTY when the reader is
+ * caught up; BROADCAST_CLOSED when it is caught up and the writer has
+ * closed; BROADCAST_OVERRUN when the writer lapped the reader, in which case
+ * the cursor has moved to the oldest record still held and c->missed says
+ * how many records were lost in total.
+ */
+static inline long broadcast_read(const Broadcast *b, BroadcastCursor *c, void *buf, size_t size)
+{
+    uint64_t head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    if (c->next > head)
+        return __atomic_load_n(&b->closed, __ATOMIC_ACQUIRE) && __atomic_load_n(&b->head, __ATOMIC_ACQUIRE) == head
+                   ? BROADCAST_CLOSED
+                   : BROADCAST_EMPTY;
+
+    if (head - c->next < b->slots)
+    {
+        long len = broadcast_copy(b, c->next, buf, size);
+        if (len >= 0)
+        {
+            c->next++;
+            return len;
+        }
+        c->torn++;
+        head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    }
+
+    /* Lapped: resume at the oldest record, leaving a slot of margin for the one being written. */
+    uint64_t oldest = head >= b->slots ? head - b->slots + 2 : 1;
+    if (oldest > c->next)
+    {
+        c->missed += oldest - c->next;
+        c->next = oldest;
+    }
+    return BROADCAST_OVERRUN;
+}
+
+/*
+ * Copies the newest record into buf and stores its number in *n. Returns
+ * its length, or BROADCAST_EMPTY before the first record.
+ */
+static inline long broadcast_latest(const Broadcast *b, void *buf, size_t size, uint64_t *n)
+{
+    for (;;)
+    {
+        uint64_t head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+        if (head == 0)
+            return BROADCAST_EMPTY;
+        long len = broadcast_copy(b, head, buf, size);
+        if (len >= 0)
+        {
+            *n = head;
+            return len;
+        }
+        /* Only possible after slots more publishes; take the newer head. */
+    }
+}
+
+/* Sleeps until a record past the cursor is published or the channel closes. */
+static inline void broadcast_wait(Broadcast *b, const BroadcastCursor *c)
+{
+    __atomic_fetch_add(&b->sleepers, 1, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        uint32_t seen = __atomic_load_n(&b->futex, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&b->head, __ATOMIC_ACQUIRE) >= c->next || __atomic_load_n(&b->closed, __ATOMIC_ACQUIRE))
+            break;
+        syscall(SYS_futex, &b->futex, FUTEX_WAIT, seen, NULL, NULL, 0);
+    }
+    __atomic_fetch_sub(&b->sleepers, 1, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+/*
+ * Bounded multi-producer/multi-consumer queue of pointers for threads.
+ *
+ * This is Vyukov's array queue: every cell carries a sequence number that
+ * says whether it is ready for the push or the pop at a given position.
+ * A thread claims a position with one compare-and-swap on head or tail
+ * and then publishes the cell with a release store of its sequence, so
+ * producers and consumers only meet on the cells, and head and tail live
+ * on their own cache lines. NULL is a valid item.
+ *
+ * The blocking calls spin briefly and then sleep on a futex, with the same
+ * handshake as spsc_ring.h: the sleeper registers and retries before it
+ * sleeps, and the other side fences after publishing and makes the
+ * wake-up call only when somebody registered. On a single CPU they do not
+ * spin at all. Link with -pthread.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define MPMC_CACHE_LINE 64
+#define MPMC_SPINS 1024
+
+#if defined(__x86_64__) || defined(__i386__)
+#define mpmc_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define mpmc_relax() __asm__ __volatile__("yield")
+#else
+#define mpmc_relax() ((void)0)
+#endif
+
+typedef struct
+{
+    uint64_t seq;
+    void *item;
+} MpmcCell;
+
+typedef struct
+{
+    _Alignas(MPMC_CACHE_LINE) uint64_t head; /* next position to push */
+    _Alignas(MPMC_CACHE_LINE) uint64_t tail; /* next position to pop */
+    /* wake-up line, touched only around sleeping */
+    _Alignas(MPMC_CACHE_LINE) uint32_t itemsFutex;
+    uint32_t slotsFutex;
+    uint32_t popSleepers;
+    uint32_t pushSleepers;
+    /* read-only after init */
+    _Alignas(MPMC_CACHE_LINE) uint64_t mask;
+    uint32_t spins;
+    MpmcCell *cells;
+} MpmcQueue;
+
+static inline long mpmc_futex(uint32_t *word, int op, uint32_t value)
+{
+    return syscall(SYS_futex, word, op | FUTEX_PRIVATE_FLAG, value, NULL, NULL, 0);
+}
+
+/* Sets up an empty queue of at least capacity cells; returns 0 or -1. */
+static inline int mpmc_queue_init(MpmcQueue *q, size_t capacity)
+{
+    size_t cells = 2;
+    while (cells < capacity)
+        cells <<= 1;
+
+    memset(q, 0, sizeof(*q));
+    q->cells = aligned_alloc(MPMC_CACHE_LINE, cells * sizeof(MpmcCell));
+    if (q->cells == NULL)
+        return -1;
+    for (size_t i = 0; i < cells; i++)
+        q->cells[i].seq = i;
+    q->mask = cells - 1;
+    q->spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? MPMC_SPINS : 0;
+    return 0;
+}
+
+static inline void mpmc_queue_destroy(MpmcQueue *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+}
+
+static inline void mpmc_wake(uint32_t *futex, uint32_t *sleepers)
+{
+    /* Pairs with the registration in mpmc_sleep: either we see it or it sees our cell. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(sleepers, __ATOMIC_RELAXED) > 0)
+    {
+        __atomic_fetch_add(futex, 1, __ATOMIC_RELEASE);
+        mpmc_futex(futex, FUTEX_WAKE, 1);
+    }
+}
+
+/* Appends item without blocking; returns 1, or 0 when the queue is full. */
+static inline int mpmc_queue_try_push(MpmcQueue *q, void *item)
+{
+    uint64_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        MpmcCell *cell = &q->cells[pos & q->mask];
+        int64_t diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                cell->item = item;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                mpmc_wake(&q->itemsFutex, &q->popSleepers);
+                return 1;
+            }
+        }
+        else if (diff < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+}
+
+/* Takes the oldest item without blocking; returns 1, or 0 when the queue is empty. */
+static inline int mpmc_queue_try_pop(MpmcQueue *q, void **item)
+{
+    uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        MpmcCell *cell = &q->cells[pos & q->mask];
+        int64_t diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *item = cell->item;
+                __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+                mpmc_wake(&q->slotsFutex, &q->pushSleepers);
+                return 1;
+            }
+        }
+        else if (diff < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+}
+
+/* Sleeps once unless retry() succeeds after registering; returns what retry returned. */
+static inline int mpmc_sleep(uint32_t *futex, uint32_t *sleepers, int (*retry)(MpmcQueue *, void **),
+                             MpmcQueue *q, void **item)
+{
+    uint32_t seen = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+    __atomic_fetch_add(sleepers, 1, __ATOMIC_SEQ_CST);
+    int done = retry(q, item);
+    if (!done)
+        mpmc_futex(futex, FUTEX_WAIT, seen);
+    __atomic_fetch_sub(sleepers, 1, __ATOMIC_RELAXED);
+    return done;
+}
+
+static inline int mpmc_retry_push(MpmcQueue *q, void **item)
+{
+    return mpmc_queue_try_push(q, *item);
+}
+
+/* Appends item, sleeping while the queue is full. */
+static inline void mpmc_queue_push(MpmcQueue *q, void *item)
+{
+    for (uint32_t spin = 0; !mpmc_queue_try_push(q, item); spin++)
+    {
+        if (spin < q->spins)
+            mpmc_relax();
+        else if (mpmc_sleep(&q->slotsFutex, &q->pushSleepers, mpmc_retry_push, q, &item))
+            return;
+    }
+}
+
+/* Takes the oldest item, sleeping while the queue is empty. */
+static inline void *mpmc_queue_pop(MpmcQueue *q)
+{
+    void *item;
+    for (uint32_t spin = 0; !mpmc_queue_try_pop(q, &item); spin++)
+    {
+        if (spin < q->spins)
+            mpmc_relax();
+        else if (mpmc_sleep(&q->itemsFutex, &q->popSleepers, mpmc_queue_try_pop, q, &item))
+            break;
+    }
+    return item;
+}
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef PARALLEL_SUM_H
+#define PARALLEL_SUM_H
+
+/*
+ * Serial and pthread-parallel sums over an integer range or an array.
+ *
+ * The inner loops work on GCC vector types with several independent
+ * accumulators, so the compiler emits packed adds (SSE2 by default, AVX2
+ * with -mavx2 or -march=native) and the adds do not wait on each other.
+ * Sums are unsigned 64-bit and wrap like the plain loop would.
+ *
+ * The parallel versions cut the work into one contiguous block per thread.
+ * A thread adds its block in registers and stores the result once, into a
+ * partial padded to its own cache line, so threads never write to a line
+ * another thread writes to. The calling thread takes the first block
+ * itself. Link with -pthread.
+ *
+ * parallel_sum_pool() does the same on a work_pool.h pool: the range is
+ * split into many pieces that idle workers steal, and every worker adds
+ * its pieces into its own padded partial.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "work_pool.h"
+
+#define SUM_CACHE_LINE 64
+#define SUM_LANES 4    /* 64-bit lanes per vector */
+#define SUM_UNROLL 4   /* vectors added independently per step */
+#define SUM_MAX_THREADS 256
+#define SUM_POOL_PIECES 16   /* pieces per pool worker */
+#define SUM_POOL_GRAIN 4096  /* smallest piece */
+
+typedef uint64_t SumVector __attribute__((vector_size(SUM_LANES * sizeof(uint64_t))));
+
+/* Sum of lo, lo + 1, ..., hi - 1. */
+static inline uint64_t sum_range(uint64_t lo, uint64_t hi)
+{
+    uint64_t sum = 0;
+    uint64_t i = lo;
+    if (hi > lo && hi - lo >= SUM_LANES * SUM_UNROLL)
+    {
+        SumVector acc[SUM_UNROLL] = {{0}};
+        SumVector next[SUM_UNROLL];
+        const SumVector step = {SUM_LANES * SUM_UNROLL, SUM_LANES * SUM_UNROLL, SUM_LANES * SUM_UNROLL,
+                                SUM_LANES * SUM_UNROLL};
+        for (int u = 0; u < SUM_UNROLL; u++)
+            for (int l = 0; l < SUM_LANES; l++)
+                next[u][l] = lo + u * SUM_LANES + l;
+        for (; hi - i >= SUM_LANES * SUM_UNROLL; i += SUM_LANES * SUM_UNROLL)
+            for (int u = 0; u < SUM_UNROLL; u++)
+            {
+                acc[u] += next[u];
+                next[u] += step;
+            }
+        for (int u = 1; u < SUM_UNROLL; u++)
+            acc[0] += acc[u];
+        for (int l = 0; l < SUM_LANES; l++)
+            sum += acc[0][l];
+    }
+    for (; i < hi; i++)
+        sum += i;
+    return sum;
+}
+
+/* Sum of a[0] .. a[n - 1]; a needs no particular alignment. */
+static inline uint64_t sum_array(const uint64_t *a, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+    SumVector acc[SUM_UNROLL] = {{0}};
+    for (; n - i >= SUM_LANES * SUM_UNROLL; i += SUM_LANES * SUM_UNROLL)
+        for (int u = 0; u < SUM_UNROLL; u++)
+        {
+            SumVector v;
+            memcpy(&v, a + i + u * SUM_LANES, sizeof(v));
+            acc[u] += v;
+        }
+    for (int u = 1; u < SUM_UNROLL; u++)
+        acc[0] += acc[u];
+    for (int l = 0; l < SUM_LANES; l++)
+        sum += acc[0][l];
+    for (; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+typedef struct
+{
+    _Alignas(SUM_CACHE_LINE) uint64_t sum;
+    const uint64_t *array; /* NULL to sum the range lo..hi - 1 */
+    uint64_t lo;
+    uint64_t hi;           /* block end; an index into array in array mode */
+} SumPartial;
+
+static inline void *sum_worker(void *arg)
+{
+    SumPartial *p = arg;
+    p->sum = p->array != NULL ? sum_array(p->array + p->lo, p->hi - p->lo) : sum_range(p->lo, p->hi);
+    return NULL;
+}
+
+/*
+ * Splits lo..hi - 1 (or array indices when array is non-NULL) over threads
+ * threads and adds the partials. Returns 0, or -1 when a thread could not
+ * be started, in which case *sum is not set.
+ */
+static inline int parallel_sum(const uint64_t *array, uint64_t lo, uint64_t hi, int threads, uint64_t *sum)
+{
+    SumPartial parts[SUM_MAX_THREADS];
+    pthread_t tids[SUM_MAX_THREADS];
+    uint64_t n = hi > lo ? hi - lo : 0;
+    int started, failed = 0;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > SUM_MAX_THREADS)
+        threads = SUM_MAX_THREADS;
+    if ((uint64_t)threads > n / (SUM_LANES * SUM_UNROLL) + 1)
+        threads = n / (SUM_LANES * SUM_UNROLL) + 1;
+
+    /* The first n % threads blocks take one element more. */
+    uint64_t block = n / threads, extra = n % threads;
+    for (int t = 0; t < threads; t++)
+    {
+        uint64_t ut = (uint64_t)t;
+        parts[t].sum = 0;
+        parts[t].array = array;
+        parts[t].lo = lo + block * ut + (ut < extra ? ut : extra);
+        parts[t].hi = parts[t].lo + block + (ut < extra);
+    }
+    for (started = 1; started < threads; started++)
+        if (pthread_create(&tids[started], NULL, sum_worker, &parts[started]) != 0)
+        {
+            failed = 1;
+            break;
+        }
+    sum_worker(&parts[0]);
+
+    uint64_t total = parts[0].sum;
+    for (int t = 1; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+        total += parts[t].sum;
+    }
+    if (failed)
+        return -1;
+    *sum = total;
+    return 0;
+}
+
+static inline int parallel_sum_range(uint64_t lo, uint64_t hi, int threads, uint64_t *sum)
+{
+    return parallel_sum(NULL, lo, hi, threads, sum);
+}
+
+static inline int parallel_sum_array(const uint64_t *a, size_t n, int threads, uint64_t *sum)
+{
+    return parallel_sum(a, 0, n, threads, sum);
+}
+
+typedef struct
+{
+    WorkPool *pool;
+    const uint64_t *array;
+    SumPartial *partials; /* one per worker, then one for the caller */
+} SumPoolJob;
+
+static inline void sum_pool_piece(uint64_t lo, uint64_t hi, void *arg)
+{
+    SumPoolJob *job = arg;
+    int w = work_pool_worker_index(job->pool);
+    SumPartial *p = &job->partials[w >= 0 ? w : job->pool->workers];
+    p->sum += job->array != NULL ? sum_array(job->array + lo, hi - lo) : sum_range(lo, hi);
+}
+
+/*
+ * parallel_sum on the workers of pool. Returns 0, or -1 when the partials
+ * could not be allocated, in which case *sum is not set.
+ */
+static inline int parallel_sum_pool(WorkPool *pool, const uint64_t *array, uint64_t lo, uint64_t hi, uint64_t *sum)
+{
+    size_t bytes = (pool->workers + 1) * sizeof(SumPartial);
+    SumPoolJob job = {pool, array, aligned_alloc(SUM_CACHE_LINE, bytes)};
+    uint64_t n = hi > lo ? hi - lo : 0;
+    uint64_t grain = n / ((uint64_t)pool->workers * SUM_POOL_PIECES);
+
+    if (job.partials == NULL)
+        return -1;
+    memset(job.partials, 0, bytes);
+    work_pool_for(pool, lo, hi, grain > SUM_POOL_GRAIN ? grain : SUM_POOL_GRAIN, sum_pool_piece, &job);
+
+    uint64_t total = 0;
+    for (int w = 0; w <= pool->workers; w++)
+        total += job.partials[w].sum;
+    free(job.partials);
+    *sum = total;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef SHM_SEGMENT_H
+#define SHM_SEGMENT_H
+
+/*
+ * POSIX shared-memory segments for the Lab2 programs.
+ *
+ * A segment is either private or named. A private segment (name NULL) is a
+ * memfd mapping that forked children inherit; it has no name to collide on
+ * and disappears with the last process that maps it, crashed or not. A
+ * named segment is a shm_open object that unrelated processes attach to by
+ * name. shm_segment_unique_name() builds names as "/prefix-pid-n", so
+ * concurrent runs never share a segment, and shm_segment_reap() removes the
+ * ones left behind by creators that have died.
+ *
+ * SHM_SEG_HUGE backs a segment of at least SHM_HUGE_PAGE bytes with huge
+ * pages: hugetlbfs pages for private segments when some are reserved,
+ * transparent huge pages otherwise. SHM_SEG_CLEANUP unlinks a named
+ * segment when the creating process exits or is stopped by SIGINT,
+ * SIGTERM, SIGHUP or SIGQUIT.
+ *
+ * Everything is static inline so each program can include this header
+ * without another object file to build. memfd_create needs _GNU_SOURCE
+ * defined before the first system header. Link with -lrt on glibc older
+ * than 2.34.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define SHM_SEG_HUGE 0x1
+#define SHM_SEG_CLEANUP 0x2
+
+#define SHM_NAME_MAX 64
+#define SHM_HUGE_PAGE (2UL << 20)
+#define SHM_CLEANUP_SLOTS 16
+
+typedef struct
+{
+    void *addr;
+    size_t size; /* mapped bytes, at least the requested size */
+    int huge;    /* backed by hugetlbfs pages */
+    char name[SHM_NAME_MAX]; /* empty for a private segment */
+} ShmSegment;
+
+static char shm_cleanup_names[SHM_CLEANUP_SLOTS][SHM_NAME_MAX];
+static pid_t shm_cleanup_owner;
+
+static inline void shm_cleanup_all(void)
+{
+    /* Forked children run the same atexit handlers but own nothing. */
+    if (getpid() != shm_cleanup_owner)
+        return;
+    for (int i = 0; i < SHM_CLEANUP_SLOTS; i++)
+        if (shm_cleanup_names[i][0] != '\0')
+        {
+            shm_unlink(shm_cleanup_names[i]);
+            shm_cleanup_names[i][0] = '\0';
+        }
+}
+
+static inline void shm_cleanup_signal(int sig)
+{
+    shm_cleanup_all();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static inline void shm_cleanup_register(const char *name)
+{
+    static int installed;
+    if (!installed)
+    {
+        static const int signals[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT};
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = shm_cleanup_signal;
+        sigemptyset(&sa.sa_mask);
+        for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+        {
+            struct sigaction old;
+            /* Leave signals the program handles itself alone. */
+            if (sigaction(signals[i], NULL, &old) == 0 && old.sa_handler == SIG_DFL)
+                sigaction(signals[i], &sa, NULL);
+        }
+        atexit(shm_cleanup_all);
+        shm_cleanup_owner = getpid();
+        installed = 1;
+    }
+
+    for (int i = 0; i < SHM_CLEANUP_SLOTS; i++)
+        if (shm_cleanup_names[i][0] == '\0')
+        {
+            snprintf(shm_cleanup_names[i], SHM_NAME_MAX, "%s", name);
+            return;
+        }
+}
+
+static inline void shm_cleanup_forget(const char *name)
+{
+    for (int i = 0; i < SHM_CLEANUP_SLOTS; i++)
+        if (strcmp(shm_cleanup_names[i], name) == 0)
+            shm_cleanup_names[i][0] = '\0';
+}
+
+/* Writes "/prefix-pid-n" into name, n counting up within the process. */
+static inline void shm_segment_unique_name(char *name, size_t len, const char *prefix)
+{
+    static unsigned counter;
+    snprintf(name, len, "/%s-%ld-%u", prefix, (long)getpid(), counter++);
+}
+
+/*
+ * Unlinks the "/prefix-pid-n" segments whose creator no longer runs.
+ * Returns how many were removed. Needs /dev/shm, which is where Linux
+ * keeps POSIX shared memory.
+ */
+static inline int shm_segment_reap(const char *prefix)
+{
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL)
+        return 0;
+
+    size_t plen = strlen(prefix);
+    int reaped = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char *end;
+        if (strncmp(entry->d_name, prefix, plen) != 0 || entry->d_name[plen] != '-')
+            continue;
+        long pid = strtol(entry->d_name + plen + 1, &end, 10);
+        if (pid <= 0 || *end != '-' || kill(pid, 0) == 0 || errno != ESRCH)
+            continue;
+
+        char name[sizeof(entry->d_name) + 1];
+        snprintf(name, sizeof(name), "/%s", entry->d_name);
+        if (shm_unlink(name) == 0)
+            reaped++;
+    }
+    closedir(dir);
+    return reaped;
+}
+
+static inline int shm_segment_map(ShmSegment *seg, int fd, size_t size, int flags)
+{
+    seg->addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (seg->addr == MAP_FAILED)
+    {
+        seg->addr = NULL;
+        return -1;
+    }
+    seg->size = size;
+    if ((flags & SHM_SEG_HUGE) && !seg->huge && size >= SHM_HUGE_PAGE)
+        madvise(seg->addr, size, MADV_HUGEPAGE);
+    return 0;
+}
+
+/*
+ * Creates a zero-filled segment of size bytes, private when name is NULL
+ * and named otherwise. A named segment must not exist yet. Returns 0, or
+ * -1 with errno set.
+ */
+static inline int shm_segment_create(ShmSegment *seg, const char *name, size_t size, int flags)
+{
+    memset(seg, 0, sizeof(*seg));
+    if (size == 0)
+        size = 1;
+
+    int fd = -1;
+    size_t mapped = size;
+    if (name == NULL)
+    {
+        if ((flags & SHM_SEG_HUGE) && size >= SHM_HUGE_PAGE)
+        {
+            fd = memfd_create("shm_segment", MFD_CLOEXEC | MFD_HUGETLB);
+            mapped = (size + SHM_HUGE_PAGE - 1) & ~(SHM_HUGE_PAGE - 1);
+            /* Without reserved huge pages the mapping, not memfd_create, fails. */
+            if (fd >= 0 && (ftruncate(fd, mapped) != 0 || shm_segment_map(seg, fd, mapped, 0) != 0))
+            {
+                close(fd);
+                fd = -1;
+            }
+            if (fd >= 0)
+            {
+                seg->huge = 1;
+                close(fd);
+                return 0;
+            }
+            mapped = size;
+        }
+        fd = memfd_create("shm_segment", MFD_CLOEXEC);
+    }
+    else
+    {
+        if (strlen(name) >= SHM_NAME_MAX)
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, mapped) != 0 || shm_segment_map(seg, fd, mapped, flags) != 0)
+    {
+        int saved = errno;
+        close(fd);
+        if (name != NULL)
+            shm_unlink(name);
+        errno = saved;
+        return -1;
+    }
+    close(fd);
+
+    if (name != NULL)
+    {
+        snprintf(seg->name, SHM_NAME_MAX, "%s", name);
+        if (flags & SHM_SEG_CLEANUP)
+            shm_cleanup_register(name);
+    }
+    return 0;
+}
+
+/* Attaches to an existing named segment, mapping all of it. */
+static inline int shm_segment_open(ShmSegment *seg, const char *name, int flags)
+{
+    memset(seg, 0, sizeof(*seg));
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || shm_segment_map(seg, fd, st.st_size, flags) != 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved != 0 ? saved : EINVAL;
+        return -1;
+    }
+    close(fd);
+    snprintf(seg->name, SHM_NAME_MAX, "%s", name);
+    return 0;
+}
+
+/* Unmaps the segment. A named segment stays until shm_segment_unlink. */
+static inline void shm_segment_close(ShmSegment *seg)
+{
+    if (seg->addr != NULL)
+        munmap(seg->addr, seg->size);
+    seg->addr = NULL;
+}
+
+/* Removes the name; processes that still map the segment keep using it. */
+static inline int shm_segment_unlink(ShmSegment *seg)
+{
+    if (seg->name[0] == '\0')
+        return 0;
+    shm_cleanup_forget(seg->name);
+    return shm_unlink(seg->name);
+}
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+/*
+ * Single-producer/single-consumer message ring for shared memory.
+ *
+ * The ring is a power-of-two byte buffer placed in a segment that both
+ * processes map. A message is a 4-byte length followed by the payload,
+ * padded to 8 bytes; a message that does not fit before the end of the
+ * buffer is preceded by a wrap marker and starts over at offset 0.
+ *
+ * head and tail count bytes ever written and read and live on their own
+ * cache lines. Each side publishes its counter with a release store and
+ * reads the other side's with an acquire load, and keeps a private copy of
+ * the other counter so it only touches the shared line when the copy says
+ * the ring is full or empty. Nothing enters the kernel while the ring has
+ * data and room.
+ *
+ * When a side has to wait it spins briefly, then sleeps on a futex. The
+ * sleeper raises a waiting flag and rechecks the ring before sleeping; the
+ * other side issues a full fence after publishing and wakes only when it
+ * sees the flag, so the fast path never makes the wake-up system call.
+ * The futexes are process-shared, so the ring works across fork and
+ * across unrelated processes mapping the same segment. spsc_ring_init
+ * stores a magic word last; a process attaching by name must see it
+ * (spsc_ring_valid) before touching the ring, or init would erase its
+ * waiting flag.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SPSC_CACHE_LINE 64
+#define SPSC_WRAP UINT32_MAX
+#define SPSC_SPINS 1024
+#define SPSC_MAGIC 0x31474e5243535053ULL /* "SPSCRNG1" */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define spsc_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define spsc_relax() __asm__ __volatile__("yield")
+#else
+#define spsc_relax() ((void)0)
+#endif
+
+typedef struct
+{
+    /* producer line */
+    _Alignas(SPSC_CACHE_LINE) uint64_t head;
+    uint64_t cachedTail; /* producer's copy of tail */
+    uint64_t pendingNeed; /* bytes a blocked push is waiting for */
+    uint64_t producerWaits;
+    /* consumer line */
+    _Alignas(SPSC_CACHE_LINE) uint64_t tail;
+    uint64_t cachedHead; /* consumer's copy of head */
+    uint64_t consumerWaits;
+    /* wake-up line, touched only around sleeping */
+    _Alignas(SPSC_CACHE_LINE) uint32_t dataFutex;
+    uint32_t spaceFutex;
+    uint32_t consumerSleeping;
+    uint32_t producerSleeping;
+    uint32_t closed;
+    /* read-only after init */
+    _Alignas(SPSC_CACHE_LINE) uint64_t magic; /* SPSC_MAGIC once init is done */
+    uint64_t capacity;
+    uint64_t mask;
+    uint32_t spins; /* 0 on a single CPU, where spinning only delays the other side */
+    _Alignas(SPSC_CACHE_LINE) unsigned char data[];
+} SpscRing;
+
+static inline long spsc_futex(uint32_t *word, int op, uint32_t value)
+{
+    return syscall(SYS_futex, word, op, value, NULL, NULL, 0);
+}
+
+static inline size_t spsc_align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+/* Bytes a ring with capacity data bytes (a power of two) occupies. */
+static inline size_t spsc_ring_bytes(size_t capacity)
+{
+    return sizeof(SpscRing) + capacity;
+}
+
+/* Largest message a ring of this capacity accepts. */
+static inline size_t spsc_ring_max_message(const SpscRing *r)
+{
+    return r->capacity / 2 - sizeof(uint32_t);
+}
+
+/* Sets up an empty ring in zero-filled shared memory. */
+static inline void spsc_ring_init(SpscRing *r, size_t capacity)
+{
+    memset(r, 0, sizeof(*r));
+    r->capacity = capacity;
+    r->mask = capacity - 1;
+    r->spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPSC_SPINS : 0;
+    __atomic_store_n(&r->magic, SPSC_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Nonzero when mem holds a ring set up by spsc_ring_init. */
+static inline int spsc_ring_valid(const SpscRing *r, size_t mapped)
+{
+    return mapped >= sizeof(SpscRing) && __atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) == SPSC_MAGIC &&
+           r->capacity > 0 && (r->capacity & r->mask) == 0 && mapped >= spsc_ring_bytes(r->capacity);
+}
+
+static inline void spsc_wake(uint32_t *futex, uint32_t *sleeping)
+{
+    /* Pairs with the fence in spsc_wait: either we see the flag or it sees our data. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(sleeping, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(futex, 1, __ATOMIC_RELEASE);
+        spsc_futex(futex, FUTEX_WAKE, 1);
+    }
+}
+
+/* Sleeps until ready(r) holds; *waits counts the futex sleeps. */
+static inline void spsc_wait(SpscRing *r, uint32_t *futex, uint32_t *sleeping, uint64_t *waits,
+                             int (*ready)(SpscRing *))
+{
+    for (uint32_t spin = 0; spin < r->spins; spin++)
+    {
+        if (ready(r))
+            return;
+        spsc_relax();
+    }
+    for (;;)
+    {
+        uint32_t seen = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+        __atomic_store_n(sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ready(r))
+            break;
+        (*waits)++;
+        spsc_futex(futex, FUTEX_WAIT, seen);
+    }
+    __atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/* Bytes a message of len takes in the ring, header and padding included. */
+static inline size_t spsc_record_bytes(uint32_t len)
+{
+    return spsc_align8(sizeof(uint32_t) + len);
+}
+
+static inline int spsc_has_room(SpscRing *r, size_t need)
+{
+    if (r->head + need - r->cachedTail <= r->capacity)
+        return 1;
+    r->cachedTail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    return r->head + need - r->cachedTail <= r->capacity;
+}
+
+static inline int spsc_room_ready(SpscRing *r)
+{
+    return spsc_has_room(r, r->pendingNeed);
+}
+
+/* Room needed to place a record of len at head, wrap included. */
+static inline size_t spsc_room_needed(const SpscRing *r, uint32_t len)
+{
+    size_t bytes = spsc_record_bytes(len);
+    size_t offset = r->head & r->mask;
+    return offset + bytes > r->capacity ? r->capacity - offset + bytes : bytes;
+}
+
+/*
+ * Appends one message without blocking. Returns 1 when it was queued, 0
+ * when the ring is full and -1 with errno EMSGSIZE when it can never fit.
+ */
+static inline int spsc_ring_try_push(SpscRing *r, const void *msg, uint32_t len)
+{
+    if (len > spsc_ring_max_message(r))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    size_t need = spsc_room_needed(r, len);
+    if (!spsc_has_room(r, need))
+    {
+        r->pendingNeed = need;
+        return 0;
+    }
+
+    size_t offset = r->head & r->mask;
+    uint64_t head = r->head;
+    if (offset + spsc_record_bytes(len) > r->capacity)
+    {
+        *(uint32_t *)(r->data + offset) = SPSC_WRAP;
+        head += r->capacity - offset;
+        offset = 0;
+    }
+    *(uint32_t *)(r->data + offset) = len;
+    memcpy(r->data + offset + sizeof(uint32_t), msg, len);
+    __atomic_store_n(&r->head, head + spsc_record_bytes(len), __ATOMIC_RELEASE);
+    spsc_wake(&r->dataFutex, &r->consumerSleeping);
+    return 1;
+}
+
+/* Appends one message, sleeping while the ring is full. */
+static inline int spsc_ring_push(SpscRing *r, const void *msg, uint32_t len)
+{
+    int rc;
+    while ((rc = spsc_ring_try_push(r, msg, len)) == 0)
+        spsc_wait(r, &r->spaceFutex, &r->producerSleeping, &r->producerWaits, spsc_room_ready);
+    return rc;
+}
+
+/* Marks the end of the stream; the consumer drains what is left first. */
+static inline void spsc_ring_close(SpscRing *r)
+{
+    __atomic_store_n(&r->closed, 1, __ATOMIC_RELEASE);
+    spsc_wake(&r->dataFutex, &r->consumerSleeping);
+}
+
+static inline int spsc_has_data(SpscRing *r)
+{
+    if (r->cachedHead != r->tail)
+        return 1;
+    r->cachedHead = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    return r->cachedHead != r->tail || __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+}
+
+static inline int spsc_drained(SpscRing *r)
+{
+    return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->head;
+}
+
+/* Lets the producer wait until the consumer has taken every message. */
+static inline void spsc_ring_drain(SpscRing *r)
+{
+    while (!spsc_drained(r))
+        spsc_wait(r, &r->spaceFutex, &r->producerSleeping, &r->producerWaits, spsc_drained);
+}
+
+/*
+ * Takes one message without blocking. Copies at most size bytes to buf and
+ * returns the full message length, -1 when the ring is empty, or -2 when
+ * it is empty and closed.
+ */
+static inline long spsc_ring_try_pop(SpscRing *r, void *buf, size_t size)
+{
+    if (r->cachedHead == r->tail)
+    {
+        r->cachedHead = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (r->cachedHead == r->tail)
+            return __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE) &&
+                           __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail
+                       ? -2
+                       : -1;
+    }
+
+    uint64_t tail = r->tail;
+    size_t offset = tail & r->mask;
+    uint32_t len = *(const uint32_t *)(r->data + offset);
+    if (len == SPSC_WRAP)
+    {
+        tail += r->capacity - offset;
+        offset = 0;
+        len = *(const uint32_t *)r->data;
+    }
+    memcpy(buf, r->data + offset + sizeof(uint32_t), len < size ? len : size);
+    __atomic_store_n(&r->tail, tail + spsc_record_bytes(len), __ATOMIC_RELEASE);
+    spsc_wake(&r->spaceFutex, &r->producerSleeping);
+    return len;
+}
+
+/* Takes one message, sleeping while the ring is empty; -2 at end of stream. */
+static inline long spsc_ring_pop(SpscRing *r, void *buf, size_t size)
+{
+    long len;
+    while ((len = spsc_ring_try_pop(r, buf, size)) == -1)
+        spsc_wait(r, &r->dataFutex, &r->consumerSleeping, &r->consumerWaits, spsc_has_data);
+    return len;
+}
+
+#endif
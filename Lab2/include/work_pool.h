@@ -0,0 +1,494 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+/*
+ * Work-stealing thread pool.
+ *
+ * Every worker owns a deque of tasks (Chase and Lev). The owner pushes
+ * and pops at the bottom without locking; idle workers steal from the top
+ * of a deque picked at random, so the oldest and usually largest pieces
+ * of work move and the owner keeps working on what is hot in its cache.
+ * Tasks submitted from outside the pool go through a small locked queue
+ * that workers check before they steal.
+ *
+ * work_pool_submit() returns a future; work_future_get() waits for the
+ * result and frees the future. work_pool_for() runs fn over index
+ * subranges of at most grain indexes, splitting the range in halves as
+ * it goes so that thieves take big halves rather than single items. A
+ * worker that waits (for a future or for a nested work_pool_for) runs
+ * other tasks meanwhile instead of blocking, so tasks may wait on tasks.
+ *
+ * Idle workers spin a little and then sleep on a futex; a push makes the
+ * wake-up call only when some worker has said it is going to sleep, so a
+ * busy pool stays out of the kernel. Link with -pthread.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define WORK_CACHE_LINE 64
+#define WORK_DEQUE_SIZE 4096 /* tasks per worker; a push beyond runs inline */
+#define WORK_SPINS 256
+#define WORK_MAX_WORKERS 256
+
+#if defined(__x86_64__) || defined(__i386__)
+#define work_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define work_relax() __asm__ __volatile__("yield")
+#else
+#define work_relax() ((void)0)
+#endif
+
+typedef struct WorkPool WorkPool;
+typedef struct WorkTask WorkTask;
+
+struct WorkTask
+{
+    void (*run)(WorkPool *pool, WorkTask *task);
+    void *(*fn)(void *arg); /* submitted tasks */
+    void *arg;
+    void *result;
+    uint64_t lo; /* work_pool_for ranges */
+    uint64_t hi;
+    uint32_t done; /* 0 pending, 1 done, 2 pending with a sleeping waiter */
+};
+
+typedef WorkTask WorkFuture;
+
+typedef struct
+{
+    _Alignas(WORK_CACHE_LINE) int64_t top; /* thieves take here */
+    _Alignas(WORK_CACHE_LINE) int64_t bottom; /* the owner works here */
+    uint64_t executed; /* written by the owner only */
+    uint64_t steals;
+    WorkTask *tasks[WORK_DEQUE_SIZE];
+} WorkDeque;
+
+struct WorkPool
+{
+    int workers;
+    int started; /* threads running */
+    pthread_t *tids;
+    WorkDeque *deques;
+
+    pthread_mutex_t injectLock; /* tasks from outside the pool */
+    WorkTask **inject;
+    size_t injectHead;
+    size_t injectCount;
+    size_t injectCap;
+    _Alignas(WORK_CACHE_LINE) size_t injectPending; /* injectCount, readable without the lock */
+
+    _Alignas(WORK_CACHE_LINE) uint32_t signal; /* bumped to wake sleepers */
+    uint32_t sleepers;
+    uint32_t stop;
+};
+
+static __thread WorkPool *work_pool_current;
+static __thread int work_pool_self = -1;
+static __thread uint32_t work_pool_seed;
+
+static inline long work_futex(uint32_t *addr, int op, uint32_t val)
+{
+    return syscall(SYS_futex, addr, op | FUTEX_PRIVATE_FLAG, val, NULL, NULL, 0);
+}
+
+/* Index of the calling worker in pool, or -1 when the caller is not one. */
+static inline int work_pool_worker_index(const WorkPool *pool)
+{
+    return work_pool_current == pool ? work_pool_self : -1;
+}
+
+/* ---- deque, after Le, Pop, Cohen and Zappa Nardelli (PPoPP 2013) ---- */
+
+static inline int work_deque_push(WorkDeque *d, WorkTask *task)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= WORK_DEQUE_SIZE)
+        return -1;
+    __atomic_store_n(&d->tasks[b & (WORK_DEQUE_SIZE - 1)], task, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline WorkTask *work_deque_pop(WorkDeque *d)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    WorkTask *task = NULL;
+    if (t <= b)
+    {
+        task = __atomic_load_n(&d->tasks[b & (WORK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+        /* The last task: race the thieves for it. */
+        if (t == b && !__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            task = NULL;
+        if (t == b)
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    else
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return task;
+}
+
+/* Takes the oldest task; NULL when empty or when another thief won. */
+static inline WorkTask *work_deque_steal(WorkDeque *d)
+{
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return NULL;
+    WorkTask *task = __atomic_load_n(&d->tasks[t & (WORK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return task;
+}
+
+/* ---- scheduling ---- */
+
+static inline void work_pool_wake(WorkPool *pool)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_RELAXED) > 0)
+    {
+        __atomic_fetch_add(&pool->signal, 1, __ATOMIC_RELEASE);
+        work_futex(&pool->signal, FUTEX_WAKE, 1);
+    }
+}
+
+static inline void work_pool_push(WorkPool *pool, WorkTask *task)
+{
+    int self = work_pool_worker_index(pool);
+    if (self >= 0)
+    {
+        if (work_deque_push(&pool->deques[self], task) != 0)
+        {
+            /* Full: nobody is short of work, so do it now. */
+            task->run(pool, task);
+            return;
+        }
+    }
+    else
+    {
+        pthread_mutex_lock(&pool->injectLock);
+        if (pool->injectCount == pool->injectCap)
+        {
+            size_t cap = pool->injectCap ? pool->injectCap * 2 : 64;
+            WorkTask **grown = malloc(cap * sizeof(WorkTask *));
+            if (grown == NULL)
+            {
+                pthread_mutex_unlock(&pool->injectLock);
+                task->run(pool, task);
+                return;
+            }
+            for (size_t i = 0; i < pool->injectCount; i++)
+                grown[i] = pool->inject[(pool->injectHead + i) % pool->injectCap];
+            free(pool->inject);
+            pool->inject = grown;
+            pool->injectHead = 0;
+            pool->injectCap = cap;
+        }
+        pool->inject[(pool->injectHead + pool->injectCount++) % pool->injectCap] = task;
+        __atomic_store_n(&pool->injectPending, pool->injectCount, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&pool->injectLock);
+    }
+    work_pool_wake(pool);
+}
+
+static inline WorkTask *work_pool_take_injected(WorkPool *pool)
+{
+    WorkTask *task = NULL;
+    if (__atomic_load_n(&pool->injectPending, __ATOMIC_ACQUIRE) == 0)
+        return NULL;
+    pthread_mutex_lock(&pool->injectLock);
+    if (pool->injectCount > 0)
+    {
+        task = pool->inject[pool->injectHead];
+        pool->injectHead = (pool->injectHead + 1) % pool->injectCap;
+        pool->injectCount--;
+        __atomic_store_n(&pool->injectPending, pool->injectCount, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pool->injectLock);
+    return task;
+}
+
+/* Own deque first, then the outside queue, then the other workers. */
+static inline WorkTask *work_pool_find(WorkPool *pool, int self)
+{
+    WorkDeque *own = &pool->deques[self];
+    WorkTask *task = work_deque_pop(own);
+    if (task == NULL)
+        task = work_pool_take_injected(pool);
+    if (task == NULL && pool->workers > 1)
+    {
+        work_pool_seed = work_pool_seed * 1103515245u + 12345u;
+        int start = (work_pool_seed >> 16) % pool->workers;
+        for (int i = 0; i < pool->workers && task == NULL; i++)
+        {
+            int victim = (start + i) % pool->workers;
+            if (victim != self && (task = work_deque_steal(&pool->deques[victim])) != NULL)
+                own->steals++;
+        }
+    }
+    return task;
+}
+
+static inline void work_pool_execute(WorkPool *pool, int self, WorkTask *task)
+{
+    pool->deques[self].executed++;
+    task->run(pool, task);
+}
+
+static inline void *work_pool_thread(void *arg)
+{
+    WorkPool *pool = arg;
+    int self = work_pool_self;
+
+    for (;;)
+    {
+        WorkTask *task = NULL;
+        for (int spin = 0; spin < WORK_SPINS && task == NULL; spin++)
+        {
+            if ((task = work_pool_find(pool, self)) == NULL)
+                work_relax();
+        }
+        if (task != NULL)
+        {
+            work_pool_execute(pool, self, task);
+            continue;
+        }
+
+        /* Announce the nap, then look once more so a push in between is not missed. */
+        __atomic_fetch_add(&pool->sleepers, 1, __ATOMIC_RELAXED);
+        uint32_t seen = __atomic_load_n(&pool->signal, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        task = work_pool_find(pool, self);
+        if (task == NULL && !__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE))
+            work_futex(&pool->signal, FUTEX_WAIT, seen);
+        __atomic_fetch_sub(&pool->sleepers, 1, __ATOMIC_RELAXED);
+        if (task != NULL)
+            work_pool_execute(pool, self, task);
+        else if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE))
+            break;
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    WorkPool *pool;
+    int index;
+} WorkSeat;
+
+static inline void *work_pool_start_thread(void *arg)
+{
+    WorkSeat seat = *(WorkSeat *)arg;
+    free(arg);
+    work_pool_current = seat.pool;
+    work_pool_self = seat.index;
+    work_pool_seed = (uint32_t)seat.index * 2654435761u + 1;
+    return work_pool_thread(seat.pool);
+}
+
+static inline void work_pool_destroy(WorkPool *pool);
+
+/* Starts workers threads, or one per online CPU when workers is 0. */
+static inline int work_pool_init(WorkPool *pool, int workers)
+{
+    memset(pool, 0, sizeof(*pool));
+    if (workers <= 0)
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+        workers = 1;
+    if (workers > WORK_MAX_WORKERS)
+        workers = WORK_MAX_WORKERS;
+
+    pthread_mutex_init(&pool->injectLock, NULL);
+    pool->tids = calloc(workers, sizeof(pthread_t));
+    pool->deques = aligned_alloc(WORK_CACHE_LINE, workers * sizeof(WorkDeque));
+    if (pool->tids == NULL || pool->deques == NULL)
+    {
+        work_pool_destroy(pool);
+        return -1;
+    }
+    memset(pool->deques, 0, workers * sizeof(WorkDeque));
+    /* Fixed before the first thread runs; thieves index the deques by it. */
+    pool->workers = workers;
+    for (; pool->started < workers; pool->started++)
+    {
+        WorkSeat *seat = malloc(sizeof(*seat));
+        if (seat == NULL)
+        {
+            work_pool_destroy(pool);
+            return -1;
+        }
+        seat->pool = pool;
+        seat->index = pool->started;
+        if (pthread_create(&pool->tids[pool->started], NULL, work_pool_start_thread, seat) != 0)
+        {
+            free(seat);
+            work_pool_destroy(pool);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Stops the workers once no task is left and frees the pool. */
+static inline void work_pool_destroy(WorkPool *pool)
+{
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&pool->signal, 1, __ATOMIC_RELEASE);
+    work_futex(&pool->signal, FUTEX_WAKE, INT_MAX);
+    for (int w = 0; w < pool->started; w++)
+        pthread_join(pool->tids[w], NULL);
+    pthread_mutex_destroy(&pool->injectLock);
+    free(pool->tids);
+    free(pool->deques);
+    free(pool->inject);
+    memset(pool, 0, sizeof(*pool));
+}
+
+/* ---- completion flags, shared by futures and work_pool_for ---- */
+
+static inline void work_flag_set(uint32_t *flag)
+{
+    if (__atomic_exchange_n(flag, 1, __ATOMIC_RELEASE) == 2)
+        work_futex(flag, FUTEX_WAKE, INT_MAX);
+}
+
+/* Waits for the flag; a worker runs other tasks meanwhile. */
+static inline void work_flag_wait(WorkPool *pool, uint32_t *flag)
+{
+    int self = work_pool_worker_index(pool);
+    if (self >= 0)
+    {
+        while (__atomic_load_n(flag, __ATOMIC_ACQUIRE) != 1)
+        {
+            WorkTask *task = work_pool_find(pool, self);
+            if (task != NULL)
+                work_pool_execute(pool, self, task);
+            else
+                sched_yield();
+        }
+        return;
+    }
+    uint32_t state = 0;
+    if (__atomic_compare_exchange_n(flag, &state, 2, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE) || state == 2)
+        while (__atomic_load_n(flag, __ATOMIC_ACQUIRE) == 2)
+            work_futex(flag, FUTEX_WAIT, 2);
+}
+
+/* ---- futures ---- */
+
+static inline void work_run_future(WorkPool *pool, WorkTask *task)
+{
+    (void)pool;
+    task->result = task->fn(task->arg);
+    work_flag_set(&task->done);
+}
+
+/* Queues fn(arg); returns the future of its result, or NULL without memory. */
+static inline WorkFuture *work_pool_submit(WorkPool *pool, void *(*fn)(void *), void *arg)
+{
+    WorkTask *task = calloc(1, sizeof(*task));
+    if (task == NULL)
+        return NULL;
+    task->run = work_run_future;
+    task->fn = fn;
+    task->arg = arg;
+    work_pool_push(pool, task);
+    return task;
+}
+
+/* Waits for the task, frees the future and returns what fn returned. */
+static inline void *work_future_get(WorkPool *pool, WorkFuture *future)
+{
+    work_flag_wait(pool, &future->done);
+    void *result = future->result;
+    free(future);
+    return result;
+}
+
+/* ---- parallel for ---- */
+
+typedef struct
+{
+    void (*fn)(uint64_t lo, uint64_t hi, void *arg);
+    void *arg;
+    uint64_t grain;
+    uint64_t remaining; /* indexes not yet done */
+    uint32_t done;
+} WorkFor;
+
+static inline void work_for_range(WorkPool *pool, WorkFor *loop, uint64_t lo, uint64_t hi);
+
+static inline void work_run_range(WorkPool *pool, WorkTask *task)
+{
+    WorkFor *loop = task->arg;
+    uint64_t lo = task->lo, hi = task->hi;
+    free(task);
+    work_for_range(pool, loop, lo, hi);
+}
+
+/* Hands the upper halves to the deque until a grain is left, then runs it. */
+static inline void work_for_range(WorkPool *pool, WorkFor *loop, uint64_t lo, uint64_t hi)
+{
+    while (hi - lo > loop->grain)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        WorkTask *task = malloc(sizeof(*task));
+        if (task == NULL)
+            break;
+        task->run = work_run_range;
+        task->arg = loop;
+        task->lo = mid;
+        task->hi = hi;
+        work_pool_push(pool, task);
+        hi = mid;
+    }
+    loop->fn(lo, hi, loop->arg);
+    if (__atomic_sub_fetch(&loop->remaining, hi - lo, __ATOMIC_ACQ_REL) == 0)
+        work_flag_set(&loop->done);
+}
+
+/*
+ * Calls fn(lo, hi, arg) on subranges of begin..end - 1 of at most grain
+ * indexes (1 when grain is 0) on the pool's workers and returns when all
+ * are done. May be called from a task.
+ */
+static inline void work_pool_for(WorkPool *pool, uint64_t begin, uint64_t end, uint64_t grain,
+                                 void (*fn)(uint64_t lo, uint64_t hi, void *arg), void *arg)
+{
+    WorkFor loop = {fn, arg, grain > 0 ? grain : 1, end > begin ? end - begin : 0, 0};
+    if (loop.remaining == 0)
+        return;
+    if (work_pool_worker_index(pool) >= 0)
+        work_for_range(pool, &loop, begin, end);
+    else
+    {
+        WorkTask *root = malloc(sizeof(*root));
+        if (root == NULL)
+        {
+            fn(begin, end, arg);
+            return;
+        }
+        root->run = work_run_range;
+        root->arg = &loop;
+        root->lo = begin;
+        root->hi = end;
+        work_pool_push(pool, root);
+    }
+    work_flag_wait(pool, &loop.done);
+}
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef MSGFRAME_H
+#define MSGFRAME_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Filename: msgframe.h
+ *
+ * Length-prefixed framing used by the batched transport: one queue message
+ * carries as many records as fit, each as a 4-byte header and the bytes.
+ * The header holds the frame length in the low 31 bits; the top bit says
+ * the record goes on in the next frame, so a record longer than a message
+ * is cut into chunks and put back together by the receiver.
+ */
+
+#define FRAME_MORE 0x80000000u
+#define FRAME_HEADER sizeof(uint32_t)
+#define FRAME_MIN_ROOM 64 /* flush rather than start a record with less */
+
+struct frame_batch {
+   char *data;
+   size_t cap;
+   size_t used;
+   long records; /* records started in this batch */
+};
+
+/* Flushes the batch through send(); returns nonzero on failure. */
+typedef int (*frame_flush_fn)(struct frame_batch *batch, void *arg);
+
+/*
+ * Appends one record, flushing full batches as it goes. Returns 0, or the
+ * nonzero value flush returned.
+ */
+static inline int frame_append(struct frame_batch *b, const char *data, size_t len,
+                               frame_flush_fn flush, void *arg) {
+   int started = 0, rc;
+   if (b->cap - b->used < FRAME_HEADER + (len < FRAME_MIN_ROOM ? len : FRAME_MIN_ROOM) &&
+       b->used > 0 && (rc = flush(b, arg)) != 0)
+      return rc;
+
+   do {
+      size_t room = b->cap - b->used - FRAME_HEADER;
+      size_t chunk = len < room ? len : room;
+      uint32_t header = (uint32_t) chunk | (chunk < len ? FRAME_MORE : 0);
+      memcpy(b->data + b->used, &header, FRAME_HEADER);
+      memcpy(b->data + b->used + FRAME_HEADER, data, chunk);
+      b->used += FRAME_HEADER + chunk;
+      if (!started) {
+         b->records++;
+         started = 1;
+      }
+      data += chunk;
+      len -= chunk;
+      if ((len > 0 || b->cap - b->used <= FRAME_HEADER) && (rc = flush(b, arg)) != 0)
+         return rc;
+   } while (len > 0);
+   return 0;
+}
+
+/* Reassembles records from received batches. */
+struct frame_reader {
+   char *record;
+   size_t len;
+   size_t cap;
+};
+
+/* Called once per complete record; the bytes are valid until it returns. */
+typedef void (*frame_record_fn)(const char *record, size_t len, void *arg);
+
+/* Feeds one received batch; returns the number of records completed or -1. */
+static inline long frame_feed(struct frame_reader *r, const char *data, size_t size,
+                              frame_record_fn deliver, void *arg) {
+   long records = 0;
+   size_t pos = 0;
+   while (pos + FRAME_HEADER <= size) {
+      uint32_t header;
+      memcpy(&header, data + pos, FRAME_HEADER);
+      size_t chunk = header & ~FRAME_MORE;
+      pos += FRAME_HEADER;
+      if (chunk > size - pos)
+         return -1;
+
+      if (r->len + chunk + 1 > r->cap) {
+         size_t cap = r->cap ? r->cap : 256;
+         while (cap < r->len + chunk + 1)
+            cap *= 2;
+         char *grown = realloc(r->record, cap);
+         if (grown == NULL)
+            return -1;
+         r->record = grown;
+         r->cap = cap;
+      }
+      memcpy(r->record + r->len, data + pos, chunk);
+      r->len += chunk;
+      pos += chunk;
+
+      if (!(header & FRAME_MORE)) {
+         r->record[r->len] = '\0';
+         deliver(r->record, r->len, arg);
+         r->len = 0;
+         records++;
+      }
+   }
+   return records;
+}
+
+#endif
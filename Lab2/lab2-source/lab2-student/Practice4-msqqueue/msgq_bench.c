@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "msgqueue.h"
+
+/*
+ * Filename: msgq_bench.c
+ *
+ * Usage: msgq_bench [-B sysv|posix|shm] [-r round-trips] [-n messages] [-s bytes]
+ * Runs every backend of msgqueue.h (or only -B) on fresh queues between
+ * this process and a forked child:
+ *
+ *   round trip  send a message, wait for the child to echo it back; the
+ *               p50/p99/p99.9 latency is over all round trips.
+ *   throughput  send messages one way as fast as the child takes them.
+ *
+ * The end-of-stream message stops the child in both phases.
+ */
+
+struct bench_config {
+   long roundTrips;
+   long messages;
+   size_t bytes;
+};
+
+static uint64_t now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+   uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+   return (x > y) - (x < y);
+}
+
+/* Child side: echo requests to the reply queue, or just count them. */
+static int serve(int backend, const char *reqName, const char *repName) {
+   struct queue req, rep;
+   int echo = repName != NULL;
+   ssize_t n;
+   if (queue_open(&req, backend, reqName) == -1 || (echo && queue_open(&rep, backend, repName) == -1)) {
+      perror("queue_open");
+      return 1;
+   }
+   while ((n = queue_recv(&req, &(long){0}, queue_buffer(&req), req.msgmax)) > 0) {
+      if (echo && queue_send(&rep, 1, queue_buffer(&req), n) == -1) {
+         perror("queue_send");
+         return 1;
+      }
+   }
+   if (echo)
+      queue_close(&rep);
+   queue_close(&req);
+   return n < 0;
+}
+
+static pid_t spawn(int backend, const char *reqName, const char *repName) {
+   fflush(stdout); /* or the child prints our buffered lines again */
+   pid_t pid = fork();
+   if (pid == 0)
+      exit(serve(backend, reqName, repName));
+   return pid;
+}
+
+static int finish(pid_t pid) {
+   int status;
+   waitpid(pid, &status, 0);
+   return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static int bench_backend(int backend, const struct bench_config *cfg) {
+   char reqName[SHM_NAME_MAX], repName[SHM_NAME_MAX];
+   struct queue req, rep;
+   uint64_t *samples = malloc(cfg->roundTrips * sizeof(uint64_t) + 1);
+   char *msg = calloc(1, cfg->bytes + 1);
+   int failed = 0;
+
+   shm_segment_unique_name(reqName, sizeof(reqName), "msgq-bench");
+   shm_segment_unique_name(repName, sizeof(repName), "msgq-bench");
+   if (samples == NULL || msg == NULL || queue_open(&req, backend, reqName) == -1 ||
+       queue_open(&rep, backend, repName) == -1) {
+      perror("msgq_bench");
+      return 1;
+   }
+   if (cfg->bytes > req.msgmax) {
+      fprintf(stderr, "%s: messages are limited to %zu bytes\n", req.ops->name, req.msgmax);
+      return 1;
+   }
+
+   pid_t pid = spawn(backend, reqName, repName);
+   for (long i = 0; i < cfg->roundTrips && !failed; i++) {
+      uint64_t start = now_ns();
+      failed = queue_send(&req, 1, msg, cfg->bytes) == -1 ||
+               queue_recv(&rep, &(long){0}, queue_buffer(&rep), rep.msgmax) < 0;
+      samples[i] = now_ns() - start;
+   }
+   failed |= queue_send_eof(&req, 1) == -1;
+   failed |= finish(pid) != 0;
+   if (!failed && cfg->roundTrips > 0) {
+      long n = cfg->roundTrips;
+      qsort(samples, n, sizeof(uint64_t), compare_u64);
+      printf("%-6s round trip ns: p50 %llu  p99 %llu  p99.9 %llu  max %llu\n", req.ops->name,
+             (unsigned long long) samples[n / 2], (unsigned long long) samples[n * 99 / 100],
+             (unsigned long long) samples[n * 999 / 1000], (unsigned long long) samples[n - 1]);
+   }
+
+   /* One-way: the child only counts, so the reply queue stays unused. */
+   uint64_t start = now_ns();
+   pid = spawn(backend, reqName, NULL);
+   for (long i = 0; i < cfg->messages && !failed; i++)
+      failed = queue_send(&req, 1, msg, cfg->bytes) == -1;
+   failed |= queue_send_eof(&req, 1) == -1;
+   failed |= finish(pid) != 0;
+   double elapsed = (now_ns() - start) / 1e9;
+   if (!failed)
+      printf("%-6s throughput: %ld messages of %zu bytes in %.3f s, %.0f msgs/s, %.1f MB/s\n",
+             req.ops->name, cfg->messages, cfg->bytes, elapsed, cfg->messages / elapsed,
+             cfg->messages * (double) cfg->bytes / elapsed / 1e6);
+   else
+      fprintf(stderr, "%s: benchmark failed\n", req.ops->name);
+
+   queue_destroy(&req);
+   queue_destroy(&rep);
+   queue_close(&req);
+   queue_close(&rep);
+   free(samples);
+   free(msg);
+   return failed;
+}
+
+int main(int argc, char *argv[]) {
+   struct bench_config cfg = {100000, 1000000, 64};
+   int only = -1, failed = 0;
+   int c;
+
+   while ((c = getopt(argc, argv, "B:r:n:s:")) != -1) {
+      if (c == 'B' && (only = queue_backend(optarg)) >= 0) {
+         continue;
+      } else if (c == 'r') {
+         cfg.roundTrips = strtol(optarg, NULL, 10);
+      } else if (c == 'n') {
+         cfg.messages = strtol(optarg, NULL, 10);
+      } else if (c == 's') {
+         cfg.bytes = strtoul(optarg, NULL, 10);
+      } else {
+         fprintf(stderr, "Usage: %s [-B sysv|posix|shm] [-r round-trips] [-n messages] [-s bytes]\n", argv[0]);
+         exit(1);
+      }
+   }
+   /* Only the end-of-stream message is empty. */
+   if (cfg.bytes == 0)
+      cfg.bytes = 1;
+
+   for (int b = 0; b < QUEUE_BACKENDS; b++)
+      if (only < 0 || only == b)
+         failed |= bench_backend(b, &cfg);
+   return failed;
+}
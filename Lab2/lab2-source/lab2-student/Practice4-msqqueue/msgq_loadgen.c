@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "msgqueue.h"
+
+/*
+ * Filename: msgq_loadgen.c
+ *
+ * Usage: msgq_loadgen [-B sysv|posix] [-p 1,2,4,8] [-n per-producer]
+ *                     [-r receivers] [-u urgent-percent] [-s bytes]
+ *
+ * For each producer count in -p, forks that many producers and -r
+ * receivers, each receiver with a fresh queue of its own. Every message
+ * goes to receiver seq % r in one of two lanes, urgent (-u percent of
+ * messages, default 10) or bulk, sent as type 1 and 2. A receiver takes
+ * the most urgent type up to 2, which both backends do in one blocking
+ * receive, so the numbers measure the queue and not a polling loop.
+ *
+ * Reported per producer count: total msgs/s, p50/p99 latency per lane,
+ * Jain's fairness index over the producers' send rates (1.0 when every
+ * producer got the same share of the queue) and the spread between the
+ * best and worst producer's mean latency.
+ */
+
+#define LANES 2
+#define URGENT 0
+#define BULK 1
+
+struct load_msg {
+   uint32_t producer;
+   uint32_t lane;
+   uint64_t seq;
+   uint64_t sentNs;
+};
+
+struct load_config {
+   int backend;
+   long perProducer;
+   int receivers;
+   int urgentPercent;
+   size_t bytes;
+};
+
+/* Shared with the children; the arrays follow in the same segment. */
+struct load_results {
+   volatile int go;
+   double sendSeconds[64];      /* per producer */
+   double latencySum[64];       /* per producer, ns */
+   long received[64];           /* per producer */
+   long samples[LANES];         /* samples taken per lane */
+   uint64_t *latency[LANES];    /* ns, one slot per message */
+};
+
+static uint64_t now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+   uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+   return (x > y) - (x < y);
+}
+
+static long lane_type(int lane) {
+   return lane + 1;
+}
+
+/* Receiver r's queue is called "<name>-r". */
+static void receiver_queue(char *out, size_t size, const char *name, int receiver) {
+   snprintf(out, size, "%s-%d", name, receiver);
+}
+
+static int produce(const struct load_config *cfg, const char *name, int id, struct load_results *res) {
+   struct queue *qs = calloc(cfg->receivers, sizeof(struct queue));
+   char qname[SHM_NAME_MAX];
+   if (qs == NULL) {
+      perror("calloc");
+      return 1;
+   }
+   for (int r = 0; r < cfg->receivers; r++) {
+      receiver_queue(qname, sizeof(qname), name, r);
+      if (queue_open(&qs[r], cfg->backend, qname) == -1) {
+         perror("queue_open");
+         return 1;
+      }
+      memset(queue_buffer(&qs[r]), 0, cfg->bytes);
+   }
+   while (!res->go)
+      usleep(100);
+
+   uint64_t start = now_ns();
+   for (long seq = 0; seq < cfg->perProducer; seq++) {
+      struct load_msg m;
+      m.producer = id;
+      m.lane = (uint64_t) (seq * 7919 + id * 104729) % 100 < (uint64_t) cfg->urgentPercent ? URGENT : BULK;
+      m.seq = seq;
+      m.sentNs = now_ns();
+      struct queue *q = &qs[seq % cfg->receivers];
+      memcpy(queue_buffer(q), &m, sizeof(m));
+      if (queue_send(q, lane_type(m.lane), queue_buffer(q), cfg->bytes) == -1) {
+         perror("queue_send");
+         return 1;
+      }
+   }
+   res->sendSeconds[id] = (now_ns() - start) / 1e9;
+   for (int r = 0; r < cfg->receivers; r++)
+      queue_close(&qs[r]);
+   free(qs);
+   return 0;
+}
+
+static int consume(const struct load_config *cfg, const char *name, int id, struct load_results *res) {
+   struct queue q;
+   char qname[SHM_NAME_MAX];
+   ssize_t n;
+   long type;
+   receiver_queue(qname, sizeof(qname), name, id);
+   if (queue_open(&q, cfg->backend, qname) == -1) {
+      perror("queue_open");
+      return 1;
+   }
+   /* The end-of-stream message, sent once every producer is done, stops us. */
+   while ((n = queue_recv_range(&q, lane_type(URGENT), lane_type(BULK), &type, queue_buffer(&q), q.msgmax)) > 0) {
+      struct load_msg m;
+      memcpy(&m, queue_buffer(&q), sizeof(m));
+      uint64_t latency = now_ns() - m.sentNs;
+      long slot = __atomic_fetch_add(&res->samples[m.lane], 1, __ATOMIC_RELAXED);
+      res->latency[m.lane][slot] = latency;
+      __atomic_fetch_add(&res->received[m.producer], 1, __ATOMIC_RELAXED);
+      /* Doubles have no fetch-add; each producer's sum is only read at the end. */
+      double sum, next;
+      __atomic_load(&res->latencySum[m.producer], &sum, __ATOMIC_RELAXED);
+      do {
+         next = sum + latency;
+      } while (!__atomic_compare_exchange(&res->latencySum[m.producer], &sum, &next, 0, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+   }
+   queue_close(&q);
+   return n < 0;
+}
+
+/* Removes and closes the first n receiver queues. */
+static void remove_queues(struct queue *qs, int n) {
+   for (int r = 0; r < n; r++) {
+      queue_destroy(&qs[r]);
+      queue_close(&qs[r]);
+   }
+   free(qs);
+}
+
+static int run(const struct load_config *cfg, int producers) {
+   char name[SHM_NAME_MAX - 12], qname[SHM_NAME_MAX]; /* room for "-<receiver>" */
+   struct queue *qs;
+   long total = cfg->perProducer * producers;
+   ShmSegment seg;
+   int failed = 0;
+
+   shm_segment_unique_name(name, sizeof(name), "msgq-load");
+   if (shm_segment_create(&seg, NULL, sizeof(struct load_results) + LANES * total * sizeof(uint64_t), 0) != 0) {
+      perror("msgq_loadgen");
+      return 1;
+   }
+   if ((qs = calloc(cfg->receivers, sizeof(struct queue))) == NULL) {
+      perror("calloc");
+      shm_segment_close(&seg);
+      return 1;
+   }
+   for (int r = 0; r < cfg->receivers; r++) {
+      receiver_queue(qname, sizeof(qname), name, r);
+      if (queue_open(&qs[r], cfg->backend, qname) == -1) {
+         perror("queue_open");
+         remove_queues(qs, r);
+         shm_segment_close(&seg);
+         return 1;
+      }
+   }
+   struct load_results *res = seg.addr;
+   for (int lane = 0; lane < LANES; lane++)
+      res->latency[lane] = (uint64_t *) (res + 1) + lane * total;
+
+   pid_t *pids = malloc((producers + cfg->receivers) * sizeof(pid_t));
+   if (pids == NULL) {
+      perror("malloc");
+      remove_queues(qs, cfg->receivers);
+      shm_segment_close(&seg);
+      return 1;
+   }
+   fflush(stdout);
+   for (int i = 0; i < cfg->receivers + producers; i++) {
+      if ((pids[i] = fork()) == 0)
+         exit(i < cfg->receivers ? consume(cfg, name, i, res) : produce(cfg, name, i - cfg->receivers, res));
+      if (pids[i] == -1) {
+         perror("fork");
+         /* The children started so far are still waiting for go. */
+         for (int j = 0; j < i; j++)
+            kill(pids[j], SIGKILL);
+         for (int j = 0; j < i; j++)
+            waitpid(pids[j], NULL, 0);
+         remove_queues(qs, cfg->receivers);
+         shm_segment_close(&seg);
+         free(pids);
+         return 1;
+      }
+   }
+
+   uint64_t start = now_ns();
+   res->go = 1;
+   for (int i = cfg->receivers; i < cfg->receivers + producers; i++) {
+      int status;
+      waitpid(pids[i], &status, 0);
+      failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+   }
+   /* Stops go behind everything in the bulk lane. */
+   for (int r = 0; r < cfg->receivers; r++)
+      failed |= queue_send_eof(&qs[r], lane_type(BULK)) == -1;
+   for (int i = 0; i < cfg->receivers; i++) {
+      int status;
+      waitpid(pids[i], &status, 0);
+      failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+   }
+   double elapsed = (now_ns() - start) / 1e9;
+
+   long received = res->samples[URGENT] + res->samples[BULK];
+   if (failed || received != total) {
+      fprintf(stderr, "%d producers: received %ld of %ld messages\n", producers, received, total);
+      failed = 1;
+   } else {
+      double rateSum = 0, rateSquares = 0, minMean = 0, maxMean = 0;
+      for (int p = 0; p < producers; p++) {
+         double rate = cfg->perProducer / res->sendSeconds[p];
+         double mean = res->latencySum[p] / res->received[p] / 1e3;
+         rateSum += rate;
+         rateSquares += rate * rate;
+         if (p == 0 || mean < minMean)
+            minMean = mean;
+         if (p == 0 || mean > maxMean)
+            maxMean = mean;
+      }
+      printf("%9d %11.0f", producers, total / elapsed);
+      for (int lane = 0; lane < LANES; lane++) {
+         long n = res->samples[lane];
+         qsort(res->latency[lane], n, sizeof(uint64_t), compare_u64);
+         if (n > 0)
+            printf(" %9.1f %9.1f", res->latency[lane][n / 2] / 1e3, res->latency[lane][n * 99 / 100] / 1e3);
+         else
+            printf(" %9s %9s", "-", "-");
+      }
+      printf(" %8.3f %8.1f-%.1f\n", rateSum * rateSum / (producers * rateSquares), minMean, maxMean);
+   }
+
+   remove_queues(qs, cfg->receivers);
+   shm_segment_close(&seg);
+   free(pids);
+   return failed;
+}
+
+int main(int argc, char *argv[]) {
+   struct load_config cfg = {QUEUE_SYSV, 100000, 2, 10, sizeof(struct load_msg)};
+   char *counts = "1,2,4,8";
+   int failed = 0;
+   int c;
+
+   while ((c = getopt(argc, argv, "B:p:n:r:u:s:")) != -1) {
+      if (c == 'B' && (cfg.backend = queue_backend(optarg)) >= 0 && cfg.backend != QUEUE_SHM) {
+         continue;
+      } else if (c == 'p') {
+         counts = optarg;
+      } else if (c == 'n') {
+         cfg.perProducer = strtol(optarg, NULL, 10);
+      } else if (c == 'r') {
+         cfg.receivers = atoi(optarg);
+      } else if (c == 'u') {
+         cfg.urgentPercent = atoi(optarg);
+      } else if (c == 's') {
+         cfg.bytes = strtoul(optarg, NULL, 10);
+      } else {
+         fprintf(stderr, "Usage: %s [-B sysv|posix] [-p 1,2,4,8] [-n per-producer] [-r receivers] "
+                         "[-u urgent-percent] [-s bytes]\n", argv[0]);
+         exit(1);
+      }
+   }
+   if (cfg.bytes < sizeof(struct load_msg))
+      cfg.bytes = sizeof(struct load_msg);
+   if (cfg.receivers < 1)
+      cfg.receivers = 1;
+
+   printf("%s, %d receivers, %ld messages per producer, %d%% urgent\n", queue_backends[cfg.backend].name,
+          cfg.receivers, cfg.perProducer, cfg.urgentPercent);
+   printf("producers      msgs/s urgent-p50       p99  bulk-p50       p99 fairness mean latency\n");
+   printf("                          (us)      (us)      (us)      (us)              (us)\n");
+   for (char *p = counts; *p != '\0';) {
+      int producers = strtol(p, &p, 10);
+      if (producers < 1 || producers > 64) {
+         fprintf(stderr, "producer counts must be 1..64\n");
+         return 1;
+      }
+      failed |= run(&cfg, producers);
+      if (*p == ',')
+         p++;
+   }
+   return failed;
+}
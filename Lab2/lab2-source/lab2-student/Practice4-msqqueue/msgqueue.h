@@ -0,0 +1,620 @@
+#ifndef MSGQUEUE_H
+#define MSGQUEUE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include "../../../include/shm_segment.h"
+#include "../../../include/spsc_ring.h"
+
+/*
+ * Filename: msgqueue.h
+ *
+ * One message-queue interface over three backends, picked at run time:
+ *
+ *   sysv   System V msgget/msgsnd/msgrcv; the message type is the mtype.
+ *   posix  POSIX mq_open/mq_send/mq_receive. The descriptor is opened
+ *          non-blocking and waited on with epoll, so a receiver can watch
+ *          it next to other descriptors. The type travels as the message
+ *          priority.
+ *   shm    spsc_ring.h in a named POSIX shared-memory segment: one sender
+ *          and one receiver, no system call while data flows.
+ *
+ * Types are positive and a lower type is more urgent, as with a negative
+ * msgtyp on System V. queue_recv_range() takes the most urgent message in
+ * a type range, so several receivers can share one queue, each pulling
+ * its own range, with priority lanes inside it. Only sysv can select by
+ * type; posix still delivers the most urgent message first but from the
+ * whole queue, and shm delivers in order.
+ *
+ * Every backend is opened by name; whichever side comes first creates the
+ * queue. The default name maps to the old System V key 0x123. Include
+ * with _GNU_SOURCE defined; link with -lrt on glibc older than 2.34.
+ *
+ * queue_buffer() is the payload area of the queue's own staging buffer.
+ * Building a message there, or receiving into it, saves the copy
+ * queue_send and queue_recv otherwise make.
+ *
+ * A message without payload is the end-of-stream control message: data
+ * messages always carry a byte, queue_send_eof() sends one with the
+ * sender's own type, so it queues behind that sender's data and inside
+ * the receivers' type range, and a receive returns QUEUE_EOF (0) for it.
+ *
+ * Programs that share a queue by name attach with queue_attach() as a
+ * producer or consumer; the counts live in a small "<name>.refs" segment.
+ * queue_detach() by the last process out removes the queue, so nobody
+ * removes it under a receiver that is still draining it. A producer that
+ * leaves unread messages behind keeps the queue for the first consumer to
+ * come, but not once every consumer has come and gone.
+ * A process killed while attached keeps its count; remove the queue and
+ * /dev/shm/<name>.refs by hand then.
+ *
+ * Several producers can feed one receiver. An attached producer opens its
+ * stream with queue_open_stream(), and the segment counts the streams of
+ * each type until their end-of-stream message is taken. A receiver passes
+ * every QUEUE_EOF to queue_stream_end(), which says whether a stream in
+ * its range is still open, so it stops at the last producer's end rather
+ * than the first one's.
+ */
+
+#define PERMS 0644
+#define MSG_KEY 0x123
+#define QUEUE_DEFAULT_NAME "/lab2-msgq"
+#define MSGMAX_PATH "/proc/sys/kernel/msgmax"
+#define DEFAULT_MSGMAX 8192
+#define POSIX_MAXMSG 10 /* fs.mqueue.msg_max default */
+#define SHM_QUEUE_BYTES (1 << 20)
+#define QUEUE_POLL_MIN_US 20
+#define QUEUE_POLL_MAX_US 1000
+#define QUEUE_EOF 0 /* receive result for the end-of-stream message */
+#define QUEUE_OPEN_TRIES 1000
+#define QUEUE_STREAM_TYPES 64 /* distinct producer types a queue counts */
+
+/* queue_attach roles */
+#define QUEUE_PRODUCER 1
+#define QUEUE_CONSUMER 2
+
+enum queue_backend { QUEUE_SYSV, QUEUE_POSIX, QUEUE_SHM, QUEUE_BACKENDS };
+
+struct queue;
+
+struct queue_ops {
+   const char *name;
+   int (*open)(struct queue *q);
+   int (*send)(struct queue *q, long type, size_t len);      /* from the staging buffer */
+   ssize_t (*recv)(struct queue *q, long lo, long hi, long *type); /* into the staging buffer */
+   long (*pending)(struct queue *q);                         /* messages not yet taken */
+   void (*close)(struct queue *q);
+   int (*destroy)(struct queue *q);
+};
+
+/* Header of the shared-memory backend's segment; the ring follows it. */
+struct shm_queue {
+   uint32_t ready;
+   char pad[SPSC_CACHE_LINE - sizeof(uint32_t)];
+   SpscRing ring;
+};
+
+/* Streams of one type whose end-of-stream message has not been taken. */
+struct queue_stream {
+   long type;       /* 0 while the slot is free */
+   uint32_t open;
+};
+
+/*
+ * Attached processes, consumers in the high half and producers in the
+ * low; QUEUE_REFS_SERVED once a consumer has attached, QUEUE_REFS_GONE
+ * once the last one has started removing the queue.
+ */
+struct queue_refs {
+   uint32_t ready;
+   uint64_t count;
+   struct queue_stream streams[QUEUE_STREAM_TYPES];
+};
+
+#define QUEUE_REFS_CONSUMER (1ull << 32)
+#define QUEUE_REFS_SERVED (1ull << 62)
+#define QUEUE_REFS_GONE (1ull << 63)
+
+struct queue {
+   const struct queue_ops *ops;
+   char name[SHM_NAME_MAX];
+   size_t msgmax;   /* largest payload */
+   char *staging;   /* long type prefix (sysv, shm), then the payload */
+   size_t prefix;   /* bytes before the payload in staging */
+   int msqid;       /* sysv */
+   mqd_t mq;        /* posix */
+   int epfd;        /* posix */
+   ShmSegment seg;  /* shm */
+   SpscRing *ring;  /* shm */
+   int role;        /* QUEUE_PRODUCER or QUEUE_CONSUMER after queue_attach */
+   long stream;     /* type of the producer's open stream, 0 when none */
+   ShmSegment refSeg;
+   struct queue_refs *refs;
+};
+
+static inline size_t kernel_msgmax(void) {
+   FILE *f = fopen(MSGMAX_PATH, "r");
+   long max = 0;
+   if (f != NULL) {
+      if (fscanf(f, "%ld", &max) != 1)
+         max = 0;
+      fclose(f);
+   }
+   return max > 0 ? (size_t) max : DEFAULT_MSGMAX;
+}
+
+/* ---- System V ---- */
+
+static inline key_t sysv_key(const char *name) {
+   uint32_t h = 2166136261u;
+   if (strcmp(name, QUEUE_DEFAULT_NAME) == 0)
+      return MSG_KEY;
+   for (; *name; name++)
+      h = (h ^ (unsigned char) *name) * 16777619u;
+   return (key_t) (h & 0x7fffffff);
+}
+
+static inline int sysv_open(struct queue *q) {
+   if ((q->msqid = msgget(sysv_key(q->name), PERMS | IPC_CREAT)) == -1)
+      return -1;
+   q->msgmax = kernel_msgmax();
+   q->prefix = sizeof(long);
+   return 0;
+}
+
+static inline int sysv_send(struct queue *q, long type, size_t len) {
+   memcpy(q->staging, &type, sizeof(long));
+   while (msgsnd(q->msqid, q->staging, len, 0) == -1)
+      if (errno != EINTR)
+         return -1;
+   return 0;
+}
+
+static inline ssize_t sysv_take(struct queue *q, long msgtyp, int flags, long *type) {
+   ssize_t n;
+   while ((n = msgrcv(q->msqid, q->staging, q->msgmax, msgtyp, flags)) == -1)
+      if (errno != EINTR)
+         return -1;
+   memcpy(type, q->staging, sizeof(long));
+   return n;
+}
+
+/*
+ * The kernel can block on one type, on "any" or on "lowest type up to
+ * hi", so a range starting at 1 costs one call. Other ranges are swept
+ * from the most urgent type with IPC_NOWAIT and, when empty, polled again
+ * after a back-off that grows to QUEUE_POLL_MAX_US.
+ */
+static inline ssize_t sysv_recv(struct queue *q, long lo, long hi, long *type) {
+   if (hi <= 0)
+      return sysv_take(q, 0, 0, type);
+   if (lo <= 1)
+      return sysv_take(q, -hi, 0, type);
+   if (lo == hi)
+      return sysv_take(q, lo, 0, type);
+
+   for (useconds_t backoff = QUEUE_POLL_MIN_US;;) {
+      for (long t = lo; t <= hi; t++) {
+         ssize_t n = sysv_take(q, t, IPC_NOWAIT, type);
+         if (n >= 0 || errno != ENOMSG)
+            return n;
+      }
+      usleep(backoff);
+      if (backoff < QUEUE_POLL_MAX_US)
+         backoff *= 2;
+   }
+}
+
+static inline long sysv_pending(struct queue *q) {
+   struct msqid_ds ds;
+   return msgctl(q->msqid, IPC_STAT, &ds) == 0 ? (long) ds.msg_qnum : -1;
+}
+
+static inline void sysv_close(struct queue *q) {
+   (void) q;
+}
+
+static inline int sysv_destroy(struct queue *q) {
+   return msgctl(q->msqid, IPC_RMID, NULL);
+}
+
+/* ---- POSIX mqueue ---- */
+
+static inline int posix_open(struct queue *q) {
+   struct mq_attr attr;
+   struct epoll_event ev;
+   memset(&attr, 0, sizeof(attr));
+   attr.mq_maxmsg = POSIX_MAXMSG;
+   attr.mq_msgsize = DEFAULT_MSGMAX;
+   q->mq = mq_open(q->name, O_RDWR | O_CREAT | O_NONBLOCK, PERMS, &attr);
+   if (q->mq == (mqd_t) -1)
+      return -1;
+   if (mq_getattr(q->mq, &attr) != 0 || (q->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+      mq_close(q->mq);
+      return -1;
+   }
+   memset(&ev, 0, sizeof(ev));
+   epoll_ctl(q->epfd, EPOLL_CTL_ADD, q->mq, &ev);
+   q->msgmax = attr.mq_msgsize;
+   q->prefix = 0;
+   return 0;
+}
+
+/* Sleeps until epoll reports the queue ready for events (EPOLLIN or EPOLLOUT). */
+static inline void posix_wait(struct queue *q, uint32_t events) {
+   struct epoll_event ev;
+   memset(&ev, 0, sizeof(ev));
+   ev.events = events;
+   epoll_ctl(q->epfd, EPOLL_CTL_MOD, q->mq, &ev);
+   while (epoll_wait(q->epfd, &ev, 1, -1) == -1 && errno == EINTR)
+      ;
+}
+
+/* mq delivers the highest priority first, so urgent (low) types get high ones. */
+static inline unsigned posix_priority(long type) {
+   return type <= 0 ? MQ_PRIO_MAX - 1 : type >= MQ_PRIO_MAX ? 0 : (unsigned) (MQ_PRIO_MAX - type);
+}
+
+static inline int posix_send(struct queue *q, long type, size_t len) {
+   unsigned prio = posix_priority(type);
+   while (mq_send(q->mq, q->staging, len, prio) == -1) {
+      if (errno == EAGAIN)
+         posix_wait(q, EPOLLOUT);
+      else if (errno != EINTR)
+         return -1;
+   }
+   return 0;
+}
+
+static inline ssize_t posix_recv(struct queue *q, long lo, long hi, long *type) {
+   unsigned prio;
+   (void) lo;
+   (void) hi;
+   ssize_t n;
+   while ((n = mq_receive(q->mq, q->staging, q->msgmax, &prio)) == -1) {
+      if (errno == EAGAIN)
+         posix_wait(q, EPOLLIN);
+      else if (errno != EINTR)
+         return -1;
+   }
+   *type = MQ_PRIO_MAX - prio;
+   return n;
+}
+
+static inline long posix_pending(struct queue *q) {
+   struct mq_attr attr;
+   return mq_getattr(q->mq, &attr) == 0 ? attr.mq_curmsgs : -1;
+}
+
+static inline void posix_close(struct queue *q) {
+   close(q->epfd);
+   mq_close(q->mq);
+}
+
+static inline int posix_destroy(struct queue *q) {
+   return mq_unlink(q->name);
+}
+
+/* ---- shared-memory ring ---- */
+
+/*
+ * Opens the named segment, creating it of the given size when it does not
+ * exist yet; the creator runs init (may be NULL) on it. The segment starts
+ * with a uint32_t ready flag, set once init is done, which the other
+ * processes wait for.
+ */
+static inline int shm_open_shared(ShmSegment *seg, const char *name, size_t bytes, void (*init)(void *)) {
+   for (int tries = 0;; tries++) {
+      if (shm_segment_create(seg, name, bytes, 0) == 0) {
+         if (init != NULL)
+            init(seg->addr);
+         __atomic_store_n((uint32_t *) seg->addr, 1, __ATOMIC_RELEASE);
+         return 0;
+      }
+      /* Somebody else created it; it may not be sized or set up yet. */
+      if (errno == EEXIST && shm_segment_open(seg, name, 0) == 0 && seg->size >= bytes) {
+         while (!__atomic_load_n((uint32_t *) seg->addr, __ATOMIC_ACQUIRE))
+            usleep(100);
+         return 0;
+      }
+      if (seg->addr != NULL)
+         shm_segment_close(seg);
+      if ((errno != EEXIST && errno != ENOENT && errno != EINVAL) || tries == QUEUE_OPEN_TRIES)
+         return -1;
+      usleep(1000);
+   }
+}
+
+static inline void shm_init_queue(void *mem) {
+   spsc_ring_init(&((struct shm_queue *) mem)->ring, SHM_QUEUE_BYTES);
+}
+
+static inline int shm_open_queue(struct queue *q) {
+   size_t bytes = offsetof(struct shm_queue, ring) + spsc_ring_bytes(SHM_QUEUE_BYTES);
+   if (shm_open_shared(&q->seg, q->name, bytes, shm_init_queue) != 0)
+      return -1;
+   q->ring = &((struct shm_queue *) q->seg.addr)->ring;
+   q->msgmax = spsc_ring_max_message(q->ring) - sizeof(long);
+   q->prefix = sizeof(long);
+   return 0;
+}
+
+static inline int shm_send(struct queue *q, long type, size_t len) {
+   memcpy(q->staging, &type, sizeof(long));
+   return spsc_ring_push(q->ring, q->staging, sizeof(long) + len) < 0 ? -1 : 0;
+}
+
+static inline ssize_t shm_recv(struct queue *q, long lo, long hi, long *type) {
+   (void) lo;
+   (void) hi;
+   long n = spsc_ring_pop(q->ring, q->staging, sizeof(long) + q->msgmax);
+   if (n < (long) sizeof(long)) {
+      errno = n == -2 ? EIDRM : EBADMSG;
+      return -1;
+   }
+   memcpy(type, q->staging, sizeof(long));
+   return n - sizeof(long);
+}
+
+static inline long shm_pending(struct queue *q) {
+   return __atomic_load_n(&q->ring->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&q->ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline void shm_close(struct queue *q) {
+   shm_segment_close(&q->seg);
+}
+
+static inline int shm_destroy(struct queue *q) {
+   return shm_segment_unlink(&q->seg);
+}
+
+static const struct queue_ops queue_backends[QUEUE_BACKENDS] = {
+   {"sysv", sysv_open, sysv_send, sysv_recv, sysv_pending, sysv_close, sysv_destroy},
+   {"posix", posix_open, posix_send, posix_recv, posix_pending, posix_close, posix_destroy},
+   {"shm", shm_open_queue, shm_send, shm_recv, shm_pending, shm_close, shm_destroy},
+};
+
+/* Backend number for "sysv", "posix" or "shm", -1 for anything else. */
+static inline int queue_backend(const char *name) {
+   for (int i = 0; i < QUEUE_BACKENDS; i++)
+      if (strcmp(name, queue_backends[i].name) == 0)
+         return i;
+   return -1;
+}
+
+/* Opens (creating when needed) the queue called name; NULL for the default. */
+static inline int queue_open(struct queue *q, int backend, const char *name) {
+   memset(q, 0, sizeof(*q));
+   q->ops = &queue_backends[backend];
+   snprintf(q->name, sizeof(q->name), "%s", name != NULL ? name : QUEUE_DEFAULT_NAME);
+   if (q->ops->open(q) != 0)
+      return -1;
+   q->staging = malloc(q->prefix + q->msgmax);
+   if (q->staging == NULL) {
+      q->ops->close(q);
+      return -1;
+   }
+   return 0;
+}
+
+/* Where to build a message for queue_send, or find one after queue_recv. */
+static inline void *queue_buffer(struct queue *q) {
+   return q->staging + q->prefix;
+}
+
+/*
+ * Sends len bytes of data as a message of the given type (> 0). len may
+ * not be 0, which would be taken for the end of the stream.
+ */
+static inline int queue_send(struct queue *q, long type, const void *data, size_t len) {
+   if (len == 0 || len > q->msgmax) {
+      errno = len == 0 ? EINVAL : EMSGSIZE;
+      return -1;
+   }
+   if (data != queue_buffer(q))
+      memcpy(queue_buffer(q), data, len);
+   return q->ops->send(q, type, len);
+}
+
+/*
+ * Sends the end-of-stream message behind the sender's messages of this
+ * type, ending the stream queue_open_stream opened.
+ */
+static inline int queue_send_eof(struct queue *q, long type) {
+   if (q->stream == type)
+      q->stream = 0;
+   return q->ops->send(q, type, 0);
+}
+
+/*
+ * Receives the most urgent message with a type in lo..hi (hi 0 for any)
+ * into buf, at most cap bytes, sets *type and returns the length, or
+ * QUEUE_EOF for the end-of-stream message.
+ */
+static inline ssize_t queue_recv_range(struct queue *q, long lo, long hi, long *type, void *buf, size_t cap) {
+   ssize_t n = q->ops->recv(q, lo, hi, type);
+   if (n >= 0 && buf != queue_buffer(q))
+      memcpy(buf, queue_buffer(q), (size_t) n < cap ? (size_t) n : cap);
+   return n;
+}
+
+/*
+ * Receives one message selected like msgrcv's msgtyp: 0 takes the first
+ * message, t > 0 only type t, t < 0 the most urgent type up to -t. *type
+ * holds the selector on entry and the type received on return.
+ */
+static inline ssize_t queue_recv(struct queue *q, long *type, void *buf, size_t cap) {
+   long t = *type;
+   if (t == 0)
+      return queue_recv_range(q, 0, 0, type, buf, cap);
+   return t > 0 ? queue_recv_range(q, t, t, type, buf, cap) : queue_recv_range(q, 1, -t, type, buf, cap);
+}
+
+/* Waits until every message sent has been received. */
+static inline void queue_drain(struct queue *q) {
+   if (q->ring != NULL) {
+      spsc_ring_drain(q->ring);
+      return;
+   }
+   while (q->ops->pending(q) > 0)
+      usleep(1000);
+}
+
+static inline void queue_close(struct queue *q) {
+   q->ops->close(q);
+   free(q->staging);
+   q->staging = NULL;
+}
+
+/* Removes the queue from the system; open handles may still drain it. */
+static inline int queue_destroy(struct queue *q) {
+   return q->ops->destroy(q);
+}
+
+/*
+ * queue_open, counting the caller as a role (QUEUE_PRODUCER or
+ * QUEUE_CONSUMER) of the queue until queue_detach.
+ */
+static inline int queue_attach(struct queue *q, int backend, const char *name, int role) {
+   char refName[SHM_NAME_MAX];
+   uint64_t one = role == QUEUE_CONSUMER ? QUEUE_REFS_CONSUMER : 1;
+   ShmSegment seg;
+   struct queue_refs *refs;
+   uint64_t count;
+
+   snprintf(refName, sizeof(refName), "%s.refs", name != NULL ? name : QUEUE_DEFAULT_NAME);
+   for (int tries = 0;; tries++) {
+      if (shm_open_shared(&seg, refName, sizeof(struct queue_refs), NULL) != 0)
+         return -1;
+      refs = seg.addr;
+      count = __atomic_load_n(&refs->count, __ATOMIC_ACQUIRE);
+      while (!(count & QUEUE_REFS_GONE) &&
+             !__atomic_compare_exchange_n(&refs->count, &count,
+                                          (count + one) | (role == QUEUE_CONSUMER ? QUEUE_REFS_SERVED : 0), 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+         ;
+      if (!(count & QUEUE_REFS_GONE))
+         break;
+      /* The last user is removing it; wait for the name to go and start afresh. */
+      shm_segment_close(&seg);
+      if (tries == QUEUE_OPEN_TRIES) {
+         errno = EBUSY;
+         return -1;
+      }
+      usleep(100);
+   }
+
+   if (queue_open(q, backend, name) != 0) {
+      int saved = errno;
+      __atomic_fetch_sub(&refs->count, one, __ATOMIC_ACQ_REL);
+      shm_segment_close(&seg);
+      errno = saved;
+      return -1;
+   }
+   q->role = role;
+   q->refSeg = seg;
+   q->refs = refs;
+   return 0;
+}
+
+/* The counter for streams of this type, claiming a free one when create is set. */
+static inline struct queue_stream *queue_stream_slot(struct queue_refs *refs, long type, int create) {
+   for (int i = 0; i < QUEUE_STREAM_TYPES; i++) {
+      long seen = __atomic_load_n(&refs->streams[i].type, __ATOMIC_ACQUIRE);
+      if (seen == 0) {
+         if (!create)
+            return NULL;
+         if (__atomic_compare_exchange_n(&refs->streams[i].type, &seen, type, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return &refs->streams[i];
+         /* Another producer took the slot; seen is its type now. */
+      }
+      if (seen == type)
+         return &refs->streams[i];
+   }
+   return NULL;
+}
+
+/*
+ * Counts the attached producer's stream of this type (> 0) as open until
+ * a receiver takes its end-of-stream message. queue_send_eof ends it, and
+ * so does queue_detach for a producer that has not sent one.
+ */
+static inline int queue_open_stream(struct queue *q, long type) {
+   struct queue_stream *stream = queue_stream_slot(q->refs, type, 1);
+   if (stream == NULL) {
+      errno = ENOSPC;
+      return -1;
+   }
+   __atomic_fetch_add(&stream->open, 1, __ATOMIC_ACQ_REL);
+   q->stream = type;
+   return 0;
+}
+
+/*
+ * Counts the end-of-stream message of this type a receive just returned.
+ * Returns 1 when no stream with a type in lo..hi (hi 0 for any) is still
+ * open, so the receiver can stop, 0 when producers are still sending.
+ * Backends that cannot select by type count every stream.
+ */
+static inline int queue_stream_end(struct queue *q, long type, long lo, long hi) {
+   struct queue_stream *stream = queue_stream_slot(q->refs, type, 0);
+   int any = hi <= 0 || q->ops != &queue_backends[QUEUE_SYSV];
+
+   if (stream != NULL) {
+      uint32_t open = __atomic_load_n(&stream->open, __ATOMIC_ACQUIRE);
+      while (open > 0 &&
+             !__atomic_compare_exchange_n(&stream->open, &open, open - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+         ;
+   }
+   for (int i = 0; i < QUEUE_STREAM_TYPES; i++) {
+      long t = __atomic_load_n(&q->refs->streams[i].type, __ATOMIC_ACQUIRE);
+      if (t == 0)
+         break;
+      if ((any || (t >= lo && t <= hi)) && __atomic_load_n(&q->refs->streams[i].open, __ATOMIC_ACQUIRE) > 0)
+         return 0;
+   }
+   return 1;
+}
+
+/*
+ * Closes a queue opened with queue_attach. The last process out removes
+ * the queue and its counts, unless it is a producer leaving messages for
+ * a consumer that has not attached yet. Returns 1 when this call removed
+ * the queue, 0 when it did not, -1 when removing failed.
+ */
+static inline int queue_detach(struct queue *q) {
+   uint64_t one = q->role == QUEUE_CONSUMER ? QUEUE_REFS_CONSUMER : 1;
+   uint64_t count;
+   int last, rc = 0;
+
+   /* Receivers would otherwise wait for this producer forever. */
+   if (q->stream != 0 && queue_send_eof(q, q->stream) == -1)
+      rc = -1;
+   count = __atomic_load_n(&q->refs->count, __ATOMIC_ACQUIRE);
+   do {
+      last = (count & ~QUEUE_REFS_SERVED) == one &&
+             (q->role == QUEUE_CONSUMER || (count & QUEUE_REFS_SERVED) || q->ops->pending(q) == 0);
+   } while (!__atomic_compare_exchange_n(&q->refs->count, &count, last ? QUEUE_REFS_GONE : count - one, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+   if (last) {
+      rc = queue_destroy(q) == 0 ? 1 : -1;
+      shm_segment_unlink(&q->refSeg);
+   }
+   shm_segment_close(&q->refSeg);
+   q->refs = NULL;
+   queue_close(q);
+   return rc;
+}
+
+#endif
@@ -1,45 +1,146 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
+#include <time.h>
+#include <unistd.h>
+#include "msgframe.h"
+#include "msgqueue.h"
 
 /*
  * Filename: msgrcv.c
+ *
+ * Usage: msgrcv [-B sysv|posix|shm] [-n name] [-r lo[-hi]] [-b] [-q]
+ * -r only takes messages with a type in lo..hi, most urgent (lowest) type
+ * first, so several receivers can share a queue, each with its own range.
+ * Without -r messages are taken in arrival order.
+ * -b takes the batches msgsnd -b sends and splits them back into lines.
+ * -q only counts the lines instead of printing them.
+ * The receiver stops once every sender with a type in its range has sent
+ * its end of stream, however many share the queue.
  */
 
-#define PERMS 0644
-#define MSG_KEY 0x123
 struct my_msgbuf {
    long mtype;
    char mtext[200];
 };
 
-int main(void) {
+static double now_seconds(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct recv_stats {
+   int quiet;
+   long lines;
+   long bytes;
+};
+
+static void print_line(const char *line, size_t len, void *arg) {
+   struct recv_stats *stats = arg;
+   if (!stats->quiet)
+      printf("recvd: \"%s\"\n", line);
+   stats->lines++;
+   stats->bytes += len;
+}
+
+int main(int argc, char *argv[]) {
    struct my_msgbuf buf;
-   int msqid;
-   int toend;
-   key_t key;
+   struct queue q;
+   int backend = QUEUE_SYSV;
+   const char *name = NULL;
+   long lo = 0, hi = 0;
+   char *end;
+   int batched = 0;
+   long messages = 0;
+   struct recv_stats stats = {0, 0, 0};
+   double start = 0;
+   int c;
+
+   while ((c = getopt(argc, argv, "B:n:r:bq")) != -1) {
+      if (c == 'B' && (backend = queue_backend(optarg)) >= 0) {
+         continue;
+      } else if (c == 'n') {
+         name = optarg;
+      } else if (c == 'r') {
+         lo = hi = strtol(optarg, &end, 10);
+         if (*end == '-')
+            hi = strtol(end + 1, NULL, 10);
+         if (lo < 1 || hi < lo) {
+            fprintf(stderr, "msgrcv: bad type range '%s'\n", optarg);
+            exit(1);
+         }
+      } else if (c == 'b') {
+         batched = 1;
+      } else if (c == 'q') {
+         stats.quiet = 1;
+      } else {
+         fprintf(stderr, "Usage: %s [-B sysv|posix|shm] [-n name] [-r lo[-hi]] [-b] [-q]\n", argv[0]);
+         exit(1);
+      }
+   }
    
-   if ((msqid = msgget(MSG_KEY, PERMS | IPC_CREAT)) == -1) { /* connect to the queue */
-      perror("msgget");
+   if (queue_attach(&q, backend, name, QUEUE_CONSUMER) == -1) { /* connect to the queue */
+      perror("queue_attach");
       exit(1);
    }
    printf("message queue: ready to receive messages.\n");
-   
-   for(;;) { /* normally receiving never ends but just to make conclusion 
-             /* this program ends wuth string of end */
-      if (msgrcv(msqid, &buf, sizeof(buf.mtext), 0, 0) == -1) {
-         perror("msgrcv");
-         exit(1);
+
+   if (batched) {
+      struct frame_reader reader = {NULL, 0, 0};
+      ssize_t n;
+      /* Batches are read in place. */
+      for (;;) {
+         long type;
+         if ((n = queue_recv_range(&q, lo, hi, &type, queue_buffer(&q), q.msgmax)) == QUEUE_EOF) {
+            if (queue_stream_end(&q, type, lo, hi))
+               break;
+            continue;
+         }
+         if (n == -1) {
+            perror("queue_recv");
+            exit(1);
+         }
+         if (messages++ == 0)
+            start = now_seconds();
+         if (frame_feed(&reader, queue_buffer(&q), n, print_line, &stats) < 0) {
+            fprintf(stderr, "msgrcv: malformed batch\n");
+            exit(1);
+         }
       }
-      printf("recvd: \"%s\"\n", buf.mtext);
-      toend = strcmp(buf.mtext,"end");
-      if (toend == 0)
-      break;
+      free(reader.record);
+   } else {
+      for(;;) { /* normally receiving never ends but just to make conclusion 
+                * this program ends with the last sender's end-of-stream message */
+         ssize_t n = queue_recv_range(&q, lo, hi, &buf.mtype, buf.mtext, sizeof(buf.mtext));
+         if (n == -1) {
+            perror("queue_recv");
+            exit(1);
+         }
+         if (n == QUEUE_EOF) {
+            if (queue_stream_end(&q, buf.mtype, lo, hi))
+               break;
+            continue;
+         }
+         if (messages++ == 0)
+            start = now_seconds();
+         if (!stats.quiet)
+            printf("recvd: \"%s\"\n", buf.mtext);
+         stats.lines++;
+         stats.bytes += strlen(buf.mtext);
+      }
+   }
+   double elapsed = messages > 0 ? now_seconds() - start : 0;
+   if (queue_detach(&q) == -1) {
+      perror("queue_detach");
+      exit(1);
    }
+
    printf("message queue: done receiving messages.\n");
-   system("rm msgq.txt");
+   printf("received %ld lines (%ld bytes) in %ld %s receives, %.3f s: %.0f lines/s, %.1f MB/s\n",
+          stats.lines, stats.bytes, messages, q.ops->name, elapsed, elapsed > 0 ? stats.lines / elapsed : 0.0,
+          elapsed > 0 ? stats.bytes / elapsed / 1e6 : 0.0);
    return 0;
 }
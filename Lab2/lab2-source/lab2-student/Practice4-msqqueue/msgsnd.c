@@ -1,54 +1,146 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
+#include <time.h>
+#include <unistd.h>
+#include "msgframe.h"
+#include "msgqueue.h"
 
 /*
  * Filename: msgsnd.c
+ *
+ * Usage: msgsnd [-B sysv|posix|shm] [-n name] [-t type] [-b] [-s batch-bytes]
+ * Sends stdin line by line, one message per line of at most 199 bytes,
+ * all with the given type (default 1; lower types are more urgent).
+ * -b packs the lines into batches of up to batch-bytes (default: the
+ * largest message the queue takes) with msgframe.h, so one send carries
+ * many lines and lines of any length arrive whole. Start msgrcv with the
+ * same -B, -n and -b. The queue backends are described in msgqueue.h.
  */
 
-#define PERMS 0644
-#define MSG_KEY 0x123
 struct my_msgbuf {
    long mtype;
    char mtext[200];
 };
 
-int main(void) {
+struct send_stats {
+   struct queue *q;
+   long type;
+   long messages;
+   long bytes;
+};
+
+static double now_seconds(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The batch is built in the queue's own buffer, so sending copies nothing. */
+static int flush_batch(struct frame_batch *batch, void *arg) {
+   struct send_stats *stats = arg;
+   if (queue_send(stats->q, stats->type, batch->data, batch->used) == -1) {
+      perror("queue_send");
+      return -1;
+   }
+   stats->messages++;
+   stats->bytes += batch->used;
+   batch->used = 0;
+   batch->records = 0;
+   return 0;
+}
+
+int main(int argc, char *argv[]) {
    struct my_msgbuf buf;
-   int msqid;
+   struct queue q;
+   int backend = QUEUE_SYSV;
+   const char *name = NULL;
    int len;
-   key_t key;
-   system("touch msgq.txt");
- 
-   if ((msqid = msgget(MSG_KEY, PERMS | IPC_CREAT)) == -1) {
-      perror("msgget");
+   int batched = 0;
+   size_t batchBytes = 0;
+   long lines = 0, lineBytes = 0;
+   struct send_stats stats = {&q, 1, 0, 0};
+   int c;
+
+   while ((c = getopt(argc, argv, "B:n:t:bs:")) != -1) {
+      if (c == 'B' && (backend = queue_backend(optarg)) >= 0) {
+         continue;
+      } else if (c == 'n') {
+         name = optarg;
+      } else if (c == 't' && (stats.type = strtol(optarg, NULL, 10)) > 0) {
+         continue;
+      } else if (c == 'b') {
+         batched = 1;
+      } else if (c == 's') {
+         batchBytes = strtoul(optarg, NULL, 10);
+      } else {
+         fprintf(stderr, "Usage: %s [-B sysv|posix|shm] [-n name] [-t type] [-b] [-s batch-bytes]\n", argv[0]);
+         exit(1);
+      }
+   }
+
+   if (queue_attach(&q, backend, name, QUEUE_PRODUCER) == -1) {
+      perror("queue_attach");
+      exit(1);
+   }
+   /* Receivers keep going until every open stream has ended. */
+   if (queue_open_stream(&q, stats.type) == -1) {
+      perror("queue_open_stream");
+      queue_detach(&q);
       exit(1);
    }
+   if (batchBytes == 0 || batchBytes > q.msgmax)
+      batchBytes = q.msgmax;
+   if (batchBytes < FRAME_MIN_ROOM + FRAME_HEADER)
+      batchBytes = FRAME_MIN_ROOM + FRAME_HEADER;
    printf("message queue: ready to send messages.\n");
    printf("Enter lines of text, ^D to quit:\n");
-   buf.mtype = 1; /* we don't really care in this case */
-   
-   while(fgets(buf.mtext, sizeof buf.mtext, stdin) != NULL) {
-      len = strlen(buf.mtext);
-      /* remove newline at end, if it exists */
-      if (buf.mtext[len-1] == '\n') buf.mtext[len-1] = '\0';
-      if (msgsnd(msqid, &buf, len+1, 0) == -1) /* +1 for '\0' */
-      perror("msgsnd");
+   buf.mtype = stats.type; /* receivers may pull only their own types */
+   double start = now_seconds();
+
+   if (batched) {
+      struct frame_batch batch = {queue_buffer(&q), batchBytes, 0, 0};
+      char *line = NULL;
+      size_t lineCap = 0;
+      ssize_t n;
+      while ((n = getline(&line, &lineCap, stdin)) != -1) {
+         if (n > 0 && line[n-1] == '\n') n--;
+         if (frame_append(&batch, line, n, flush_batch, &stats) != 0)
+            exit(1);
+         lines++;
+         lineBytes += n;
+      }
+      if (batch.used > 0 && flush_batch(&batch, &stats) != 0)
+         exit(1);
+      free(line);
+   } else {
+      while(fgets(buf.mtext, sizeof buf.mtext, stdin) != NULL) {
+         len = strlen(buf.mtext);
+         /* remove newline at end, if it exists */
+         if (buf.mtext[len-1] == '\n') buf.mtext[len-1] = '\0';
+         if (queue_send(&q, buf.mtype, buf.mtext, len+1) == -1) /* +1 for '\0' */
+         perror("queue_send");
+         lines++;
+         lineBytes += strlen(buf.mtext);
+         stats.messages++;
+         stats.bytes += len + 1;
+      }
    }
-   strcpy(buf.mtext, "end");
-   len = strlen(buf.mtext);
-   if (msgsnd(msqid, &buf, len+1, 0) == -1) /* +1 for '\0' */
-   perror("msgsnd");
-   
-   if (msgctl(msqid, IPC_RMID, NULL) == -1) {
-      perror("msgctl");
+   if (queue_send_eof(&q, stats.type) == -1)
+      perror("queue_send_eof");
+   double elapsed = now_seconds() - start;
+
+   /* Whoever leaves last, with nothing left to read, removes the queue. */
+   if (queue_detach(&q) == -1) {
+      perror("queue_detach");
       exit(1);
    }
    printf("message queue: done sending messages.\n");
+   printf("sent %ld lines (%ld bytes) in %ld %s sends, %.3f s: %.0f lines/s, %.1f MB/s\n",
+          lines, lineBytes, stats.messages, q.ops->name, elapsed, elapsed > 0 ? lines / elapsed : 0.0,
+          elapsed > 0 ? lineBytes / elapsed / 1e6 : 0.0);
    return 0;
-}
\ No newline at end of file
+}
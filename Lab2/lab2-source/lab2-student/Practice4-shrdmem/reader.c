@@ -1,39 +1,125 @@
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "../../../include/shm_segment.h"
+#include "../../../include/spsc_ring.h"
+#include "../../../include/broadcast.h"
 
 /*
- * Reader.c using the pre-shared key SHM_KEY 0x123
+ * Reader.c taking the messages writer streams through the ring
  *
+ * Usage: reader [-q] [-b [-l]] name
+ * Every message is printed unless -q is given; the count and rate are
+ * printed once the writer closes the ring.
+ *
+ * -b follows a "writer -b" broadcast from the oldest record it still holds.
+ * Any number of readers can do so at once; a reader that falls behind
+ * reports how many records it missed and carries on. -l only prints the
+ * newest record and exits.
  */
 
-#define SHM_KEY 0x123
+#define MSG_MAX 4096
+#define ATTACH_TRIES 50000 /* 100 us apart, 5 s for a writer that is still setting up */
+
+static long follow(Broadcast *b, char *msg, int quiet, BroadcastCursor *cursor) {
+  long count = 0, len;
+
+  broadcast_cursor_init(b, cursor, 0);
+  while ((len = broadcast_read(b, cursor, msg, MSG_MAX - 1)) != BROADCAST_CLOSED) {
+    if (len == BROADCAST_EMPTY) {
+      broadcast_wait(b, cursor);
+    } else if (len == BROADCAST_OVERRUN) {
+      if (!quiet)
+        printf("overrun: %llu records missed so far\n", (unsigned long long) cursor->missed);
+    } else {
+      msg[len < MSG_MAX - 1 ? len : MSG_MAX - 1] = '\0';
+      if (!quiet)
+        printf("record %llu:  %s", (unsigned long long) cursor->next - 1, msg);
+      count++;
+    }
+  }
+  return count;
+}
 
 int main(int argc, char * argv[]) {
-  int shmid;
-  char * shm;
-  shmid = shmget(SHM_KEY, 1000, 0644 | IPC_CREAT);
-  if (shmid < 0) {
-    perror("shmget");
+  ShmSegment seg;
+  char msg[MSG_MAX];
+  int quiet = 0, broadcast = 0, latest = 0;
+  long count = 0, len;
+  struct timespec start, end;
+  int c;
+
+  while ((c = getopt(argc, argv, "qbl")) != -1) {
+    if (c == 'q') {
+      quiet = 1;
+    } else if (c == 'b') {
+      broadcast = 1;
+    } else if (c == 'l') {
+      latest = 1;
+    } else {
+      optind = argc;
+      break;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-q] [-b [-l]] name\n", argv[0]);
+    return 1;
+  }
+  if (shm_segment_open(&seg, argv[optind], 0) != 0) {
+    perror("shm_open");
     return 1;
   } else {
-    printf("shared memory ID:  %d\n", shmid);
+    printf("shared memory name:  %s\n", seg.name);
   }
-  shm = (char * ) shmat(shmid, 0, 0);
-  if (shm == (char * )- 1) {
-    perror("shmat");
-    exit(1);
+  printf("shared memory mm:  %p\n", seg.addr);
+
+  /* The writer may still be setting the segment up. */
+  for (int tries = 0; !(broadcast ? broadcast_valid((Broadcast *) seg.addr, seg.size)
+                                  : spsc_ring_valid((SpscRing *) seg.addr, seg.size)); tries++) {
+    if (tries == ATTACH_TRIES) {
+      fprintf(stderr, "%s is not a %s segment\n", argv[optind], broadcast ? "broadcast" : "ring");
+      return 1;
+    }
+    usleep(100);
   }
-  printf("shared memory mm:  %p\n", shm);
-  if (shm != 0) {
-    printf("shared memory content:  %s\n", shm);
+
+  if (broadcast) {
+    Broadcast *b = (Broadcast *) seg.addr;
+    BroadcastCursor cursor;
+    uint64_t n;
+    if (latest) {
+      if ((len = broadcast_latest(b, msg, MSG_MAX - 1, &n)) >= 0) {
+        msg[len < MSG_MAX - 1 ? len : MSG_MAX - 1] = '\0';
+        printf("record %llu:  %s", (unsigned long long) n, msg);
+      }
+      shm_segment_close(&seg);
+      return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    count = follow(b, msg, quiet, &cursor);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("received %ld records in %.3f s, missed %llu, discarded %llu torn copies\n", count,
+           elapsed, (unsigned long long) cursor.missed, (unsigned long long) cursor.torn);
+    shm_segment_close(&seg);
+    return 0;
   }
-  sleep(10);
-  if (shmdt(shm) == -1) {
-    perror("shmdt");
-    return 1;
+
+  SpscRing *ring = (SpscRing *) seg.addr;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while ((len = spsc_ring_pop(ring, msg, sizeof(msg) - 1)) >= 0) {
+    msg[len < MSG_MAX - 1 ? len : MSG_MAX - 1] = '\0';
+    if (!quiet)
+      printf("shared memory content:  %s", msg);
+    count++;
   }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("received %ld messages in %.3f s (%.0f msgs/s), reader slept %llu times\n", count,
+         elapsed, elapsed > 0 ? count / elapsed : 0.0, (unsigned long long) ring->consumerWaits);
+  shm_segment_close(&seg);
   return 0;
 }
@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "../../../include/shm_segment.h"
+#include "../../../include/spsc_ring.h"
+
+/*
+ * Throughput and latency of the shared-memory ring between two processes
+ *
+ * Usage: ring_bench [-n messages] [-s payload-bytes] [-c ring-bytes]
+ * The parent produces, a forked child consumes. Every message carries a
+ * sequence number the child checks; every LATENCY_STRIDE-th message also
+ * carries its send time, which gives the one-way latency percentiles.
+ * The sleep counts show how often either side had to enter the kernel.
+ */
+
+#define LATENCY_STRIDE 64
+
+typedef struct {
+  uint64_t seq;
+  uint64_t sentNs; /* 0 when not sampled */
+} MsgHeader;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static int consume(SpscRing *ring, long messages, size_t payload, uint64_t startNs) {
+  char *msg = malloc(payload);
+  uint64_t *samples = malloc((messages / LATENCY_STRIDE + 1) * sizeof(uint64_t));
+  long received = 0, nsamples = 0, len;
+  if (msg == NULL || samples == NULL) {
+    perror("malloc");
+    return 1;
+  }
+
+  while ((len = spsc_ring_pop(ring, msg, payload)) >= 0) {
+    MsgHeader header;
+    memcpy(&header, msg, sizeof(header));
+    if ((size_t) len != payload || header.seq != (uint64_t) received) {
+      fprintf(stderr, "message %ld: got seq %llu, length %ld\n", received,
+              (unsigned long long) header.seq, len);
+      return 1;
+    }
+    if (header.sentNs != 0)
+      samples[nsamples++] = now_ns() - header.sentNs;
+    received++;
+  }
+  double elapsed = (now_ns() - startNs) / 1e9;
+
+  qsort(samples, nsamples, sizeof(uint64_t), compare_u64);
+  printf("%ld messages of %zu bytes in %.3f s: %.0f msgs/s, %.1f MB/s\n", received, payload,
+         elapsed, received / elapsed, received * (double) payload / elapsed / 1e6);
+  if (nsamples > 0)
+    printf("latency ns: p50 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+           (unsigned long long) samples[nsamples / 2],
+           (unsigned long long) samples[nsamples * 99 / 100],
+           (unsigned long long) samples[nsamples * 999 / 1000],
+           (unsigned long long) samples[nsamples - 1]);
+  printf("consumer slept %llu times\n", (unsigned long long) ring->consumerWaits);
+  free(msg);
+  free(samples);
+  return 0;
+}
+
+int main(int argc, char * argv[]) {
+  long messages = 10000000;
+  size_t payload = sizeof(MsgHeader);
+  size_t capacity = 1 << 20;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:s:c:")) != -1) {
+    switch (c) {
+    case 'n':
+      messages = strtol(optarg, NULL, 10);
+      break;
+    case 's':
+      payload = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      capacity = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n messages] [-s payload-bytes] [-c ring-bytes]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (payload < sizeof(MsgHeader))
+    payload = sizeof(MsgHeader);
+  if (capacity < 64 || (capacity & (capacity - 1)) != 0 || payload > capacity / 2 - sizeof(uint32_t)) {
+    fprintf(stderr, "ring bytes must be a power of two holding two messages\n");
+    return 1;
+  }
+
+  ShmSegment seg;
+  if (shm_segment_create(&seg, NULL, spsc_ring_bytes(capacity), SHM_SEG_HUGE) != 0) {
+    perror("Shared-memory");
+    return 1;
+  }
+  SpscRing *ring = (SpscRing *) seg.addr;
+  spsc_ring_init(ring, capacity);
+
+  uint64_t startNs = now_ns();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0)
+    exit(consume(ring, messages, payload, startNs));
+
+  char *msg = calloc(1, payload);
+  if (msg == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  for (long i = 0; i < messages; i++) {
+    MsgHeader header = {(uint64_t) i, i % LATENCY_STRIDE == 0 ? now_ns() : 0};
+    memcpy(msg, &header, sizeof(header));
+    spsc_ring_push(ring, msg, payload);
+  }
+  spsc_ring_close(ring);
+
+  int status;
+  waitpid(pid, &status, 0);
+  printf("producer slept %llu times\n", (unsigned long long) ring->producerWaits);
+  free(msg);
+  shm_segment_close(&seg);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
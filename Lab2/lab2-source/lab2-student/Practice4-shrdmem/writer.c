@@ -1,47 +1,117 @@
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include "../../../include/shm_segment.h"
+#include "../../../include/spsc_ring.h"
+#include "../../../include/broadcast.h"
 
 /*
- * Writer.c using the pre-shared key SHM_KEY 0x123
+ * Writer.c streaming messages to reader through a ring in a POSIX
+ * shared-memory segment with a unique name
  *
+ * Usage: writer [-n count] [-b] [-i usec] [name]
+ * Without a name one is made up as "/shrdmem-<pid>-0" and printed, pass it
+ * to reader. The writer sends "hello  world" count times (default once),
+ * closes the ring and waits until the reader has taken every message, so
+ * neither side depends on sleeping. The segment is unlinked on exit, also
+ * on Ctrl-C, and segments left by writers that were killed outright are
+ * removed on the next start.
+ *
+ * -b broadcasts numbered records to any number of "reader -b" processes
+ * instead, pausing usec microseconds between records (-i, default 0).
+ * Readers that fall behind are told how many records they missed; the
+ * writer never waits for them.
  */
 
-#define SHM_KEY 0x123
+#define SHM_PREFIX "shrdmem"
+#define RING_CAPACITY (1 << 16)
+#define BROADCAST_SLOTS 1024
+#define BROADCAST_PAYLOAD 256
+
+static int stream(SpscRing *ring, long count) {
+  const char *msg = "hello  world\n";
+
+  for (long i = 0; i < count; i++) {
+    if (spsc_ring_push(ring, msg, strlen(msg) + 1) < 0) {
+      perror("spsc_ring_push");
+      return 1;
+    }
+  }
+  spsc_ring_close(ring);
+  spsc_ring_drain(ring);
+  printf("sent %ld messages, writer slept %llu times\n", count,
+         (unsigned long long) ring->producerWaits);
+  return 0;
+}
+
+static int publish(Broadcast *b, long count, long interval) {
+  char msg[BROADCAST_PAYLOAD];
+
+  for (long i = 1; i <= count; i++) {
+    int len = snprintf(msg, sizeof(msg), "hello  world %ld\n", i);
+    broadcast_publish(b, msg, len + 1);
+    if (interval > 0)
+      usleep(interval);
+  }
+  broadcast_close(b);
+  printf("published %ld records\n", count);
+  return 0;
+}
 
 int main(int argc, char * argv[]) {
-  int shmid;
-  char *shm;
-  shmid = shmget(SHM_KEY, 1000, 0644 | IPC_CREAT);
-  if (shmid < 0) {
+  ShmSegment seg;
+  char name[SHM_NAME_MAX];
+  long count = 1, interval = 0;
+  int broadcast = 0, rc;
+  size_t size;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:bi:")) != -1) {
+    if (c == 'n') {
+      count = strtol(optarg, NULL, 10);
+    } else if (c == 'b') {
+      broadcast = 1;
+    } else if (c == 'i') {
+      interval = strtol(optarg, NULL, 10);
+    } else {
+      fprintf(stderr, "Usage: %s [-n count] [-b] [-i usec] [name]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  shm_segment_reap(SHM_PREFIX);
+  if (optind < argc)
+    snprintf(name, sizeof(name), "%s", argv[optind]);
+  else
+    shm_segment_unique_name(name, sizeof(name), SHM_PREFIX);
+
+  size = broadcast ? broadcast_bytes(BROADCAST_SLOTS, BROADCAST_PAYLOAD) : spsc_ring_bytes(RING_CAPACITY);
+  if (shm_segment_create(&seg, name, size, SHM_SEG_CLEANUP) != 0) {
     perror("Shared-memory");
     return 1;
+  }
+  // Set the segment up before anyone can learn its name.
+  if (broadcast)
+    broadcast_init((Broadcast *) seg.addr, BROADCAST_SLOTS, BROADCAST_PAYLOAD);
+  else
+    spsc_ring_init((SpscRing *) seg.addr, RING_CAPACITY);
+  printf("Shared-memory name:  %s\n", seg.name);
+  fflush(stdout);
+  printf("shared memory mm:  %p\n", seg.addr);
+  if (broadcast) {
+    rc = publish((Broadcast *) seg.addr, count, interval);
   } else {
-    printf("Shared-memory ID:  %d\n", shmid);
+    rc = stream((SpscRing *) seg.addr, count);
   }
-  shm = (char *) shmat(shmid, 0, 0);
+  if (rc != 0)
+    return rc;
 
-  if (shm == (char *) -1) {
-    perror("shmat");
-    exit(1);
-  }
-  printf("shared memory mm:  %p\n", shm);
-  sprintf(shm, "hello  world\n");
-  printf("shared memory content:  %s\n", shm);
-  sleep(10);
-
-  // detach from the shared memory
-  if (shmdt(shm) == -1) {
-    perror("shmdt");
-    return 1;
-  }
-  // Mark the shared segment to be destroyed .
-  if (shmctl(shmid, IPC_RMID, 0) == -1) {
-    perror("shmctl");
+  // Remove the name, then unmap; the reader keeps its mapping.
+  if (shm_segment_unlink(&seg) == -1) {
+    perror("shm_unlink");
     return 1;
   }
+  shm_segment_close(&seg);
   return 0;
 }
@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "include/shm_segment.h"
+#include "include/parallel_sum.h"
+#include "include/work_pool.h"
+
+/*
+ * Usage: parallel_compare [-W sum|ratings] [-w 1,2,4,8] [-r repeats]
+ *                         [-n range] [-f ratings-file]
+ *
+ * Runs the same work with three models of parallelism and prints what each
+ * costs:
+ *
+ *   fork    one forked process per worker, results in shared memory, as
+ *           problem-1.c does
+ *   thread  one pthread per worker, created and joined per run
+ *   pool    a work_pool.h pool of as many threads, created once; each
+ *           run hands it one task per worker share
+ *
+ * The workloads are the range sum of parallel_sum.h (1..n, default 1e9)
+ * and the rating aggregation of ex-4.1 (per-movie rating count and sum,
+ * default file ex-4.1/movie-100k.txt, so run it from Lab2). Without -W
+ * both run.
+ *
+ * Every mode runs in a fresh child process so its numbers start clean:
+ *
+ *   start   from asking for workers until the last one has begun, best run
+ *   wall    whole run including the merge, best of -r runs (default 5)
+ *   rss     peak resident set; for fork the sum over the processes, so
+ *           pages they share count once per process
+ *   vcsw    voluntary and involuntary context switches per run
+ *   ivcsw
+ *
+ * The merged result of every mode is checked against the first.
+ */
+
+#define RATING_ITEMS (1 << 16) /* movie ids at or above are skipped */
+#define MAX_WORKERS 256
+
+typedef enum
+{
+    MODE_FORK,
+    MODE_THREAD,
+    MODE_POOL,
+    MODES
+} Mode;
+
+static const char *modeNames[MODES] = {"fork", "thread", "pool"};
+
+typedef enum
+{
+    WORK_SUM,
+    WORK_RATINGS
+} Workload;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t sum;
+} RatingCell;
+
+/* Everything workers write; lives in shared memory so fork mode sees it. */
+typedef struct
+{
+    double started[MAX_WORKERS];
+    SumPartial partials[MAX_WORKERS];
+    long skipped[MAX_WORKERS];
+    RatingCell cells[]; /* RATING_ITEMS per worker */
+} Shared;
+
+typedef struct
+{
+    Workload work;
+    int workers;
+    uint64_t n;
+    const char *data; /* mapped ratings file */
+    size_t size;
+    Shared *shared;
+} Job;
+
+typedef struct
+{
+    double start;
+    double wall;
+    long rssKb;
+    double vcsw;
+    double ivcsw;
+    uint64_t check;
+    int failed;
+} ModeResult;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* First byte of the lines worker w owns: those starting in its share. */
+static size_t line_start(const Job *job, int w)
+{
+    size_t pos = job->size / job->workers * w;
+    if (w == job->workers)
+        return job->size; /* even when the shares round down to nothing */
+    if (w == 0 || pos == 0)
+        return 0;
+    while (pos < job->size && job->data[pos - 1] != '\n')
+        pos++;
+    return pos;
+}
+
+static inline const char *parse_field(const char *p, const char *end, uint32_t *value)
+{
+    uint32_t v = 0;
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    while (p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+    *value = v;
+    return p;
+}
+
+static void sum_ratings(const Job *job, int w)
+{
+    RatingCell *cells = job->shared->cells + (size_t)w * RATING_ITEMS;
+    const char *p = job->data + line_start(job, w);
+    const char *end = job->data + line_start(job, w + 1);
+    long skipped = 0;
+
+    memset(cells, 0, RATING_ITEMS * sizeof(RatingCell));
+    while (p < end)
+    {
+        uint32_t user, item, rating;
+        p = parse_field(p, end, &user);
+        p = parse_field(p, end, &item);
+        p = parse_field(p, end, &rating);
+        if (item < RATING_ITEMS && rating > 0)
+        {
+            cells[item].count++;
+            cells[item].sum += rating;
+        }
+        else
+            skipped++;
+        while (p < end && *p++ != '\n')
+            ;
+    }
+    job->shared->skipped[w] = skipped;
+}
+
+static void run_task(const Job *job, int w)
+{
+    job->shared->started[w] = now_seconds();
+    if (job->work == WORK_SUM)
+    {
+        SumPartial *p = &job->shared->partials[w];
+        uint64_t block = job->n / job->workers, extra = job->n % job->workers, uw = (uint64_t)w;
+        p->lo = 1 + block * uw + (uw < extra ? uw : extra);
+        p->hi = p->lo + block + (uw < extra);
+        p->sum = sum_range(p->lo, p->hi);
+    }
+    else
+        sum_ratings(job, w);
+}
+
+/* Folds the workers' results into one number to compare modes by. */
+static uint64_t merge(const Job *job)
+{
+    uint64_t check = 0;
+    if (job->work == WORK_SUM)
+    {
+        for (int w = 0; w < job->workers; w++)
+            check += job->shared->partials[w].sum;
+        return check;
+    }
+    for (size_t item = 0; item < RATING_ITEMS; item++)
+    {
+        uint64_t count = 0, sum = 0;
+        for (int w = 0; w < job->workers; w++)
+        {
+            count += job->shared->cells[w * RATING_ITEMS + item].count;
+            sum += job->shared->cells[w * RATING_ITEMS + item].sum;
+        }
+        check = check * 1000003 + count * 8 + sum;
+    }
+    return check;
+}
+
+/* pool mode: one work_pool_for index per worker share */
+static void pool_task(uint64_t lo, uint64_t hi, void *arg)
+{
+    for (uint64_t w = lo; w < hi; w++)
+        run_task(arg, (int)w);
+}
+
+/* ---- one run per mode ---- */
+
+typedef struct
+{
+    const Job *job;
+    int index;
+} ThreadArg;
+
+static void *thread_main(void *arg)
+{
+    ThreadArg *t = arg;
+    run_task(t->job, t->index);
+    return NULL;
+}
+
+/* Runs the job once; for fork mode adds the workers' peak RSS to *childRss. */
+static int run_once(Mode mode, const Job *job, WorkPool *pool, long *childRss)
+{
+    pid_t pids[MAX_WORKERS];
+    pthread_t tids[MAX_WORKERS];
+    ThreadArg args[MAX_WORKERS];
+    int failed = 0;
+
+    if (mode == MODE_FORK)
+    {
+        for (int w = 0; w < job->workers; w++)
+        {
+            if ((pids[w] = fork()) == 0)
+            {
+                run_task(job, w);
+                _exit(0);
+            }
+            failed |= pids[w] < 0;
+        }
+        for (int w = 0; w < job->workers; w++)
+        {
+            int status;
+            struct rusage ru;
+            if (pids[w] > 0 && wait4(pids[w], &status, 0, &ru) == pids[w])
+            {
+                *childRss += ru.ru_maxrss;
+                failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            }
+        }
+    }
+    else if (mode == MODE_THREAD)
+    {
+        int started;
+        for (started = 0; started < job->workers; started++)
+        {
+            args[started].job = job;
+            args[started].index = started;
+            if (pthread_create(&tids[started], NULL, thread_main, &args[started]) != 0)
+            {
+                failed = 1;
+                break;
+            }
+        }
+        for (int w = 0; w < started; w++)
+            pthread_join(tids[w], NULL);
+    }
+    else
+        work_pool_for(pool, 0, job->workers, 1, pool_task, (void *)job);
+    return failed;
+}
+
+static void measure(Mode mode, Job *job, int repeats, ModeResult *res)
+{
+    size_t bytes = sizeof(Shared) + (job->work == WORK_RATINGS ? (size_t)job->workers * RATING_ITEMS * sizeof(RatingCell) : 0);
+    ShmSegment seg;
+    WorkPool pool;
+    struct rusage before, after;
+    long peakChildRss = 0;
+
+    if (shm_segment_create(&seg, NULL, bytes, 0) != 0)
+    {
+        perror("shm_segment_create");
+        res->failed = 1;
+        return;
+    }
+    job->shared = seg.addr;
+    if (mode == MODE_POOL && work_pool_init(&pool, job->workers) != 0)
+    {
+        perror("work_pool_init");
+        res->failed = 1;
+        return;
+    }
+
+    getrusage(RUSAGE_SELF, &before);
+    struct rusage childBefore;
+    getrusage(RUSAGE_CHILDREN, &childBefore);
+    for (int r = 0; r < repeats && !res->failed; r++)
+    {
+        long childRss = 0;
+        double t0 = now_seconds();
+        res->failed |= run_once(mode, job, &pool, &childRss);
+        uint64_t check = merge(job);
+        double wall = now_seconds() - t0;
+
+        double lastStart = t0;
+        for (int w = 0; w < job->workers; w++)
+            if (job->shared->started[w] > lastStart)
+                lastStart = job->shared->started[w];
+        if (r == 0 || lastStart - t0 < res->start)
+            res->start = lastStart - t0;
+        if (r == 0 || wall < res->wall)
+            res->wall = wall;
+        if (childRss > peakChildRss)
+            peakChildRss = childRss;
+        res->check = check;
+    }
+    getrusage(RUSAGE_SELF, &after);
+    res->vcsw = after.ru_nvcsw - before.ru_nvcsw;
+    res->ivcsw = after.ru_nivcsw - before.ru_nivcsw;
+    if (mode == MODE_FORK)
+    {
+        struct rusage children;
+        getrusage(RUSAGE_CHILDREN, &children);
+        res->vcsw += children.ru_nvcsw - childBefore.ru_nvcsw;
+        res->ivcsw += children.ru_nivcsw - childBefore.ru_nivcsw;
+    }
+    res->vcsw /= repeats;
+    res->ivcsw /= repeats;
+    res->rssKb = after.ru_maxrss + peakChildRss;
+
+    if (mode == MODE_POOL)
+        work_pool_destroy(&pool);
+    shm_segment_close(&seg);
+}
+
+static int map_file(const char *path, Job *job)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        return -1;
+    }
+    job->size = st.st_size;
+    job->data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (job->data == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    return 0;
+}
+
+static int compare(Workload work, const char *counts, int repeats, uint64_t n, const char *path)
+{
+    ShmSegment resultSeg;
+    int failed = 0;
+
+    if (shm_segment_create(&resultSeg, NULL, sizeof(ModeResult), 0) != 0)
+    {
+        perror("shm_segment_create");
+        return 1;
+    }
+    ModeResult *res = resultSeg.addr;
+
+    if (work == WORK_SUM)
+        printf("range sum of 1..%llu, best of %d\n", (unsigned long long)n, repeats);
+    else
+        printf("rating aggregation of %s, best of %d\n", path, repeats);
+    printf("mode    workers  start (us)   wall (ms)   rss (KB)   vcsw/run  ivcsw/run\n");
+
+    for (const char *p = counts; *p != '\0';)
+    {
+        char *next;
+        int workers = strtol(p, &next, 10);
+        if (workers < 1 || workers > MAX_WORKERS || next == p)
+        {
+            fprintf(stderr, "worker counts must be 1..%d\n", MAX_WORKERS);
+            return 1;
+        }
+        p = *next == ',' ? next + 1 : next;
+
+        uint64_t expect = 0;
+        for (int mode = 0; mode < MODES; mode++)
+        {
+            memset(res, 0, sizeof(*res));
+            fflush(stdout); /* or the child prints our buffered lines again */
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                Job job = {work, workers, n, NULL, 0, NULL};
+                if (work == WORK_RATINGS && map_file(path, &job) != 0)
+                    res->failed = 1;
+                else
+                    measure(mode, &job, repeats, res);
+                _exit(0);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+            if (res->failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "%s with %d workers failed\n", modeNames[mode], workers);
+                failed = 1;
+                continue;
+            }
+            if (mode == 0)
+                expect = res->check;
+            printf("%-7s %7d %11.1f %11.3f %10ld %10.1f %10.1f%s\n", modeNames[mode], workers, res->start * 1e6,
+                   res->wall * 1e3, res->rssKb, res->vcsw, res->ivcsw, res->check == expect ? "" : "  MISMATCH");
+            failed |= res->check != expect;
+        }
+    }
+    shm_segment_close(&resultSeg);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *counts = "1,2,4,8";
+    const char *path = "ex-4.1/movie-100k.txt";
+    uint64_t n = 1000000000ULL;
+    int repeats = 5;
+    int sum = 1, ratings = 1;
+    int failed = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "W:w:r:n:f:")) != -1)
+    {
+        if (c == 'W' && (strcmp(optarg, "sum") == 0 || strcmp(optarg, "ratings") == 0))
+        {
+            sum = optarg[0] == 's';
+            ratings = !sum;
+        }
+        else if (c == 'w')
+            counts = optarg;
+        else if (c == 'r' && (repeats = atoi(optarg)) > 0)
+            continue;
+        else if (c == 'n')
+            n = strtoull(optarg, NULL, 10);
+        else if (c == 'f')
+            path = optarg;
+        else
+        {
+            fprintf(stderr, "Usage: %s [-W sum|ratings] [-w 1,2,4,8] [-r repeats] [-n range] [-f ratings-file]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+
+    if (sum)
+        failed |= compare(WORK_SUM, counts, repeats, n, path);
+    if (sum && ratings)
+        printf("\n");
+    if (ratings)
+        failed |= compare(WORK_RATINGS, counts, repeats, n, path);
+    return failed;
+}
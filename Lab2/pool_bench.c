@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "include/work_pool.h"
+
+/*
+ * Usage: pool_bench [-t threads] [-n tasks] [-m items] [-s skew]
+ *
+ * Measures include/work_pool.h in two parts.
+ *
+ * Spawn overhead, per task of -n (default 100000) empty tasks:
+ *   pthread     pthread_create and pthread_join per task
+ *   submit      work_pool_submit and work_future_get from outside the pool
+ *   nested      the same from inside a task, through the worker's deque
+ *   for         work_pool_for with a grain of 1
+ *
+ * Load balance over -m items (default 4096) where the first sixteenth of
+ * the items cost -s times (default 64) as much as the rest, the way a few
+ * popular movies dominate a rating file:
+ *   static      one block of items per thread, like parallel_sum
+ *   pool        work_pool_for with a grain of 16 items
+ * Each prints the wall time, the busiest thread's share of the work
+ * against a fair share (1.00 is perfect) and the number of steals.
+ *
+ * Threads default to the online CPUs, at least 4 so there is something
+ * to balance.
+ */
+
+#define ITEM_SPINS 2000 /* loop iterations of a light item */
+#define POOL_GRAIN 16
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *empty_task(void *arg)
+{
+    return arg;
+}
+
+static void empty_range(uint64_t lo, uint64_t hi, void *arg)
+{
+    (void)lo;
+    (void)hi;
+    (void)arg;
+}
+
+typedef struct
+{
+    WorkPool *pool;
+    long tasks;
+    WorkFuture **futures;
+} NestedJob;
+
+static void *nested_task(void *arg)
+{
+    NestedJob *job = arg;
+    for (long i = 0; i < job->tasks; i++)
+        job->futures[i] = work_pool_submit(job->pool, empty_task, NULL);
+    for (long i = 0; i < job->tasks; i++)
+        work_future_get(job->pool, job->futures[i]);
+    return NULL;
+}
+
+static void spawn_overhead(WorkPool *pool, long tasks)
+{
+    WorkFuture **futures = malloc(tasks * sizeof(WorkFuture *));
+    if (futures == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+
+    double start = now_seconds();
+    for (long i = 0; i < tasks; i++)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, empty_task, NULL) != 0)
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+        pthread_join(tid, NULL);
+    }
+    double pthreadNs = (now_seconds() - start) / tasks * 1e9;
+
+    start = now_seconds();
+    for (long i = 0; i < tasks; i++)
+        if ((futures[i] = work_pool_submit(pool, empty_task, NULL)) == NULL)
+        {
+            perror("work_pool_submit");
+            exit(1);
+        }
+    for (long i = 0; i < tasks; i++)
+        work_future_get(pool, futures[i]);
+    double submitNs = (now_seconds() - start) / tasks * 1e9;
+
+    NestedJob job = {pool, tasks, futures};
+    start = now_seconds();
+    work_future_get(pool, work_pool_submit(pool, nested_task, &job));
+    double nestedNs = (now_seconds() - start) / tasks * 1e9;
+
+    start = now_seconds();
+    work_pool_for(pool, 0, tasks, 1, empty_range, NULL);
+    double forNs = (now_seconds() - start) / tasks * 1e9;
+
+    printf("spawn overhead, %ld empty tasks, ns per task\n", tasks);
+    printf("  pthread %10.0f\n  submit  %10.0f\n  nested  %10.0f\n  for     %10.0f\n", pthreadNs, submitNs,
+           nestedNs, forNs);
+    free(futures);
+}
+
+typedef struct
+{
+    long items;
+    int skew;
+    int threads;
+    WorkPool *pool;
+    _Alignas(64) double busy[WORK_MAX_WORKERS + 1][8]; /* seconds per thread, a cache line each */
+    uint64_t sink;
+} SkewJob;
+
+static void run_items(SkewJob *job, uint64_t lo, uint64_t hi)
+{
+    uint64_t x = 0;
+    for (uint64_t i = lo; i < hi; i++)
+    {
+        long spins = ITEM_SPINS * ((long)i < job->items / 16 ? job->skew : 1);
+        for (long s = 0; s < spins; s++)
+            x = x * 6364136223846793005ULL + i;
+    }
+    __atomic_store_n(&job->sink, x, __ATOMIC_RELAXED); /* keeps the loop */
+}
+
+static void pool_items(uint64_t lo, uint64_t hi, void *arg)
+{
+    SkewJob *job = arg;
+    int w = work_pool_worker_index(job->pool);
+    double start = now_seconds();
+    run_items(job, lo, hi);
+    job->busy[w >= 0 ? w : job->threads][0] += now_seconds() - start;
+}
+
+typedef struct
+{
+    SkewJob *job;
+    int index;
+} StaticArg;
+
+static void *static_items(void *arg)
+{
+    StaticArg *a = arg;
+    SkewJob *job = a->job;
+    uint64_t lo = job->items * a->index / job->threads, hi = job->items * (a->index + 1) / job->threads;
+    double start = now_seconds();
+    run_items(job, lo, hi);
+    job->busy[a->index][0] = now_seconds() - start;
+    return NULL;
+}
+
+static void print_balance(const char *name, SkewJob *job, double wall, uint64_t steals)
+{
+    double total = 0, most = 0;
+    for (int t = 0; t <= job->threads; t++)
+    {
+        total += job->busy[t][0];
+        if (job->busy[t][0] > most)
+            most = job->busy[t][0];
+    }
+    printf("  %-7s %9.3f ms  busiest %.2f  steals %llu\n", name, wall * 1e3,
+           total > 0 ? most / (total / job->threads) : 0.0, (unsigned long long)steals);
+}
+
+static void load_balance(WorkPool *pool, int threads, long items, int skew)
+{
+    SkewJob *job = aligned_alloc(64, sizeof(SkewJob));
+    pthread_t tids[WORK_MAX_WORKERS];
+    StaticArg args[WORK_MAX_WORKERS];
+    if (job == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    memset(job, 0, sizeof(*job));
+    job->items = items;
+    job->skew = skew;
+    job->threads = threads;
+    job->pool = pool;
+
+    printf("load balance, %ld items, first 1/16 %dx heavier, %d threads\n", items, skew, threads);
+    double start = now_seconds();
+    for (int t = 0; t < threads; t++)
+    {
+        args[t].job = job;
+        args[t].index = t;
+        if (pthread_create(&tids[t], NULL, static_items, &args[t]) != 0)
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (int t = 0; t < threads; t++)
+        pthread_join(tids[t], NULL);
+    print_balance("static", job, now_seconds() - start, 0);
+
+    uint64_t stealsBefore = 0, stealsAfter = 0;
+    for (int w = 0; w < pool->workers; w++)
+        stealsBefore += __atomic_load_n(&pool->deques[w].steals, __ATOMIC_RELAXED);
+    memset(job->busy, 0, sizeof(job->busy));
+    start = now_seconds();
+    work_pool_for(pool, 0, items, POOL_GRAIN, pool_items, job);
+    double wall = now_seconds() - start;
+    for (int w = 0; w < pool->workers; w++)
+        stealsAfter += __atomic_load_n(&pool->deques[w].steals, __ATOMIC_RELAXED);
+    print_balance("pool", job, wall, stealsAfter - stealsBefore);
+    free(job);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    long tasks = 100000, items = 4096;
+    int skew = 64;
+    WorkPool pool;
+    int c;
+
+    if (threads < 4)
+        threads = 4;
+    while ((c = getopt(argc, argv, "t:n:m:s:")) != -1)
+    {
+        if (c == 't')
+            threads = atoi(optarg);
+        else if (c == 'n')
+            tasks = strtol(optarg, NULL, 10);
+        else if (c == 'm')
+            items = strtol(optarg, NULL, 10);
+        else if (c == 's')
+            skew = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-t threads] [-n tasks] [-m items] [-s skew]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (threads < 1 || threads > WORK_MAX_WORKERS || tasks < 1 || items < 1 || skew < 1)
+    {
+        fprintf(stderr, "Usage: %s [-t threads] [-n tasks] [-m items] [-s skew]\n", argv[0]);
+        exit(1);
+    }
+
+    if (work_pool_init(&pool, threads) != 0)
+    {
+        perror("work_pool_init");
+        exit(1);
+    }
+    spawn_overhead(&pool, tasks);
+    load_balance(&pool, threads, items, skew);
+    work_pool_destroy(&pool);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "include/parallel_sum.h"
+
+/*
+ * Usage: sum_bench [-a] [-t max-threads] [-r repeats] n
+ * Times the serial sum of 1..n, then the parallel sum with 1, 2, 3, ...
+ * max-threads threads (default: the online CPUs), and prints the best of
+ * -r runs (default 5) with speedup = serial time / parallel time and
+ * efficiency = speedup / threads. The last columns time the same sum on a
+ * work-stealing pool of as many threads, started outside the clock. -a
+ * sums an array instead of the range.
+ */
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int useArray = 0;
+    int maxThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int repeats = 5;
+    uint64_t *array = NULL;
+    uint64_t n, expect, sum = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "at:r:")) != -1)
+    {
+        if (c == 'a')
+            useArray = 1;
+        else if (c == 't')
+            maxThreads = atoi(optarg);
+        else if (c == 'r')
+            repeats = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-a] [-t max-threads] [-r repeats] n\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind != argc - 1 || maxThreads < 1 || repeats < 1)
+    {
+        fprintf(stderr, "Usage: %s [-a] [-t max-threads] [-r repeats] n\n", argv[0]);
+        exit(1);
+    }
+    n = strtoull(argv[optind], NULL, 10);
+    if (maxThreads > SUM_MAX_THREADS)
+        maxThreads = SUM_MAX_THREADS;
+
+    if (useArray)
+    {
+        if ((array = malloc(n * sizeof(uint64_t) + 1)) == NULL)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        for (uint64_t i = 0; i < n; i++)
+            array[i] = i + 1;
+    }
+    /* n(n+1)/2 without overflowing before the division */
+    expect = n % 2 == 0 ? n / 2 * (n + 1) : (n + 1) / 2 * n;
+
+    double serial = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        double start = now_seconds();
+        sum = useArray ? sum_array(array, n) : sum_range(1, n + 1);
+        double elapsed = now_seconds() - start;
+        if (r == 0 || elapsed < serial)
+            serial = elapsed;
+    }
+    if (sum != expect)
+    {
+        fprintf(stderr, "serial sum %llu, expected %llu\n", (unsigned long long)sum, (unsigned long long)expect);
+        exit(1);
+    }
+
+    printf("sum of 1..%llu (%s), best of %d, %ld CPUs online\n", (unsigned long long)n,
+           useArray ? "array" : "range", repeats, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("threads    seconds  speedup  efficiency   pool-sec  pool-speedup\n");
+    printf("serial  %10.6f\n", serial);
+    for (int threads = 1; threads <= maxThreads; threads++)
+    {
+        double best[2] = {0, 0};
+        WorkPool pool;
+        if (work_pool_init(&pool, threads) != 0)
+        {
+            perror("work_pool_init");
+            exit(1);
+        }
+        for (int usePool = 0; usePool < 2; usePool++)
+            for (int r = 0; r < repeats; r++)
+            {
+                double start = now_seconds();
+                int rc;
+                if (usePool)
+                    rc = useArray ? parallel_sum_pool(&pool, array, 0, n, &sum)
+                                  : parallel_sum_pool(&pool, NULL, 1, n + 1, &sum);
+                else
+                    rc = useArray ? parallel_sum_array(array, n, threads, &sum)
+                                  : parallel_sum_range(1, n + 1, threads, &sum);
+                double elapsed = now_seconds() - start;
+                if (rc != 0)
+                {
+                    perror(usePool ? "parallel_sum_pool" : "pthread_create");
+                    exit(1);
+                }
+                if (sum != expect)
+                {
+                    fprintf(stderr, "%d threads%s: sum %llu, expected %llu\n", threads, usePool ? " (pool)" : "",
+                            (unsigned long long)sum, (unsigned long long)expect);
+                    exit(1);
+                }
+                if (r == 0 || elapsed < best[usePool])
+                    best[usePool] = elapsed;
+            }
+        work_pool_destroy(&pool);
+        printf("%7d %10.6f %8.2f %11.2f %10.6f %13.2f\n", threads, best[0], serial / best[0],
+               serial / best[0] / threads, best[1], serial / best[1]);
+    }
+    free(array);
+    return 0;
+}
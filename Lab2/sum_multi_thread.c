@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "include/parallel_sum.h"
+
+/*
+ * Usage: sum_multi_thread [-a] [-p] threads n
+ * Prints 1 + 2 + ... + n like sum_serial, with the range (or, with -a, an
+ * array holding 1..n) split over the given number of threads. -p runs it
+ * on a work-stealing pool of that many threads instead of one block per
+ * thread; the pool is started before the clock starts.
+ */
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int useArray = 0, usePool = 0;
+    WorkPool pool;
+    uint64_t *array = NULL;
+    uint64_t n, sum;
+    int threads;
+    int c;
+
+    while ((c = getopt(argc, argv, "ap")) != -1)
+    {
+        if (c == 'a')
+            useArray = 1;
+        else if (c == 'p')
+            usePool = 1;
+        else
+        {
+            fprintf(stderr, "Usage: %s [-a] [-p] threads n\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind != argc - 2 || (threads = atoi(argv[optind])) < 1)
+    {
+        fprintf(stderr, "Usage: %s [-a] [-p] threads n\n", argv[0]);
+        exit(1);
+    }
+    n = strtoull(argv[optind + 1], NULL, 10);
+
+    if (useArray)
+    {
+        if ((array = malloc(n * sizeof(uint64_t) + 1)) == NULL)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        for (uint64_t i = 0; i < n; i++)
+            array[i] = i + 1;
+    }
+
+    if (usePool && work_pool_init(&pool, threads) != 0)
+    {
+        perror("work_pool_init");
+        exit(1);
+    }
+
+    double start = now_seconds();
+    int rc;
+    if (usePool)
+        rc = useArray ? parallel_sum_pool(&pool, array, 0, n, &sum) : parallel_sum_pool(&pool, NULL, 1, n + 1, &sum);
+    else
+        rc = useArray ? parallel_sum_array(array, n, threads, &sum) : parallel_sum_range(1, n + 1, threads, &sum);
+    double elapsed = now_seconds() - start;
+    if (rc != 0)
+    {
+        perror(usePool ? "parallel_sum_pool" : "pthread_create");
+        exit(1);
+    }
+
+    printf("sum of 1..%llu = %llu\n", (unsigned long long)n, (unsigned long long)sum);
+    printf("%d threads%s: %.6f s\n", threads, usePool ? " (pool)" : "", elapsed);
+    if (usePool)
+        work_pool_destroy(&pool);
+    free(array);
+    return 0;
+}
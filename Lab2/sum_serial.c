@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "include/parallel_sum.h"
+
+/*
+ * Usage: sum_serial [-a] n
+ * Prints 1 + 2 + ... + n, added one thread at a time. -a adds an array
+ * holding 1..n instead of the range, so memory bandwidth counts too.
+ * sum_multi_thread does the same with threads.
+ */
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int useArray = 0;
+    uint64_t *array = NULL;
+    uint64_t n, sum;
+    int c;
+
+    while ((c = getopt(argc, argv, "a")) != -1)
+    {
+        if (c != 'a')
+        {
+            fprintf(stderr, "Usage: %s [-a] n\n", argv[0]);
+            exit(1);
+        }
+        useArray = 1;
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-a] n\n", argv[0]);
+        exit(1);
+    }
+    n = strtoull(argv[optind], NULL, 10);
+
+    if (useArray)
+    {
+        if ((array = malloc(n * sizeof(uint64_t) + 1)) == NULL)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        for (uint64_t i = 0; i < n; i++)
+            array[i] = i + 1;
+    }
+
+    double start = now_seconds();
+    sum = useArray ? sum_array(array, n) : sum_range(1, n + 1);
+    double elapsed = now_seconds() - start;
+
+    printf("sum of 1..%llu = %llu\n", (unsigned long long)n, (unsigned long long)sum);
+    printf("serial: %.6f s\n", elapsed);
+    free(array);
+    return 0;
+}
@@ -0,0 +1,369 @@
+#ifndef SYNC_PRIMITIVES_H
+#define SYNC_PRIMITIVES_H
+
+/*
+ * Synchronization primitives for threads of one process.
+ *
+ *   TicketLock    spinlock that serves threads in arrival order
+ *   McsLock       queue lock; every waiter spins on its own node, so a
+ *                 release touches one waiter's cache line, not all of them
+ *   FutexMutex    mutex that stays in user space without contention and
+ *                 sleeps in the kernel with it (Drepper, "Futexes Are
+ *                 Tricky", mutex3)
+ *   RwLock        reader-writer lock; waiting writers hold new readers
+ *                 back so a steady read load cannot starve them
+ *   Semaphore     counting semaphore
+ *   BoundedQueue  fixed-size blocking producer/consumer queue built on
+ *                 FutexMutex and two Semaphores
+ *
+ * The spinning locks spin SYNC_SPINS times and then yield the CPU, so a
+ * waiter does not burn the time slice of a preempted lock holder when
+ * there are more threads than CPUs. The sleeping ones spin as long before
+ * they sleep, and their release makes the wake-up system call only when
+ * somebody sleeps. Everything is static inline; link with -pthread.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SYNC_CACHE_LINE 64
+#define SYNC_SPINS 128
+
+#if defined(__x86_64__) || defined(__i386__)
+#define sync_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define sync_relax() __asm__ __volatile__("yield")
+#else
+#define sync_relax() ((void)0)
+#endif
+
+static inline long sync_futex(uint32_t *addr, int op, uint32_t val)
+{
+    return syscall(SYS_futex, addr, op | FUTEX_PRIVATE_FLAG, val, NULL, NULL, 0);
+}
+
+/* One step of a spin-then-yield wait; spins counts the steps taken. */
+static inline void sync_pause(int *spins)
+{
+    if (++*spins < SYNC_SPINS)
+        sync_relax();
+    else
+    {
+        sched_yield();
+        *spins = 0;
+    }
+}
+
+/* ---- ticket spinlock ---- */
+
+typedef struct
+{
+    _Alignas(SYNC_CACHE_LINE) uint32_t next;
+    uint32_t serving;
+} TicketLock;
+
+#define TICKET_LOCK_INIT {0, 0}
+
+static inline void ticket_lock(TicketLock *l)
+{
+    uint32_t ticket = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+    int spins = 0;
+    while (__atomic_load_n(&l->serving, __ATOMIC_ACQUIRE) != ticket)
+        sync_pause(&spins);
+}
+
+static inline int ticket_trylock(TicketLock *l)
+{
+    uint32_t serving = __atomic_load_n(&l->serving, __ATOMIC_ACQUIRE);
+    uint32_t expected = serving;
+    return __atomic_compare_exchange_n(&l->next, &expected, serving + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ticket_unlock(TicketLock *l)
+{
+    /* Only the holder writes serving. */
+    __atomic_store_n(&l->serving, l->serving + 1, __ATOMIC_RELEASE);
+}
+
+/* ---- MCS queue lock ---- */
+
+typedef struct McsNode
+{
+    _Alignas(SYNC_CACHE_LINE) struct McsNode *next;
+    uint32_t locked;
+} McsNode;
+
+typedef struct
+{
+    _Alignas(SYNC_CACHE_LINE) McsNode *tail;
+} McsLock;
+
+#define MCS_LOCK_INIT {NULL}
+
+/* node belongs to the caller and must stay alive until mcs_unlock. */
+static inline void mcs_lock(McsLock *l, McsNode *node)
+{
+    node->next = NULL;
+    node->locked = 1;
+    McsNode *prev = __atomic_exchange_n(&l->tail, node, __ATOMIC_ACQ_REL);
+    if (prev == NULL)
+        return;
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    int spins = 0;
+    while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+        sync_pause(&spins);
+}
+
+static inline void mcs_unlock(McsLock *l, McsNode *node)
+{
+    McsNode *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (next == NULL)
+    {
+        McsNode *expected = node;
+        if (__atomic_compare_exchange_n(&l->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+        /* A successor swapped itself in but has not linked up yet. */
+        int spins = 0;
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL)
+            sync_pause(&spins);
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+/* ---- futex mutex ---- */
+
+typedef struct
+{
+    uint32_t state; /* 0 free, 1 held, 2 held with possible sleepers */
+} FutexMutex;
+
+#define FUTEX_MUTEX_INIT {0}
+
+static inline int futex_mutex_trylock(FutexMutex *m)
+{
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(&m->state, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void futex_mutex_lock(FutexMutex *m)
+{
+    for (int spin = 0; spin < SYNC_SPINS; spin++)
+    {
+        if (futex_mutex_trylock(m))
+            return;
+        sync_relax();
+    }
+    /* From here on the state says someone may sleep, so the holder wakes us. */
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0)
+        sync_futex(&m->state, FUTEX_WAIT, 2);
+}
+
+static inline void futex_mutex_unlock(FutexMutex *m)
+{
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+        sync_futex(&m->state, FUTEX_WAKE, 1);
+}
+
+/* ---- reader-writer lock ---- */
+
+#define RW_WRITER 0x80000000u
+
+typedef struct
+{
+    uint32_t state;          /* RW_WRITER, or the number of readers */
+    uint32_t writersWaiting;
+    uint32_t seq;            /* futex word, bumped by every unlock that frees the lock */
+    uint32_t sleepers;
+} RwLock;
+
+#define RW_LOCK_INIT {0, 0, 0, 0}
+
+static inline int rw_reader_blocked(RwLock *l)
+{
+    return (__atomic_load_n(&l->state, __ATOMIC_SEQ_CST) & RW_WRITER) ||
+           __atomic_load_n(&l->writersWaiting, __ATOMIC_SEQ_CST) > 0;
+}
+
+static inline int rw_writer_blocked(RwLock *l)
+{
+    return __atomic_load_n(&l->state, __ATOMIC_SEQ_CST) != 0;
+}
+
+/*
+ * Sleeps until the next unlock unless blocked(l) no longer holds once
+ * registered. seq is read first, so an unlock that slips in between makes
+ * the wait return at once instead of sleeping on a stale value.
+ */
+static inline void rw_sleep(RwLock *l, int (*blocked)(RwLock *))
+{
+    uint32_t seen = __atomic_load_n(&l->seq, __ATOMIC_ACQUIRE);
+    __atomic_fetch_add(&l->sleepers, 1, __ATOMIC_SEQ_CST);
+    if (blocked(l))
+        sync_futex(&l->seq, FUTEX_WAIT, seen);
+    __atomic_fetch_sub(&l->sleepers, 1, __ATOMIC_RELAXED);
+}
+
+/* Called after a seq_cst change of the state, which a sleeper either sees or registered before. */
+static inline void rw_wake(RwLock *l)
+{
+    __atomic_fetch_add(&l->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&l->sleepers, __ATOMIC_SEQ_CST) > 0)
+        sync_futex(&l->seq, FUTEX_WAKE, INT_MAX);
+}
+
+static inline void rw_read_lock(RwLock *l)
+{
+    int spins = 0;
+    for (;;)
+    {
+        uint32_t s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+        if (!(s & RW_WRITER) && __atomic_load_n(&l->writersWaiting, __ATOMIC_RELAXED) == 0)
+        {
+            if (__atomic_compare_exchange_n(&l->state, &s, s + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return;
+            continue;
+        }
+        if (++spins < SYNC_SPINS)
+            sync_relax();
+        else
+            rw_sleep(l, rw_reader_blocked);
+    }
+}
+
+static inline void rw_read_unlock(RwLock *l)
+{
+    if (__atomic_sub_fetch(&l->state, 1, __ATOMIC_SEQ_CST) == 0)
+        rw_wake(l);
+}
+
+static inline void rw_write_lock(RwLock *l)
+{
+    int spins = 0;
+    __atomic_fetch_add(&l->writersWaiting, 1, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        uint32_t s = 0;
+        if (__atomic_compare_exchange_n(&l->state, &s, RW_WRITER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        if (++spins < SYNC_SPINS)
+            sync_relax();
+        else
+            rw_sleep(l, rw_writer_blocked);
+    }
+    __atomic_fetch_sub(&l->writersWaiting, 1, __ATOMIC_RELAXED);
+}
+
+static inline void rw_write_unlock(RwLock *l)
+{
+    __atomic_store_n(&l->state, 0, __ATOMIC_SEQ_CST);
+    rw_wake(l);
+}
+
+/* ---- counting semaphore ---- */
+
+typedef struct
+{
+    uint32_t value;
+    uint32_t sleepers;
+} Semaphore;
+
+static inline void semaphore_init(Semaphore *s, uint32_t value)
+{
+    s->value = value;
+    s->sleepers = 0;
+}
+
+static inline int semaphore_trywait(Semaphore *s)
+{
+    uint32_t v = __atomic_load_n(&s->value, __ATOMIC_RELAXED);
+    while (v > 0)
+        if (__atomic_compare_exchange_n(&s->value, &v, v - 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 1;
+    return 0;
+}
+
+static inline void semaphore_wait(Semaphore *s)
+{
+    for (int spin = 0;; spin++)
+    {
+        if (semaphore_trywait(s))
+            return;
+        if (spin < SYNC_SPINS)
+            sync_relax();
+        else
+        {
+            __atomic_fetch_add(&s->sleepers, 1, __ATOMIC_SEQ_CST);
+            sync_futex(&s->value, FUTEX_WAIT, 0);
+            __atomic_fetch_sub(&s->sleepers, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static inline void semaphore_post(Semaphore *s)
+{
+    __atomic_fetch_add(&s->value, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->sleepers, __ATOMIC_SEQ_CST) > 0)
+        sync_futex(&s->value, FUTEX_WAKE, 1);
+}
+
+/* ---- bounded blocking queue ---- */
+
+typedef struct
+{
+    FutexMutex lock;
+    Semaphore slots; /* free entries */
+    Semaphore items; /* filled entries */
+    size_t capacity;
+    size_t head;
+    size_t tail;
+    void **entries;
+} BoundedQueue;
+
+/* Returns 0, or -1 when the entries cannot be allocated. */
+static inline int bounded_queue_init(BoundedQueue *q, size_t capacity)
+{
+    memset(q, 0, sizeof(*q));
+    if (capacity == 0 || (q->entries = malloc(capacity * sizeof(void *))) == NULL)
+        return -1;
+    q->capacity = capacity;
+    semaphore_init(&q->slots, capacity);
+    semaphore_init(&q->items, 0);
+    return 0;
+}
+
+static inline void bounded_queue_destroy(BoundedQueue *q)
+{
+    free(q->entries);
+    q->entries = NULL;
+}
+
+/* Blocks while the queue is full. */
+static inline void bounded_queue_put(BoundedQueue *q, void *item)
+{
+    semaphore_wait(&q->slots);
+    futex_mutex_lock(&q->lock);
+    q->entries[q->tail] = item;
+    q->tail = q->tail + 1 == q->capacity ? 0 : q->tail + 1;
+    futex_mutex_unlock(&q->lock);
+    semaphore_post(&q->items);
+}
+
+/* Blocks while the queue is empty. */
+static inline void *bounded_queue_get(BoundedQueue *q)
+{
+    semaphore_wait(&q->items);
+    futex_mutex_lock(&q->lock);
+    void *item = q->entries[q->head];
+    q->head = q->head + 1 == q->capacity ? 0 : q->head + 1;
+    futex_mutex_unlock(&q->lock);
+    semaphore_post(&q->slots);
+    return item;
+}
+
+#endif
@@ -0,0 +1,462 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "include/sync_primitives.h"
+
+/*
+ * Usage: sync_bench [-t 1,2,4,8] [-d ms] [-w work]
+ *
+ * Contention benchmark for include/sync_primitives.h. Every primitive runs
+ * next to its pthread equivalent for -d milliseconds (default 200) at each
+ * thread count of -t; a thread repeats one operation followed by -w
+ * (default 50) steps of private work, which sets how often the threads
+ * collide. The table holds millions of operations per second.
+ *
+ *   ticket, mcs, futex_mutex   lock, bump a shared counter, unlock;
+ *   pthread_spin/_mutex        against pthread_spinlock_t/pthread_mutex_t
+ *   rwlock                     9 reads of the counter per write;
+ *   pthread_rwlock             against pthread_rwlock_t
+ *   semaphore                  take one of SEM_PERMITS permits and give it
+ *   sem_t                      back; against a POSIX semaphore
+ *   queue                      put a token into a QUEUE_CAPACITY queue and
+ *   pthread_queue              take one out; against a queue guarded by a
+ *                              pthread mutex and two condition variables
+ *
+ * The last column checks the primitive did its job: the counter matches
+ * the writes, no more than SEM_PERMITS threads held a permit at once, and
+ * the tokens taken add up to the tokens put.
+ */
+
+#define MAX_THREADS 64
+#define MAX_COUNTS 16
+#define SEM_PERMITS 2
+#define QUEUE_CAPACITY 64
+#define READS_PER_WRITE 9
+
+typedef struct Bench Bench;
+
+typedef struct
+{
+    _Alignas(SYNC_CACHE_LINE) Bench *bench;
+    int index;
+    uint64_t ops;
+    uint64_t rng;
+    uint64_t put;   /* sum of tokens put, queues only */
+    uint64_t taken; /* sum of tokens taken */
+    McsNode node;
+} Worker;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t notFull;
+    pthread_cond_t notEmpty;
+    size_t head, count;
+    void *entries[QUEUE_CAPACITY];
+} PthreadQueue;
+
+struct Bench
+{
+    _Alignas(SYNC_CACHE_LINE) uint64_t counter; /* guarded by the primitive */
+    uint64_t writes;
+    uint32_t inside; /* permit holders */
+    uint32_t mostInside;
+    uint32_t torn;   /* a reader saw a write half done */
+    _Alignas(SYNC_CACHE_LINE) int stop;
+    int ready;
+    int work;
+
+    TicketLock ticket;
+    McsLock mcs;
+    FutexMutex futexMutex;
+    RwLock rw;
+    Semaphore sem;
+    BoundedQueue queue;
+    pthread_spinlock_t pspin;
+    pthread_mutex_t pmutex;
+    pthread_rwlock_t prw;
+    sem_t psem;
+    PthreadQueue pqueue;
+};
+
+typedef struct
+{
+    const char *name;
+    void (*op)(Bench *, Worker *);
+} Primitive;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void critical(Bench *b)
+{
+    b->counter++;
+    b->writes++;
+}
+
+static void op_ticket(Bench *b, Worker *w)
+{
+    (void)w;
+    ticket_lock(&b->ticket);
+    critical(b);
+    ticket_unlock(&b->ticket);
+}
+
+static void op_pthread_spin(Bench *b, Worker *w)
+{
+    (void)w;
+    pthread_spin_lock(&b->pspin);
+    critical(b);
+    pthread_spin_unlock(&b->pspin);
+}
+
+static void op_mcs(Bench *b, Worker *w)
+{
+    mcs_lock(&b->mcs, &w->node);
+    critical(b);
+    mcs_unlock(&b->mcs, &w->node);
+}
+
+static void op_futex_mutex(Bench *b, Worker *w)
+{
+    (void)w;
+    futex_mutex_lock(&b->futexMutex);
+    critical(b);
+    futex_mutex_unlock(&b->futexMutex);
+}
+
+static void op_pthread_mutex(Bench *b, Worker *w)
+{
+    (void)w;
+    pthread_mutex_lock(&b->pmutex);
+    critical(b);
+    pthread_mutex_unlock(&b->pmutex);
+}
+
+/* Readers check the counter against the writes, which a torn write breaks. */
+static void read_counter(Bench *b)
+{
+    if (b->counter != b->writes)
+        __atomic_store_n(&b->torn, 1, __ATOMIC_RELAXED);
+}
+
+static void op_rwlock(Bench *b, Worker *w)
+{
+    if (w->ops % (READS_PER_WRITE + 1) == 0)
+    {
+        rw_write_lock(&b->rw);
+        critical(b);
+        rw_write_unlock(&b->rw);
+    }
+    else
+    {
+        rw_read_lock(&b->rw);
+        read_counter(b);
+        rw_read_unlock(&b->rw);
+    }
+}
+
+static void op_pthread_rwlock(Bench *b, Worker *w)
+{
+    if (w->ops % (READS_PER_WRITE + 1) == 0)
+    {
+        pthread_rwlock_wrlock(&b->prw);
+        critical(b);
+        pthread_rwlock_unlock(&b->prw);
+    }
+    else
+    {
+        pthread_rwlock_rdlock(&b->prw);
+        read_counter(b);
+        pthread_rwlock_unlock(&b->prw);
+    }
+}
+
+static void hold_permit(Bench *b)
+{
+    uint32_t inside = __atomic_add_fetch(&b->inside, 1, __ATOMIC_RELAXED);
+    uint32_t most = __atomic_load_n(&b->mostInside, __ATOMIC_RELAXED);
+    while (inside > most && !__atomic_compare_exchange_n(&b->mostInside, &most, inside, 1, __ATOMIC_RELAXED,
+                                                         __ATOMIC_RELAXED))
+        ;
+    __atomic_sub_fetch(&b->inside, 1, __ATOMIC_RELAXED);
+}
+
+static void op_semaphore(Bench *b, Worker *w)
+{
+    (void)w;
+    semaphore_wait(&b->sem);
+    hold_permit(b);
+    semaphore_post(&b->sem);
+}
+
+static void op_sem_t(Bench *b, Worker *w)
+{
+    (void)w;
+    sem_wait(&b->psem);
+    hold_permit(b);
+    sem_post(&b->psem);
+}
+
+/*
+ * Every thread puts a token and then takes one, not necessarily its own.
+ * Items in the queue never drop below the threads waiting to take one and
+ * never exceed the thread count, so with QUEUE_CAPACITY >= threads nobody
+ * blocks for good.
+ */
+static void op_queue(Bench *b, Worker *w)
+{
+    uintptr_t token = (uintptr_t)w->index << 32 | (w->ops & 0xffffffffu);
+    w->put += token;
+    bounded_queue_put(&b->queue, (void *)token);
+    w->taken += (uintptr_t)bounded_queue_get(&b->queue);
+}
+
+static void pthread_queue_put(PthreadQueue *q, void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == QUEUE_CAPACITY)
+        pthread_cond_wait(&q->notFull, &q->lock);
+    q->entries[(q->head + q->count++) % QUEUE_CAPACITY] = item;
+    pthread_cond_signal(&q->notEmpty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *pthread_queue_get(PthreadQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0)
+        pthread_cond_wait(&q->notEmpty, &q->lock);
+    void *item = q->entries[q->head];
+    q->head = (q->head + 1) % QUEUE_CAPACITY;
+    q->count--;
+    pthread_cond_signal(&q->notFull);
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static void op_pthread_queue(Bench *b, Worker *w)
+{
+    uintptr_t token = (uintptr_t)w->index << 32 | (w->ops & 0xffffffffu);
+    w->put += token;
+    pthread_queue_put(&b->pqueue, (void *)token);
+    w->taken += (uintptr_t)pthread_queue_get(&b->pqueue);
+}
+
+static const Primitive primitives[] = {
+    {"ticket", op_ticket},
+    {"pthread_spin", op_pthread_spin},
+    {"mcs", op_mcs},
+    {"futex_mutex", op_futex_mutex},
+    {"pthread_mutex", op_pthread_mutex},
+    {"rwlock", op_rwlock},
+    {"pthread_rwlock", op_pthread_rwlock},
+    {"semaphore", op_semaphore},
+    {"sem_t", op_sem_t},
+    {"queue", op_queue},
+    {"pthread_queue", op_pthread_queue},
+};
+
+static const Primitive *current;
+
+static void *worker_main(void *arg)
+{
+    Worker *w = arg;
+    Bench *b = w->bench;
+    void (*op)(Bench *, Worker *) = current->op;
+    uint64_t x = w->rng;
+
+    while (!__atomic_load_n(&b->ready, __ATOMIC_ACQUIRE))
+        sync_relax();
+    while (!__atomic_load_n(&b->stop, __ATOMIC_RELAXED))
+    {
+        op(b, w);
+        w->ops++;
+        for (int i = 0; i < b->work; i++)
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    w->rng = x; /* keeps the private work */
+    return NULL;
+}
+
+static void reset(Bench *b)
+{
+    b->counter = b->writes = 0;
+    b->inside = b->mostInside = b->torn = 0;
+    b->stop = b->ready = 0;
+    b->ticket = (TicketLock)TICKET_LOCK_INIT;
+    b->mcs = (McsLock)MCS_LOCK_INIT;
+    b->futexMutex = (FutexMutex)FUTEX_MUTEX_INIT;
+    b->rw = (RwLock)RW_LOCK_INIT;
+    semaphore_init(&b->sem, SEM_PERMITS);
+    sem_destroy(&b->psem);
+    sem_init(&b->psem, 0, SEM_PERMITS);
+    bounded_queue_destroy(&b->queue);
+    b->pqueue.head = b->pqueue.count = 0;
+    if (bounded_queue_init(&b->queue, QUEUE_CAPACITY) != 0)
+    {
+        perror("bounded_queue_init");
+        exit(1);
+    }
+}
+
+/* Runs current on threads threads for seconds; returns ops/s, or -1 when the check fails. */
+static double run(Bench *b, Worker *workers, int threads, double seconds)
+{
+    pthread_t tids[MAX_THREADS];
+    struct timespec pause = {(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+
+    reset(b);
+    for (int t = 0; t < threads; t++)
+    {
+        memset(&workers[t], 0, sizeof(Worker));
+        workers[t].bench = b;
+        workers[t].index = t;
+        workers[t].rng = t + 1;
+        if (pthread_create(&tids[t], NULL, worker_main, &workers[t]) != 0)
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    double start = now_seconds();
+    __atomic_store_n(&b->ready, 1, __ATOMIC_RELEASE);
+    nanosleep(&pause, NULL);
+    __atomic_store_n(&b->stop, 1, __ATOMIC_RELAXED);
+
+    uint64_t ops = 0, put = 0, taken = 0;
+    int ok = 1;
+    for (int t = 0; t < threads; t++)
+    {
+        pthread_join(tids[t], NULL);
+        ops += workers[t].ops;
+        put += workers[t].put;
+        taken += workers[t].taken;
+    }
+    double elapsed = now_seconds() - start;
+
+    if (b->counter != b->writes || b->torn || b->mostInside > SEM_PERMITS || put != taken)
+        ok = 0;
+    if (current->op != op_rwlock && current->op != op_pthread_rwlock && b->writes != 0 && b->writes != ops)
+        ok = 0;
+    return ok ? ops / elapsed : -1;
+}
+
+/* Parses "1,2,4,8" into counts; returns how many, or -1. */
+static int parse_counts(const char *list, int *counts)
+{
+    int n = 0;
+    char *end;
+    for (const char *p = list; *p != '\0'; p = *end == ',' ? end + 1 : end)
+    {
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 1 || v > MAX_THREADS || n == MAX_COUNTS || (*end != ',' && *end != '\0'))
+            return -1;
+        counts[n++] = (int)v;
+    }
+    return n;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t 1,2,4,8] [-d ms] [-w work]\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int counts[MAX_COUNTS] = {1, 2, 4, 8};
+    int ncounts = 4;
+    long ms = 200;
+    int work = 50;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:d:w:")) != -1)
+    {
+        if (c == 't')
+        {
+            if ((ncounts = parse_counts(optarg, counts)) < 1)
+                usage(argv[0]);
+        }
+        else if (c == 'd')
+            ms = strtol(optarg, NULL, 10);
+        else if (c == 'w')
+            work = atoi(optarg);
+        else
+            usage(argv[0]);
+    }
+    if (ms < 1 || work < 0)
+        usage(argv[0]);
+    for (int i = 0; i < ncounts; i++)
+        if (counts[i] > QUEUE_CAPACITY)
+            usage(argv[0]);
+
+    Bench *b = aligned_alloc(SYNC_CACHE_LINE, sizeof(Bench));
+    Worker *workers = aligned_alloc(SYNC_CACHE_LINE, MAX_THREADS * sizeof(Worker));
+    if (b == NULL || workers == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    memset(b, 0, sizeof(*b));
+    b->work = work;
+    pthread_spin_init(&b->pspin, PTHREAD_PROCESS_PRIVATE);
+    pthread_mutex_init(&b->pmutex, NULL);
+    pthread_rwlock_init(&b->prw, NULL);
+    sem_init(&b->psem, 0, SEM_PERMITS);
+    pthread_mutex_init(&b->pqueue.lock, NULL);
+    pthread_cond_init(&b->pqueue.notFull, NULL);
+    pthread_cond_init(&b->pqueue.notEmpty, NULL);
+
+    printf("Mops/s, %ld ms per cell, %d steps of private work per op, %ld online CPUs\n", ms, work,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-15s", "threads");
+    for (int i = 0; i < ncounts; i++)
+        printf(" %9d", counts[i]);
+    printf("  check\n");
+
+    int failed = 0;
+    for (size_t p = 0; p < sizeof(primitives) / sizeof(primitives[0]); p++)
+    {
+        int ok = 1;
+        current = &primitives[p];
+        printf("%-15s", current->name);
+        fflush(stdout);
+        for (int i = 0; i < ncounts; i++)
+        {
+            double rate = run(b, workers, counts[i], ms / 1e3);
+            if (rate < 0)
+            {
+                ok = 0;
+                printf(" %9s", "-");
+            }
+            else
+                printf(" %9.2f", rate / 1e6);
+            fflush(stdout);
+        }
+        printf("  %s\n", ok ? "ok" : "FAIL");
+        failed |= !ok;
+    }
+
+    bounded_queue_destroy(&b->queue);
+    sem_destroy(&b->psem);
+    pthread_spin_destroy(&b->pspin);
+    pthread_mutex_destroy(&b->pmutex);
+    pthread_rwlock_destroy(&b->prw);
+    pthread_mutex_destroy(&b->pqueue.lock);
+    pthread_cond_destroy(&b->pqueue.notFull);
+    pthread_cond_destroy(&b->pqueue.notEmpty);
+    free(workers);
+    free(b);
+    return failed;
+}